@@ -1,16 +1,15 @@
 #pragma once
-#include <cstddef>
 
-#ifdef __SSE3__
-#include <immintrin.h>
-#include <cassert>
+#include "distance_kernels.hpp"
 
-#endif
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <sys/types.h>
 
-#ifdef __aarch64__
-#include <arm_neon.h>
-#endif
 
+// Reference implementations. They define the result of every kernel and back the kScalar table;
+// the SIMD variants in distance_kernels_*.cpp are checked against them.
 
 inline float fvecL2sqrRef(const float* x, const float* y, size_t d) {
     size_t i;
@@ -38,228 +37,296 @@ inline float fvecInnerProductRef(const float* x, const float* y, size_t d) {
     return res;
 }
 
-#ifdef __SSE3__
-
-// reads 0 <= d < 4 floats as __m128
-static inline __m128 maskedRead(int d, const float* x) {
-    assert(0 <= d && d < 4);
-//    ALIGNED(16)
-    float buf[4] = {0, 0, 0, 0};
-    switch (d) {
-        case 3:
-            buf[2] = x[2];
-        case 2:
-            buf[1] = x[1];
-        case 1:
-            buf[0] = x[0];
+// squared L2 from one vector x to 4 vectors y0..y3, x is loaded once per step
+inline void fvecL2sqrBatch4Ref(const float* x, const float* y0, const float* y1, const float* y2,
+                               const float* y3, size_t d, float& dis0, float& dis1, float& dis2, float& dis3) {
+    float d0 = 0, d1 = 0, d2 = 0, d3 = 0;
+    for (size_t i = 0; i < d; ++i) {
+        const float q0 = x[i] - y0[i];
+        const float q1 = x[i] - y1[i];
+        const float q2 = x[i] - y2[i];
+        const float q3 = x[i] - y3[i];
+        d0 += q0 * q0;
+        d1 += q1 * q1;
+        d2 += q2 * q2;
+        d3 += q3 * q3;
     }
-    return _mm_load_ps(buf);
-    // cannot use AVX2 _mm_mask_set1_epi32
+    dis0 = d0;
+    dis1 = d1;
+    dis2 = d2;
+    dis3 = d3;
 }
 
-inline float fvecNormL2sqr(const float* x, size_t d) {
-    __m128 mx;
-    __m128 msum1 = _mm_setzero_ps();
-
-    while (d >= 4) {
-        mx = _mm_loadu_ps(x);
-        x += 4;
-        msum1 = _mm_add_ps(msum1, _mm_mul_ps(mx, mx));
-        d -= 4;
+// Distances from x to n vectors stored contiguously, row j starts at y + j * d. The SIMD variants score four
+// rows per pass so every chunk of x is loaded once for all of them and reductions happen once per row.
+inline void fvecL2sqrNyRef(const float* x, const float* y, size_t n, size_t d, float* dis) {
+    for (size_t j = 0; j < n; ++j) {
+        dis[j] = fvecL2sqrRef(x, y + j * d, d);
     }
-
-    mx = maskedRead(d, x);
-    msum1 = _mm_add_ps(msum1, _mm_mul_ps(mx, mx));
-
-    msum1 = _mm_hadd_ps(msum1, msum1);
-    msum1 = _mm_hadd_ps(msum1, msum1);
-    return _mm_cvtss_f32(msum1);
 }
 
-#endif
+// Inner products of x with n contiguous vectors, see fvecL2sqrNy.
+inline void fvecInnerProductNyRef(const float* x, const float* y, size_t n, size_t d, float* dis) {
+    for (size_t j = 0; j < n; ++j) {
+        dis[j] = fvecInnerProductRef(x, y + j * d, d);
+    }
+}
 
-#ifdef __AVX__
+// Distances from x to the kBlockedLanes = 8 vectors of a column-blocked group: component i of vector j
+// is block[i * 8 + j], so one load covers the same component of all eight vectors.
+inline void fvecL2sqrBlocked8Ref(const float* x, const float* block, size_t d, float* dis) {
+    float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (size_t i = 0; i < d; ++i) {
+        for (size_t j = 0; j < 8; ++j) {
+            const float diff = x[i] - block[i * 8 + j];
+            acc[j] += diff * diff;
+        }
+    }
+    for (size_t j = 0; j < 8; ++j) {
+        dis[j] = acc[j];
+    }
+}
 
-inline float fvecInnerProduct(const float* x, const float* y, size_t d) {
-    __m256 msum1 = _mm256_setzero_ps();
-
-    while (d >= 8) {
-        __m256 mx = _mm256_loadu_ps(x);
-        x += 8;
-        __m256 my = _mm256_loadu_ps(y);
-        y += 8;
-        msum1 = _mm256_add_ps(msum1, _mm256_mul_ps(mx, my));
-        d -= 8;
+// Inner products of x with the 8 vectors of a column-blocked group, see fvecL2sqrBlocked8.
+inline void fvecInnerProductBlocked8Ref(const float* x, const float* block, size_t d, float* dis) {
+    float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (size_t i = 0; i < d; ++i) {
+        for (size_t j = 0; j < 8; ++j) {
+            acc[j] += x[i] * block[i * 8 + j];
+        }
     }
+    for (size_t j = 0; j < 8; ++j) {
+        dis[j] = acc[j];
+    }
+}
 
-    __m128 msum2 = _mm256_extractf128_ps(msum1, 1);
-    msum2 = _mm_add_ps(msum2, _mm256_extractf128_ps(msum1, 0));
+// Inner products of 4 queries with the 8 vectors of a column-blocked group. Query q is the row x + q * d, dis
+// receives 4 rows of 8 products, dis[q * 8 + j] for vector j. Every load of the group is used by all 4 queries.
+inline void fvecInnerProductBlocked4x8Ref(const float* x, const float* block, size_t d, float* dis) {
+    for (size_t q = 0; q < 4; ++q) {
+        fvecInnerProductBlocked8Ref(x + q * d, block, d, dis + q * 8);
+    }
+}
 
-    if (d >= 4) {
-        __m128 mx = _mm_loadu_ps(x);
-        x += 4;
-        __m128 my = _mm_loadu_ps(y);
-        y += 4;
-        msum2 = _mm_add_ps(msum2, _mm_mul_ps(mx, my));
-        d -= 4;
+// Integer vectors. u8 and i8 components differ by at most 255, squares and products are summed exactly in
+// 32 bits, which holds for any realistic dimension. i16 products need more, they are summed in 64 bits here and
+// in float by the SIMD variants.
+inline float u8L2sqrRef(const u_int8_t* x, const u_int8_t* y, size_t d) {
+    u_int32_t res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        const int32_t tmp = static_cast<int32_t>(x[i]) - static_cast<int32_t>(y[i]);
+        res += static_cast<u_int32_t>(tmp * tmp);
     }
+    return static_cast<float>(res);
+}
 
-    if (d > 0) {
-        __m128 mx = masked_read(d, x);
-        __m128 my = masked_read(d, y);
-        msum2 = _mm_add_ps(msum2, _mm_mul_ps(mx, my));
+inline float u8InnerProductRef(const u_int8_t* x, const u_int8_t* y, size_t d) {
+    u_int32_t res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        res += static_cast<u_int32_t>(x[i]) * static_cast<u_int32_t>(y[i]);
     }
+    return static_cast<float>(res);
+}
 
-    msum2 = _mm_hadd_ps(msum2, msum2);
-    msum2 = _mm_hadd_ps(msum2, msum2);
-    return _mm_cvtss_f32(msum2);
+inline float i8L2sqrRef(const int8_t* x, const int8_t* y, size_t d) {
+    u_int32_t res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        const int32_t tmp = static_cast<int32_t>(x[i]) - static_cast<int32_t>(y[i]);
+        res += static_cast<u_int32_t>(tmp * tmp);
+    }
+    return static_cast<float>(res);
 }
 
-inline float fvecL2sqr(const float* x, const float* y, size_t d) {
-    __m256 msum1 = _mm256_setzero_ps();
-
-    while (d >= 8) {
-        __m256 mx = _mm256_loadu_ps(x);
-        x += 8;
-        __m256 my = _mm256_loadu_ps(y);
-        y += 8;
-        const __m256 a_m_b1 = _mm256_sub_ps(mx, my);
-        msum1 = _mm256_add_ps(msum1, _mm256_mul_ps(a_m_b1, a_m_b1));
-        d -= 8;
+inline float i8InnerProductRef(const int8_t* x, const int8_t* y, size_t d) {
+    int32_t res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        res += static_cast<int32_t>(x[i]) * static_cast<int32_t>(y[i]);
     }
+    return static_cast<float>(res);
+}
 
-    __m128 msum2 = _mm256_extractf128_ps(msum1, 1);
-    msum2 = _mm_add_ps(msum2, _mm256_extractf128_ps(msum1, 0));
-
-    if (d >= 4) {
-        __m128 mx = _mm_loadu_ps(x);
-        x += 4;
-        __m128 my = _mm_loadu_ps(y);
-        y += 4;
-        const __m128 a_m_b1 = _mm_sub_ps(mx, my);
-        msum2 = _mm_add_ps(msum2, _mm_mul_ps(a_m_b1, a_m_b1));
-        d -= 4;
+inline float i16L2sqrRef(const int16_t* x, const int16_t* y, size_t d) {
+    u_int64_t res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        const int64_t tmp = static_cast<int64_t>(x[i]) - static_cast<int64_t>(y[i]);
+        res += static_cast<u_int64_t>(tmp * tmp);
     }
+    return static_cast<float>(res);
+}
 
-    if (d > 0) {
-        __m128 mx = masked_read(d, x);
-        __m128 my = masked_read(d, y);
-        __m128 a_m_b1 = _mm_sub_ps(mx, my);
-        msum2 = _mm_add_ps(msum2, _mm_mul_ps(a_m_b1, a_m_b1));
+inline float i16InnerProductRef(const int16_t* x, const int16_t* y, size_t d) {
+    int64_t res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        res += static_cast<int64_t>(x[i]) * static_cast<int64_t>(y[i]);
     }
+    return static_cast<float>(res);
+}
 
-    msum2 = _mm_hadd_ps(msum2, msum2);
-    msum2 = _mm_hadd_ps(msum2, msum2);
-    return _mm_cvtss_f32(msum2);
+// Asymmetric distance of a product quantization code: the sum of lut[j * 256 + code[j]] over the m
+// sub-quantizers, lut holds the distances from the query to every sub-centroid.
+inline float pqAdcDistanceRef(const float* lut, const u_int8_t* code, size_t m) {
+    float d0 = 0, d1 = 0, d2 = 0, d3 = 0;
+    size_t j = 0;
+    for (; j + 4 <= m; j += 4) {
+        d0 += lut[j * 256 + code[j]];
+        d1 += lut[(j + 1) * 256 + code[j + 1]];
+        d2 += lut[(j + 2) * 256 + code[j + 2]];
+        d3 += lut[(j + 3) * 256 + code[j + 3]];
+    }
+    for (; j < m; ++j) {
+        d0 += lut[j * 256 + code[j]];
+    }
+    return (d0 + d1) + (d2 + d3);
 }
 
+// Squared L2 distance from x to an 8-bit scalar quantized vector, component i decodes to
+// vmin[i] + code[i] * scale[i].
+inline float sq8L2sqrRef(const float* x, const u_int8_t* code, const float* vmin, const float* scale, size_t d) {
+    float res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        const float tmp = x[i] - (vmin[i] + static_cast<float>(code[i]) * scale[i]);
+        res += tmp * tmp;
+    }
+    return res;
+}
 
-#elif defined(__SSE3__) // But not AVX
+// IEEE 754 binary16 conversions, round to nearest even
+inline u_int16_t floatToHalf(float f) {
+    u_int32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const u_int32_t sign = (x >> 16) & 0x8000;
+    const u_int32_t floatExp = (x >> 23) & 0xff;
+    u_int32_t mant = x & 0x7fffff;
+    if (floatExp == 0xff) {
+        return sign | 0x7c00 | (mant != 0 ? 0x200 : 0);
+    }
+    const int exp = static_cast<int>(floatExp) - 127 + 15;
+    if (exp >= 31) {
+        return sign | 0x7c00;
+    }
+    if (exp <= 0) {
+        if (exp < -10) {
+            return sign;
+        }
+        mant |= 0x800000;
+        const u_int32_t shift = 14 - exp;
+        u_int32_t half = mant >> shift;
+        const u_int32_t rest = mant & ((1u << shift) - 1);
+        const u_int32_t middle = 1u << (shift - 1);
+        half += rest > middle || (rest == middle && (half & 1));
+        return sign | half;
+    }
+    u_int32_t half = (static_cast<u_int32_t>(exp) << 10) | (mant >> 13);
+    const u_int32_t rest = mant & 0x1fff;
+    // a carry out of the mantissa correctly bumps the exponent, up to infinity
+    half += rest > 0x1000 || (rest == 0x1000 && (half & 1));
+    return sign | half;
+}
 
-inline float fvecL2sqr(const float* x, const float* y, size_t d) {
-    __m128 msum1 = _mm_setzero_ps();
-
-    while (d >= 4) {
-        __m128 mx = _mm_loadu_ps(x);
-        x += 4;
-        __m128 my = _mm_loadu_ps(y);
-        y += 4;
-        const __m128 a_m_b1 = _mm_sub_ps(mx, my);
-        msum1 = _mm_add_ps(msum1, _mm_mul_ps(a_m_b1, a_m_b1));
-        d -= 4;
+inline float halfToFloat(u_int16_t h) {
+    const u_int32_t sign = static_cast<u_int32_t>(h & 0x8000) << 16;
+    const u_int32_t exp = (h >> 10) & 0x1f;
+    const u_int32_t mant = h & 0x3ff;
+    u_int32_t x;
+    if (exp == 0) {
+        const float subnormal = std::ldexp(static_cast<float>(mant), -24);
+        return sign != 0 ? -subnormal : subnormal;
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
     }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
 
-    if (d > 0) {
-        // add the last 1, 2 or 3 values
-        __m128 mx = maskedRead(d, x);
-        __m128 my = maskedRead(d, y);
-        __m128 a_m_b1 = _mm_sub_ps(mx, my);
-        msum1 = _mm_add_ps(msum1, _mm_mul_ps(a_m_b1, a_m_b1));
+// Squared L2 distance from x to a vector stored in half precision.
+inline float fp16L2sqrRef(const float* x, const u_int16_t* code, size_t d) {
+    float res = 0;
+    for (size_t i = 0; i < d; ++i) {
+        const float tmp = x[i] - halfToFloat(code[i]);
+        res += tmp * tmp;
     }
+    return res;
+}
 
-    msum1 = _mm_hadd_ps(msum1, msum1);
-    msum1 = _mm_hadd_ps(msum1, msum1);
-    return _mm_cvtss_f32(msum1);
+// Kernels of the best instruction set of the running CPU, see distance_kernels.hpp.
+
+inline float fvecL2sqr(const float* x, const float* y, size_t d) {
+    return getDistanceKernels().l2sqr(x, y, d);
 }
 
 inline float fvecInnerProduct(const float* x, const float* y, size_t d) {
-    __m128 mx, my;
-    __m128 msum1 = _mm_setzero_ps();
-
-    while (d >= 4) {
-        mx = _mm_loadu_ps(x);
-        x += 4;
-        my = _mm_loadu_ps(y);
-        y += 4;
-        msum1 = _mm_add_ps(msum1, _mm_mul_ps(mx, my));
-        d -= 4;
-    }
+    return getDistanceKernels().innerProduct(x, y, d);
+}
 
-    // add the last 1, 2, or 3 values
-    mx = maskedRead(d, x);
-    my = maskedRead(d, y);
-    __m128 prod = _mm_mul_ps(mx, my);
+inline float fvecNormL2sqr(const float* x, size_t d) {
+    return getDistanceKernels().normL2sqr(x, d);
+}
 
-    msum1 = _mm_add_ps(msum1, prod);
+inline void fvecL2sqrBatch4(const float* x, const float* y0, const float* y1, const float* y2,
+                            const float* y3, size_t d, float& dis0, float& dis1, float& dis2, float& dis3) {
+    float dis[4];
+    getDistanceKernels().l2sqrBatch4(x, y0, y1, y2, y3, d, dis);
+    dis0 = dis[0];
+    dis1 = dis[1];
+    dis2 = dis[2];
+    dis3 = dis[3];
+}
 
-    msum1 = _mm_hadd_ps(msum1, msum1);
-    msum1 = _mm_hadd_ps(msum1, msum1);
-    return _mm_cvtss_f32(msum1);
+inline void fvecL2sqrNy(const float* x, const float* y, size_t n, size_t d, float* dis) {
+    getDistanceKernels().l2sqrNy(x, y, n, d, dis);
 }
 
-#elif defined(__aarch64__)
+inline void fvecInnerProductNy(const float* x, const float* y, size_t n, size_t d, float* dis) {
+    getDistanceKernels().innerProductNy(x, y, n, d, dis);
+}
 
-inline float fvecL2sqr(const float* x, const float* y, size_t d) {
-    if (d & 3)
-        return fvecL2sqr_ref(x, y, d);
-    float32x4_t accu = vdupq_n_f32(0);
-    for (size_t i = 0; i < d; i += 4) {
-        float32x4_t xi = vld1q_f32(x + i);
-        float32x4_t yi = vld1q_f32(y + i);
-        float32x4_t sq = vsubq_f32(xi, yi);
-        accu = vfmaq_f32(accu, sq, sq);
-    }
-    float32x4_t a2 = vpaddq_f32(accu, accu);
-    return vdups_laneq_f32(a2, 0) + vdups_laneq_f32(a2, 1);
+inline void fvecL2sqrBlocked8(const float* x, const float* block, size_t d, float* dis) {
+    getDistanceKernels().l2sqrBlocked8(x, block, d, dis);
 }
 
-inline float fvecInnerProduct(const float* x, const float* y, size_t d) {
-    if (d & 3)
-        return fvecInnerProductRef(x, y, d);
-    float32x4_t accu = vdupq_n_f32(0);
-    for (size_t i = 0; i < d; i += 4) {
-        float32x4_t xi = vld1q_f32(x + i);
-        float32x4_t yi = vld1q_f32(y + i);
-        accu = vfmaq_f32(accu, xi, yi);
-    }
-    float32x4_t a2 = vpaddq_f32(accu, accu);
-    return vdups_laneq_f32(a2, 0) + vdups_laneq_f32(a2, 1);
+inline void fvecInnerProductBlocked8(const float* x, const float* block, size_t d, float* dis) {
+    getDistanceKernels().innerProductBlocked8(x, block, d, dis);
 }
 
-inline float fvecNormL2sqr(const float* x, size_t d) {
-    if (d & 3)
-        return fvecNormL2sqrRef(x, d);
-    float32x4_t accu = vdupq_n_f32(0);
-    for (size_t i = 0; i < d; i += 4) {
-        float32x4_t xi = vld1q_f32(x + i);
-        accu = vfmaq_f32(accu, xi, xi);
-    }
-    float32x4_t a2 = vpaddq_f32(accu, accu);
-    return vdups_laneq_f32(a2, 0) + vdups_laneq_f32(a2, 1);
+inline void fvecInnerProductBlocked4x8(const float* x, const float* block, size_t d, float* dis) {
+    getDistanceKernels().innerProductBlocked4x8(x, block, d, dis);
 }
 
-#else
-// scalar implementation
+inline float u8L2sqr(const u_int8_t* x, const u_int8_t* y, size_t d) {
+    return getDistanceKernels().u8L2sqr(x, y, d);
+}
 
-inline float fvecL2sqr(const float* x, const float* y, size_t d) {
-    return fvecL2sqrRef(x, y, d);
+inline float u8InnerProduct(const u_int8_t* x, const u_int8_t* y, size_t d) {
+    return getDistanceKernels().u8InnerProduct(x, y, d);
 }
 
-inline float fvecInnerProduct(const float* x, const float* y, size_t d) {
-    return fvecInnerProductRef(x, y, d);
+inline float i8L2sqr(const int8_t* x, const int8_t* y, size_t d) {
+    return getDistanceKernels().i8L2sqr(x, y, d);
 }
 
-inline float fvecNormL2sqr(const float* x, size_t d) {
-    return fvecNormL2sqrRef(x, d);
+inline float i8InnerProduct(const int8_t* x, const int8_t* y, size_t d) {
+    return getDistanceKernels().i8InnerProduct(x, y, d);
+}
+
+inline float i16L2sqr(const int16_t* x, const int16_t* y, size_t d) {
+    return getDistanceKernels().i16L2sqr(x, y, d);
+}
+
+inline float i16InnerProduct(const int16_t* x, const int16_t* y, size_t d) {
+    return getDistanceKernels().i16InnerProduct(x, y, d);
+}
+
+inline float pqAdcDistance(const float* lut, const u_int8_t* code, size_t m) {
+    return getDistanceKernels().pqAdcDistance(lut, code, m);
+}
+
+inline float sq8L2sqr(const float* x, const u_int8_t* code, const float* vmin, const float* scale, size_t d) {
+    return getDistanceKernels().sq8L2sqr(x, code, vmin, scale, d);
+}
+
+inline float fp16L2sqr(const float* x, const u_int16_t* code, size_t d) {
+    return getDistanceKernels().fp16L2sqr(x, code, d);
 }
-#endif
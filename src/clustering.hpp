@@ -2,14 +2,21 @@
 
 #include "thread_pool.hpp"
 #include "calc_distance.hpp"
+#include "metric.hpp"
+#include "parallel.hpp"
+#include "nearest_centroid.hpp"
+#include "parser.hpp"
 
+#include <algorithm>
 #include <vector>
 #include <random>
 #include <functional>
+#include <iterator>
 #include <limits>
-#include <chrono>
-#include <random>
-#include <set>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 // debug
 #include <iostream>
@@ -36,22 +43,24 @@ struct IVFFlatClusterData {
 };
 
 enum class kMeansSamplingMode {
+    // uniform picks
     kNormal = 0,
-    kPlusplus = 1
+    // k-means++, D² weighted picks with one parallel pass over the points per centroid
+    kPlusplus = 1,
+    // k-means||, a few parallel rounds oversample candidates and weighted k-means++ reduces them
+    kParallel = 2
 };
 
+constexpr u_int64_t kDefaultKMeansSeed = 42;
+// kParallel rounds, each picks kParallelSeedingOversampling * clusterCount candidates on average
+constexpr size_t kParallelSeedingRounds = 2;
+constexpr size_t kParallelSeedingOversampling = 2;
+constexpr size_t kMinSeedingChunkSize = 1024;
+
 template<typename T, typename U>
 inline float squaredDistance(const std::vector<T> &x, const std::vector<U> &y) {
     // ALERT: UB if x.size() > y.size()
-    if (std::is_same<float, typename std::remove_cv<T>::type>::value) {
-        return fvecL2sqr(&(*x.begin()), &(*y.begin()), x.size());
-    }
-    float squaredDist = 0;
-    for (size_t i = 0; i < x.size(); ++i) {
-        squaredDist += (static_cast<float>(x[i]) - static_cast<float>(y[i])) *
-                       (static_cast<float>(x[i]) - static_cast<float>(y[i]));
-    }
-    return squaredDist;
+    return metricDistance<MetricType::kL2>(x.data(), y.data(), x.size());
 }
 
 template<typename T, typename U>
@@ -59,106 +68,363 @@ float distance(const std::vector<T> &x, const std::vector<U> &y) {
     return sqrtf(squaredDistance(x, y));
 }
 
-//TODO: kmeans++ initialization support
+// shuffles the first count indexes into a uniform sample and drops the rest
+inline void sampleUniform(std::vector<size_t> &indexes, const size_t count, std::mt19937_64 &gen) {
+    for (size_t i = 0; i < count; ++i) {
+        std::uniform_int_distribution<size_t> pick(i, indexes.size() - 1);
+        std::swap(indexes[i], indexes[pick(gen)]);
+    }
+    indexes.resize(count);
+}
+
+// index in [0, masses.size()) drawn with probability proportional to its mass, chunkSums hold the masses
+// summed over chunks of chunkSize
+template<typename F>
+size_t sampleByMass(const size_t count, const size_t chunkSize, const std::vector<double> &chunkSums, F mass,
+                    std::mt19937_64 &gen) {
+    const double total = std::accumulate(chunkSums.begin(), chunkSums.end(), 0.0);
+    double target = std::uniform_real_distribution<double>(0, total)(gen);
+    size_t chunk = 0;
+    while (chunk + 1 < chunkSums.size() && target >= chunkSums[chunk]) {
+        target -= chunkSums[chunk];
+        ++chunk;
+    }
+    // rounding may run past the last positive mass, it is taken then
+    size_t lastPositive = count;
+    for (size_t j = chunk * chunkSize; j < std::min(count, (chunk + 1) * chunkSize); ++j) {
+        const double m = mass(j);
+        if (m > 0) {
+            lastPositive = j;
+            if (target < m) {
+                return j;
+            }
+            target -= m;
+        }
+    }
+    return lastPositive;
+}
+
+// k-means++ over points[candidates[i]]: the first pick is uniform, every next one is drawn with probability
+// proportional to weights[i] times the squared distance to the nearest pick. Returns count distinct
+// positions in candidates, empty weights weigh every candidate 1.
+template<typename T>
+std::vector<size_t> samplePlusPlus(const std::vector<std::vector<T>> &points, const std::vector<size_t> &candidates,
+                                   const std::vector<float> &weights, const size_t count, std::mt19937_64 &gen) {
+    const size_t candidateCount = candidates.size();
+    std::vector<size_t> picked;
+    picked.reserve(count);
+    std::vector<char> isPicked(candidateCount, 0);
+    std::vector<float> minSquaredDist(candidateCount, std::numeric_limits<float>::max());
+    const size_t chunkSize = calcChunkSize(candidateCount, kMinSeedingChunkSize);
+    std::vector<double> chunkSums((candidateCount + chunkSize - 1) / chunkSize);
+    auto mass = [&](size_t j) {
+        return static_cast<double>(minSquaredDist[j]) * (weights.empty() ? 1.0 : weights[j]);
+    };
+
+    size_t next = std::uniform_int_distribution<size_t>(0, candidateCount - 1)(gen);
+    while (true) {
+        picked.push_back(next);
+        isPicked[next] = 1;
+        if (picked.size() == count) {
+            break;
+        }
+        const std::vector<T> &center = points[candidates[next]];
+        parallelFor(candidateCount, chunkSize, [&](size_t begin, size_t end) {
+            double sum = 0;
+            for (size_t j = begin; j < end; ++j) {
+                minSquaredDist[j] = std::min(minSquaredDist[j], squaredDistance(points[candidates[j]], center));
+                sum += mass(j);
+            }
+            chunkSums[begin / chunkSize] = sum;
+        });
+
+        // picks and their duplicates have no mass, once only they are left the rest is taken uniformly
+        next = sampleByMass(candidateCount, chunkSize, chunkSums, mass, gen);
+        if (next == candidateCount) {
+            std::vector<size_t> rest;
+            for (size_t j = 0; j < candidateCount; ++j) {
+                if (!isPicked[j]) {
+                    rest.push_back(j);
+                }
+            }
+            sampleUniform(rest, count - picked.size(), gen);
+            picked.insert(picked.end(), rest.begin(), rest.end());
+            break;
+        }
+    }
+    return picked;
+}
+
+// k-means||: every round keeps each point independently with probability l * d²(x) / cost, where l is the
+// oversampling and cost the sum of d² over all points. The candidates are weighted by the points nearest to them
+// and reduced to clusterCount by weighted k-means++. Rounds draw from per chunk generators seeded by the seed,
+// the round and the chunk, so the result does not depend on the thread count.
+template<typename T>
+std::vector<size_t> sampleParallel(const std::vector<std::vector<T>> &points, const size_t clusterCount,
+                                   const u_int64_t seed, std::mt19937_64 &gen) {
+    const size_t pointsCount = points.size();
+    const double oversampling = static_cast<double>(kParallelSeedingOversampling * clusterCount);
+    const size_t chunkSize = calcChunkSize(pointsCount, kMinSeedingChunkSize);
+    const size_t chunkCount = (pointsCount + chunkSize - 1) / chunkSize;
+    std::vector<double> chunkSums(chunkCount);
+    std::vector<std::vector<size_t>> chunkPicks(chunkCount);
+
+    std::vector<size_t> candidates{std::uniform_int_distribution<size_t>(0, pointsCount - 1)(gen)};
+    std::vector<float> minSquaredDist(pointsCount, std::numeric_limits<float>::max());
+    std::vector<u_int32_t> nearest(pointsCount, 0);
+    // folds the candidates from first on into minSquaredDist and returns the cost
+    auto update = [&](size_t first) {
+        parallelFor(pointsCount, chunkSize, [&](size_t begin, size_t end) {
+            double sum = 0;
+            for (size_t j = begin; j < end; ++j) {
+                for (size_t c = first; c < candidates.size(); ++c) {
+                    const float dist = squaredDistance(points[j], points[candidates[c]]);
+                    if (dist < minSquaredDist[j]) {
+                        minSquaredDist[j] = dist;
+                        nearest[j] = c;
+                    }
+                }
+                sum += minSquaredDist[j];
+            }
+            chunkSums[begin / chunkSize] = sum;
+        });
+        return std::accumulate(chunkSums.begin(), chunkSums.end(), 0.0);
+    };
+
+    double cost = update(0);
+    for (u_int32_t round = 0; round < kParallelSeedingRounds && cost > 0; ++round) {
+        parallelFor(pointsCount, chunkSize, [&](size_t begin, size_t end) {
+            std::seed_seq seq{static_cast<u_int32_t>(seed), static_cast<u_int32_t>(seed >> 32), round,
+                              static_cast<u_int32_t>(begin / chunkSize)};
+            std::mt19937_64 chunkGen(seq);
+            std::uniform_real_distribution<double> uniform(0, 1);
+            std::vector<size_t> &picks = chunkPicks[begin / chunkSize];
+            picks.clear();
+            // candidates and their duplicates have no distance left and are never picked twice
+            for (size_t j = begin; j < end; ++j) {
+                if (uniform(chunkGen) * cost < oversampling * minSquaredDist[j]) {
+                    picks.push_back(j);
+                }
+            }
+        });
+        const size_t first = candidates.size();
+        for (const std::vector<size_t> &picks: chunkPicks) {
+            candidates.insert(candidates.end(), picks.begin(), picks.end());
+        }
+        cost = update(first);
+    }
+
+    if (candidates.size() <= clusterCount) {
+        // too few distinct points to oversample, the rest is uniform
+        std::vector<char> isCandidate(pointsCount, 0);
+        for (size_t index: candidates) {
+            isCandidate[index] = 1;
+        }
+        std::vector<size_t> rest;
+        for (size_t j = 0; j < pointsCount; ++j) {
+            if (!isCandidate[j]) {
+                rest.push_back(j);
+            }
+        }
+        sampleUniform(rest, clusterCount - candidates.size(), gen);
+        candidates.insert(candidates.end(), rest.begin(), rest.end());
+        return candidates;
+    }
+
+    std::vector<float> weights(candidates.size(), 0);
+    for (size_t j = 0; j < pointsCount; ++j) {
+        weights[nearest[j]] += 1;
+    }
+    std::vector<size_t> result = samplePlusPlus(points, candidates, weights, clusterCount, gen);
+    for (size_t &index: result) {
+        index = candidates[index];
+    }
+    return result;
+}
+
+// clusterCount distinct points as initial centroids, the same seed gives the same centroids.
+// Seeding measures squared euclidean distances whatever the metric of the index.
 template<typename T>
 std::vector<std::vector<T>>
 kMeansSample(const std::vector<std::vector<T>> &points, const size_t clusterCount,
-             const kMeansSamplingMode mode) {
+             const kMeansSamplingMode mode, const u_int64_t seed) {
     if (clusterCount == 0) {
         return std::vector<std::vector<T>>();
     }
-    size_t pointsCount = points.size();
-    auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    thread_local std::mt19937 gen(seed);
-    std::vector<std::vector<T>> clusters(clusterCount);
-    std::set<size_t> clustersId;
-    size_t index{};
+    const size_t pointsCount = points.size();
+    if (clusterCount > pointsCount) {
+        throw std::invalid_argument("Cluster count exceeds the number of points.");
+    }
+    std::mt19937_64 gen(seed);
+    std::vector<size_t> indexes;
     if (mode == kMeansSamplingMode::kNormal) {
-        for (auto &cluster: clusters) {
-            while (true) {
-                index = gen() % pointsCount;
-                if (clustersId.count(index) == 0) {
-                    break;
-                }
-            }
-            cluster = points[index];
-            clustersId.insert(index);
-        }
+        indexes.resize(pointsCount);
+        std::iota(indexes.begin(), indexes.end(), 0);
+        sampleUniform(indexes, clusterCount, gen);
+    } else if (mode == kMeansSamplingMode::kPlusplus) {
+        std::vector<size_t> all(pointsCount);
+        std::iota(all.begin(), all.end(), 0);
+        indexes = samplePlusPlus(points, all, std::vector<float>(), clusterCount, gen);
+    } else {
+        indexes = sampleParallel(points, clusterCount, seed, gen);
+    }
+
+    std::vector<std::vector<T>> clusters(clusterCount);
+    for (size_t i = 0; i < clusterCount; ++i) {
+        clusters[i] = points[indexes[i]];
     }
     return clusters;
 }
 
-template<typename T>
+// maxClusterSize caps the cluster sizes through balanceAssignment, 0 for no cap
+template<typename T, MetricType Metric = MetricType::kL2>
 void assignPoints(const std::vector<std::vector<float>> &centroids, const std::vector<std::vector<T>> &points,
                   std::vector<float> &minSquaredDist,
-                  std::vector<u_int32_t> &cluster) {
-
-    auto& threadPool = getThreadPool();
-    std::vector<boost::unique_future<void>> pendingTasks;
-    for (size_t j = 0; j < points.size(); ++j) {
-
-        auto calcNearestClusters = [&centroids, &minSquaredDist, &cluster, &points, j]() {
-            for (size_t i = 0; i < centroids.size(); ++i) {
-                // computed distance to current cluster
-                float dist = squaredDistance(centroids[i], points[j]);
-                // checking if distance is smaller
-                if (dist < minSquaredDist[j]) {
-                    minSquaredDist[j] = dist;
-                    cluster[j] = i;
-                }
-            }
-        };
+                  std::vector<u_int32_t> &cluster, const size_t maxClusterSize = 0) {
+    const size_t dimension = centroids.empty() ? 0 : centroids[0].size();
+    std::vector<float> centroidRows(centroids.size() * dimension);
+    for (size_t i = 0; i < centroids.size(); ++i) {
+        std::copy(centroids[i].begin(), centroids[i].end(), centroidRows.begin() + i * dimension);
+    }
+    findNearestCentroids<Metric>(centroidRows.data(), centroids.size(), dimension, points, cluster.data(),
+                                 minSquaredDist.data());
+    balanceAssignment<Metric>(centroidRows.data(), centroids.size(), dimension, points, cluster.data(),
+                              minSquaredDist.data(), maxClusterSize);
+}
+
+// per worker sums and counts of the centroid update, kept across epochs to reuse the memory
+struct CentroidUpdateBuffers {
+    std::vector<float> sums;
+    std::vector<u_int32_t> counts;
+};
 
-        Task task(calcNearestClusters);
-        boost::unique_future<void> fut = task.get_future();
-        pendingTasks.push_back(std::move(fut));
-        threadPool.Submit(std::move(task));
+constexpr size_t kMinUpdateChunkSize = 4096;
+// relative shift of the two centroids an empty cluster and the largest one get on a split
+constexpr float kClusterSplitEps = 1.0f / 1024;
+
+// An empty cluster takes over half of the largest one: both get its centroid scaled by 1 + kClusterSplitEps and
+// 1 - kClusterSplitEps in alternating coordinates, so the next assignment divides its points between them.
+// Clusters of a single point are not split, an empty cluster then keeps its centroid. Returns the split count.
+template<MetricType Metric = MetricType::kL2>
+size_t splitEmptyClusters(std::vector<std::vector<float>> &centroids, std::vector<u_int32_t> &clusterSizes) {
+    size_t splitCount = 0;
+    for (size_t c = 0; c < centroids.size(); ++c) {
+        if (clusterSizes[c] != 0) {
+            continue;
+        }
+        const size_t largest = std::max_element(clusterSizes.begin(), clusterSizes.end()) - clusterSizes.begin();
+        if (clusterSizes[largest] < 2) {
+            break;
+        }
+        for (size_t i = 0; i < centroids[c].size(); ++i) {
+            const float sign = i % 2 == 0 ? 1 : -1;
+            centroids[c][i] = centroids[largest][i] * (1 + sign * kClusterSplitEps);
+            centroids[largest][i] *= 1 - sign * kClusterSplitEps;
+        }
+        if constexpr (Metric == MetricType::kCosine) {
+            normalizeVector(centroids[c].data(), centroids[c].size());
+            normalizeVector(centroids[largest].data(), centroids[largest].size());
+        }
+        clusterSizes[c] = clusterSizes[largest] / 2;
+        clusterSizes[largest] -= clusterSizes[c];
+        ++splitCount;
     }
-    boost::wait_for_all(pendingTasks.begin(), pendingTasks.end());
+    return splitCount;
 }
 
+// Sums the points of every cluster into buffers.sums[c * dimension, (c + 1) * dimension) and counts them in
+// buffers.counts[c]. Every worker sums a contiguous range of points into its own flat slice of the buffers,
+// the slices are then merged per cluster into the first one.
 template<typename T>
+void accumulateClusterSums(const std::vector<std::vector<T>> &points, const std::vector<u_int32_t> &cluster,
+                           const size_t clusterCount, const size_t dimension, CentroidUpdateBuffers &buffers) {
+    const size_t pointsCount = points.size();
+    const size_t workerCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    const size_t chunkSize = std::max(kMinUpdateChunkSize, (pointsCount + workerCount - 1) / workerCount);
+    const size_t chunkCount = std::max<size_t>(1, (pointsCount + chunkSize - 1) / chunkSize);
+    const size_t sliceSize = clusterCount * dimension;
+    buffers.sums.assign(chunkCount * sliceSize, 0);
+    buffers.counts.assign(chunkCount * clusterCount, 0);
+
+    parallelFor(pointsCount, chunkSize, [&](size_t begin, size_t end) {
+        float *sums = buffers.sums.data() + begin / chunkSize * sliceSize;
+        u_int32_t *counts = buffers.counts.data() + begin / chunkSize * clusterCount;
+        for (size_t j = begin; j < end; ++j) {
+            const u_int32_t clusterId = cluster[j];
+            ++counts[clusterId];
+            float *sum = sums + clusterId * dimension;
+            for (size_t i = 0; i < dimension; ++i) {
+                sum[i] += static_cast<float>(points[j][i]);
+            }
+        }
+    });
+    if (chunkCount == 1) {
+        return;
+    }
+    parallelFor(clusterCount, calcChunkSize(clusterCount, 16), [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            float *sum = buffers.sums.data() + c * dimension;
+            for (size_t chunk = 1; chunk < chunkCount; ++chunk) {
+                const float *chunkSum = buffers.sums.data() + chunk * sliceSize + c * dimension;
+                for (size_t i = 0; i < dimension; ++i) {
+                    sum[i] += chunkSum[i];
+                }
+                buffers.counts[c] += buffers.counts[chunk * clusterCount + c];
+            }
+        }
+    });
+}
+
+// Moves the centroids to the means of their points and returns the Frobenius norm of the move.
+// Empty clusters are split off the largest ones. For kCosine the means are projected back onto the unit sphere
+// (spherical k-means).
+template<typename T, MetricType Metric = MetricType::kL2>
 float computePoints(std::vector<std::vector<float>> &centroids, const std::vector<std::vector<T>> &points,
                     std::vector<float> &minSquaredDist,
-                    std::vector<u_int32_t> &cluster) {
-    // updating and computing
-    auto clusterCount = static_cast<u_int32_t>(centroids.size());
-    std::vector<u_int32_t> newPoints(clusterCount, 0);
-    size_t dimension = points.at(0).size();
-    std::vector<std::vector<float>> sum(clusterCount, std::vector<float>(dimension, 0.0));
-    for (size_t j = 0; j < points.size(); ++j) {
-        u_int32_t clusterId = cluster[j];
-        newPoints[clusterId]++;
-        for (size_t i = 0; i < points[j].size(); ++i) {
-            sum[clusterId][i] += static_cast<float>(points[j][i]);
+                    std::vector<u_int32_t> &cluster, CentroidUpdateBuffers &buffers) {
+    const size_t clusterCount = centroids.size();
+    const size_t dimension = points.at(0).size();
+    accumulateClusterSums(points, cluster, clusterCount, dimension, buffers);
+    std::fill(minSquaredDist.begin(), minSquaredDist.end(), std::numeric_limits<float>::max());
+
+    const std::vector<std::vector<float>> previous = centroids;
+    std::vector<u_int32_t> clusterSizes(buffers.counts.begin(), buffers.counts.begin() + clusterCount);
+    parallelFor(clusterCount, calcChunkSize(clusterCount, 16), [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            if (clusterSizes[c] == 0) {
+                continue;
+            }
+            const float *sum = buffers.sums.data() + c * dimension;
+            for (size_t i = 0; i < dimension; ++i) {
+                centroids[c][i] = sum[i] / static_cast<float>(clusterSizes[c]);
+            }
+            if constexpr (Metric == MetricType::kCosine) {
+                normalizeVector(centroids[c].data(), dimension);
+            }
         }
-        minSquaredDist[j] = std::numeric_limits<float>::max();
-    }
+    });
+    splitEmptyClusters<Metric>(centroids, clusterSizes);
 
     float frobeniusNorm = 0;
-    std::vector<float> currentVec(dimension);
-    for (size_t i = 0; i < centroids.size(); ++i) {
-        u_int32_t clusterId = i;
-        currentVec = centroids[i];
-        for (size_t j = 0; j < centroids[i].size(); ++j) {
-            centroids[i][j] = sum[clusterId][j] / newPoints[clusterId];
-        }
-        frobeniusNorm += squaredDistance(currentVec, centroids[i]);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        frobeniusNorm += squaredDistance(previous[c], centroids[c]);
     }
     frobeniusNorm = sqrtf(frobeniusNorm);
     return frobeniusNorm;
 }
 
-template<typename T>
+template<typename T, MetricType Metric = MetricType::kL2>
 IVFFlatClusterData<T>
 kMeans(const std::vector<std::vector<T>> &points, const size_t clusterCount, const size_t maxEpochs,
-       const float tol) {
+       const float tol, const kMeansSamplingMode samplingMode = kMeansSamplingMode::kNormal,
+       const u_int64_t seed = kDefaultKMeansSeed, const size_t maxClusterSize = 0) {
 
     std::vector<u_int32_t> pointsId(points.size(), 0);
     std::vector<float> minSquaredDist(points.size(), std::numeric_limits<float>::max());
+    CentroidUpdateBuffers buffers;
     IVFFlatClusterData<T> data(clusterCount);
 
-    data.centroids = kMeansSample(points, clusterCount, kMeansSamplingMode::kNormal);
+    data.centroids = kMeansSample(points, clusterCount, samplingMode, seed);
 
     std::vector<std::vector<float>> centroids(data.centroids.size());
     for (size_t i = 0; i < centroids.size(); ++i) {
@@ -167,9 +433,9 @@ kMeans(const std::vector<std::vector<T>> &points, const size_t clusterCount, con
 
     for (size_t i = 0; i < maxEpochs; ++i) {
         // assign cluster to points
-        assignPoints(centroids, points, minSquaredDist, pointsId);
+        assignPoints<T, Metric>(centroids, points, minSquaredDist, pointsId, maxClusterSize);
         // recompute points
-        float frobeniusNorm = computePoints(centroids, points, minSquaredDist, pointsId);
+        float frobeniusNorm = computePoints<T, Metric>(centroids, points, minSquaredDist, pointsId, buffers);
 //        std::cout << frobeniusNorm << std::endl;
         if (frobeniusNorm < tol) {
             std::cout << i + 1 << " epochs passed!" << std::endl;
@@ -186,6 +452,173 @@ kMeans(const std::vector<std::vector<T>> &points, const size_t clusterCount, con
         data.idClusters[pointsId[i]].push_back(i);
     }
 
-    return std::move(data);
+    return data;
+}
+
+// splitEmptyClusters for the flat centroids of miniBatchKMeans. A split cluster keeps the share of seenCounts it
+// keeps of passCounts, a centroid split off it starts over and takes the whole mean of its next batch.
+// Returns the split count.
+template<MetricType Metric>
+size_t splitEmptyMiniBatchClusters(std::vector<float> &centroids, const size_t dimension,
+                                   std::vector<u_int32_t> &passCounts, std::vector<u_int64_t> &seenCounts) {
+    const size_t clusterCount = passCounts.size();
+    if (std::find(passCounts.begin(), passCounts.end(), 0) == passCounts.end()) {
+        return 0;
+    }
+    std::vector<std::vector<float>> rows(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        rows[c].assign(centroids.begin() + c * dimension, centroids.begin() + (c + 1) * dimension);
+    }
+    const std::vector<u_int32_t> previousCounts = passCounts;
+    const size_t splitCount = splitEmptyClusters<Metric>(rows, passCounts);
+    if (splitCount == 0) {
+        return 0;
+    }
+    for (size_t c = 0; c < clusterCount; ++c) {
+        if (passCounts[c] == previousCounts[c]) {
+            continue;
+        }
+        std::copy(rows[c].begin(), rows[c].end(), centroids.begin() + c * dimension);
+        seenCounts[c] = previousCounts[c] == 0 ? 0 : seenCounts[c] * passCounts[c] / previousCounts[c];
+    }
+    return splitCount;
 }
 
+enum class MiniBatchLearningRate {
+    // a centroid moves by the share of its batch points among all points it has seen, the running mean
+    kInverseCount = 0,
+    // a centroid moves towards the mean of its batch points by initialLearningRate / (1 + learningRateDecay * t)
+    // on the t-th batch
+    kInverseTime = 1
+};
+
+struct MiniBatchKMeansOptions {
+    // vectors per centroid update
+    size_t batchSize = 8192;
+    // vectors read from the file at once and shuffled before they are cut into batches, bounds the memory
+    size_t chunkSize = 262144;
+    // passes over the file
+    size_t epochCount = 1;
+    // vectors evenly spread over the file the seeds are picked from, at least clusterCount are read
+    size_t seedSampleSize = 65536;
+    MiniBatchLearningRate learningRate = MiniBatchLearningRate::kInverseCount;
+    float initialLearningRate = 0.5f;
+    float learningRateDecay = 0.01f;
+    kMeansSamplingMode samplingMode = kMeansSamplingMode::kNormal;
+    u_int64_t seed = kDefaultKMeansSeed;
+};
+
+// Mini-batch k-means over a learn set streamed from an fvecs (T = float) or bvecs (T = u_int8_t) file, only a chunk
+// of vectors and the centroids are in memory. Seeds are picked from a sample spread over the file, then every batch
+// is assigned to the nearest centroids and moves them by the learning rate. Clusters no vector of a pass was assigned
+// to are split off the largest ones after the pass; after the last pass the split centroids are trained once more on
+// its last batch, so none is returned as an untrained copy of another. Only the centroids of the result are filled,
+// PaseIVFFlat::buildIndex takes them instead of training itself.
+template<typename T, MetricType Metric = MetricType::kL2>
+IVFFlatClusterData<T>
+miniBatchKMeans(const std::string &pathToFile, const size_t dimension, const size_t clusterCount,
+                const MiniBatchKMeansOptions &options = MiniBatchKMeansOptions()) {
+    if (options.batchSize == 0 || options.chunkSize < options.batchSize) {
+        throw std::invalid_argument("Batch size must be positive and not exceed the chunk size.");
+    }
+    VecsReader<T> reader(pathToFile, dimension);
+    const size_t vectorCount = reader.getVectorCount();
+    if (clusterCount > vectorCount) {
+        throw std::invalid_argument("Cluster count exceeds the number of points.");
+    }
+    IVFFlatClusterData<T> data(clusterCount);
+    if (clusterCount == 0) {
+        return data;
+    }
+    // kCosine trains on the unit sphere like kMeans on normalized vectors
+    auto prepare = [](std::vector<std::vector<T>> &vectors) {
+        if constexpr (Metric == MetricType::kCosine) {
+            for (auto &vec: vectors) {
+                normalizeVector(vec.data(), vec.size());
+            }
+        }
+    };
+
+    std::vector<float> centroids(clusterCount * dimension);
+    {
+        const size_t sampleSize = std::clamp(options.seedSampleSize, clusterCount, vectorCount);
+        std::vector<std::vector<T>> sample;
+        std::vector<std::vector<T>> record;
+        sample.reserve(sampleSize);
+        for (size_t i = 0; i < sampleSize; ++i) {
+            reader.seek(i * vectorCount / sampleSize);
+            reader.read(1, record);
+            sample.push_back(std::move(record[0]));
+        }
+        prepare(sample);
+        const auto seeds = kMeansSample(sample, clusterCount, options.samplingMode, options.seed);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            std::copy(seeds[c].begin(), seeds[c].end(), centroids.begin() + c * dimension);
+        }
+    }
+
+    std::vector<u_int64_t> seenCounts(clusterCount, 0);
+    // points assigned to every cluster during the current pass, clusters left without any are split
+    std::vector<u_int32_t> passCounts(clusterCount);
+    std::vector<u_int32_t> labels;
+    CentroidUpdateBuffers buffers;
+    std::vector<std::vector<T>> chunk;
+    std::vector<std::vector<T>> batch;
+    std::mt19937_64 gen(options.seed);
+    size_t batchIndex = 0;
+    // assigns the batch to the nearest centroids and moves every centroid that got points towards their mean
+    auto trainBatch = [&]() {
+        labels.resize(batch.size());
+        findNearestCentroids<Metric>(centroids.data(), clusterCount, dimension, batch, labels.data(), nullptr);
+        accumulateClusterSums(batch, labels, clusterCount, dimension, buffers);
+
+        const float rate = options.initialLearningRate / (1 + options.learningRateDecay * batchIndex);
+        parallelFor(clusterCount, calcChunkSize(clusterCount, 16), [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c) {
+                const u_int32_t count = buffers.counts[c];
+                if (count == 0) {
+                    continue;
+                }
+                passCounts[c] += count;
+                seenCounts[c] += count;
+                const float weight = options.learningRate == MiniBatchLearningRate::kInverseCount
+                                     ? static_cast<float>(count) / static_cast<float>(seenCounts[c])
+                                     : rate;
+                float *centroid = centroids.data() + c * dimension;
+                const float *sum = buffers.sums.data() + c * dimension;
+                for (size_t i = 0; i < dimension; ++i) {
+                    centroid[i] += weight * (sum[i] / static_cast<float>(count) - centroid[i]);
+                }
+                if constexpr (Metric == MetricType::kCosine) {
+                    normalizeVector(centroid, dimension);
+                }
+            }
+        });
+        ++batchIndex;
+    };
+
+    for (size_t epoch = 0; epoch < options.epochCount; ++epoch) {
+        reader.seek(0);
+        std::fill(passCounts.begin(), passCounts.end(), 0);
+        while (reader.read(options.chunkSize, chunk) != 0) {
+            prepare(chunk);
+            std::shuffle(chunk.begin(), chunk.end(), gen);
+            for (size_t begin = 0; begin < chunk.size(); begin += options.batchSize) {
+                const size_t end = std::min(chunk.size(), begin + options.batchSize);
+                batch.assign(std::make_move_iterator(chunk.begin() + begin),
+                             std::make_move_iterator(chunk.begin() + end));
+                trainBatch();
+            }
+        }
+        // the next pass trains split centroids, after the last one the last batch does
+        if (splitEmptyMiniBatchClusters<Metric>(centroids, dimension, passCounts, seenCounts) != 0 &&
+            epoch + 1 == options.epochCount) {
+            trainBatch();
+        }
+    }
+
+    for (size_t c = 0; c < clusterCount; ++c) {
+        data.centroids[c] = std::vector<T>(centroids.begin() + c * dimension, centroids.begin() + (c + 1) * dimension);
+    }
+    return data;
+}
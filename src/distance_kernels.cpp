@@ -0,0 +1,115 @@
+#include "distance_kernels.hpp"
+
+#include <initializer_list>
+
+#ifdef PASE_X86_KERNELS
+#include <cpuid.h>
+#endif
+
+
+namespace {
+#ifdef PASE_X86_KERNELS
+
+    struct CpuFeatures {
+        bool sse41 = false;
+        bool avx2 = false;
+        bool fma = false;
+        bool f16c = false;
+        bool avx512f = false;
+    };
+
+    // state components the OS saves on context switch
+    u_int64_t readXcr0() {
+        u_int32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<u_int64_t>(edx) << 32) | eax;
+    }
+
+    CpuFeatures detectCpuFeatures() {
+        CpuFeatures features;
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return features;
+        }
+        features.sse41 = ecx & bit_SSE4_1;
+        const bool osxsave = ecx & bit_OSXSAVE;
+        const bool avx = ecx & bit_AVX;
+        const bool fma = ecx & bit_FMA;
+        const bool f16c = ecx & bit_F16C;
+        if (!osxsave || !avx) {
+            return features;
+        }
+        const u_int64_t xcr0 = readXcr0();
+        // XMM and YMM state
+        if ((xcr0 & 0x6) != 0x6) {
+            return features;
+        }
+        features.fma = fma;
+        features.f16c = f16c;
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            features.avx2 = ebx & bit_AVX2;
+            // opmask, upper ZMM and high ZMM state
+            features.avx512f = (ebx & bit_AVX512F) && (xcr0 & 0xe0) == 0xe0;
+        }
+        return features;
+    }
+
+#endif
+
+    bool isSupported(SimdLevel level) {
+#ifdef PASE_X86_KERNELS
+        static const CpuFeatures features = detectCpuFeatures();
+#endif
+        switch (level) {
+            case SimdLevel::kScalar:
+                return true;
+#ifdef PASE_X86_KERNELS
+            case SimdLevel::kSSE:
+                return features.sse41;
+            case SimdLevel::kAVX2:
+                return features.avx2 && features.fma && features.f16c;
+            case SimdLevel::kAVX512:
+                return features.avx512f && features.avx2 && features.fma && features.f16c;
+#endif
+#ifdef PASE_NEON_KERNELS
+            case SimdLevel::kNEON:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+}
+
+const DistanceKernels *findDistanceKernels(SimdLevel level) {
+    if (!isSupported(level)) {
+        return nullptr;
+    }
+    switch (level) {
+        case SimdLevel::kScalar:
+            return &getScalarDistanceKernels();
+#ifdef PASE_X86_KERNELS
+        case SimdLevel::kSSE:
+            return &getSseDistanceKernels();
+        case SimdLevel::kAVX2:
+            return &getAvx2DistanceKernels();
+        case SimdLevel::kAVX512:
+            return &getAvx512DistanceKernels();
+#endif
+#ifdef PASE_NEON_KERNELS
+        case SimdLevel::kNEON:
+            return &getNeonDistanceKernels();
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+const DistanceKernels &selectDistanceKernels() {
+    for (SimdLevel level: {SimdLevel::kAVX512, SimdLevel::kAVX2, SimdLevel::kSSE, SimdLevel::kNEON}) {
+        if (const DistanceKernels *kernels = findDistanceKernels(level)) {
+            return *kernels;
+        }
+    }
+    return getScalarDistanceKernels();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+
+// Instruction set levels with their own distance kernel implementations.
+enum class SimdLevel : u_int32_t {
+    kScalar = 0,
+    // SSE4.1
+    kSSE = 1,
+    // AVX2 with FMA and F16C
+    kAVX2 = 2,
+    // AVX-512F on top of kAVX2
+    kAVX512 = 3,
+    kNEON = 4
+};
+
+// One implementation of every distance kernel, see the *Ref functions in calc_distance.hpp for what they compute.
+// Each instruction set lives in its own translation unit built with its own target flags, so a single binary
+// carries all of them and picks one at run time.
+struct DistanceKernels {
+    SimdLevel level;
+    const char *name;
+    float (*l2sqr)(const float *x, const float *y, size_t d);
+    float (*innerProduct)(const float *x, const float *y, size_t d);
+    float (*normL2sqr)(const float *x, size_t d);
+    void (*l2sqrBatch4)(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                        size_t d, float *dis);
+    // one query against n vectors stored row after row at y, dis receives n distances
+    void (*l2sqrNy)(const float *x, const float *y, size_t n, size_t d, float *dis);
+    void (*innerProductNy)(const float *x, const float *y, size_t n, size_t d, float *dis);
+    void (*l2sqrBlocked8)(const float *x, const float *block, size_t d, float *dis);
+    void (*innerProductBlocked8)(const float *x, const float *block, size_t d, float *dis);
+    // 4 queries stored row after row at x against one column-blocked group, dis receives 4 x 8 products
+    void (*innerProductBlocked4x8)(const float *x, const float *block, size_t d, float *dis);
+    // integer vectors, u8 and i8 are summed exactly in 32-bit integers, i16 in float
+    float (*u8L2sqr)(const u_int8_t *x, const u_int8_t *y, size_t d);
+    float (*u8InnerProduct)(const u_int8_t *x, const u_int8_t *y, size_t d);
+    float (*i8L2sqr)(const int8_t *x, const int8_t *y, size_t d);
+    float (*i8InnerProduct)(const int8_t *x, const int8_t *y, size_t d);
+    float (*i16L2sqr)(const int16_t *x, const int16_t *y, size_t d);
+    float (*i16InnerProduct)(const int16_t *x, const int16_t *y, size_t d);
+    float (*pqAdcDistance)(const float *lut, const u_int8_t *code, size_t m);
+    float (*sq8L2sqr)(const float *x, const u_int8_t *code, const float *vmin, const float *scale, size_t d);
+    float (*fp16L2sqr)(const float *x, const u_int16_t *code, size_t d);
+};
+
+// kernels for the level, nullptr if the build does not contain them or the CPU can not run them
+const DistanceKernels *findDistanceKernels(SimdLevel level);
+
+// best kernels the CPU supports, detected with cpuid
+const DistanceKernels &selectDistanceKernels();
+
+// selected once on first use
+inline const DistanceKernels &getDistanceKernels() {
+    static const DistanceKernels &kernels = selectDistanceKernels();
+    return kernels;
+}
+
+// per instruction set tables, only the ones matching the target architecture are built
+const DistanceKernels &getScalarDistanceKernels();
+
+const DistanceKernels &getSseDistanceKernels();
+
+const DistanceKernels &getAvx2DistanceKernels();
+
+const DistanceKernels &getAvx512DistanceKernels();
+
+const DistanceKernels &getNeonDistanceKernels();
@@ -0,0 +1,387 @@
+// Built with -mavx2 -mfma -mf16c. Only intrinsics and functions local to this file may be used here: an inline
+// function shared with other translation units could be emitted with AVX2 code and picked by the linker for all.
+
+#include "distance_kernels.hpp"
+
+#include <immintrin.h>
+#include <type_traits>
+
+
+namespace {
+    inline float horizontalSum(__m256 v) {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        return _mm_cvtss_f32(sum);
+    }
+
+    // lanes [0, rest) enabled, 0 < rest < 8; masked loads do not touch disabled lanes
+    inline __m256i tailMask(size_t rest) {
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(rest)),
+                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    float l2sqr(const float *x, const float *y, size_t d) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= d; i += 16) {
+            const __m256 a_m_b0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+            const __m256 a_m_b1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8));
+            msum0 = _mm256_fmadd_ps(a_m_b0, a_m_b0, msum0);
+            msum1 = _mm256_fmadd_ps(a_m_b1, a_m_b1, msum1);
+        }
+        for (; i + 8 <= d; i += 8) {
+            const __m256 a_m_b = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+            msum0 = _mm256_fmadd_ps(a_m_b, a_m_b, msum0);
+        }
+        if (i < d) {
+            const __m256i mask = tailMask(d - i);
+            const __m256 a_m_b = _mm256_sub_ps(_mm256_maskload_ps(x + i, mask), _mm256_maskload_ps(y + i, mask));
+            msum1 = _mm256_fmadd_ps(a_m_b, a_m_b, msum1);
+        }
+        return horizontalSum(_mm256_add_ps(msum0, msum1));
+    }
+
+    float innerProduct(const float *x, const float *y, size_t d) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= d; i += 16) {
+            msum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), msum0);
+            msum1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), msum1);
+        }
+        for (; i + 8 <= d; i += 8) {
+            msum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), msum0);
+        }
+        if (i < d) {
+            const __m256i mask = tailMask(d - i);
+            msum1 = _mm256_fmadd_ps(_mm256_maskload_ps(x + i, mask), _mm256_maskload_ps(y + i, mask), msum1);
+        }
+        return horizontalSum(_mm256_add_ps(msum0, msum1));
+    }
+
+    float normL2sqr(const float *x, size_t d) {
+        __m256 msum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m256 mx = _mm256_loadu_ps(x + i);
+            msum = _mm256_fmadd_ps(mx, mx, msum);
+        }
+        if (i < d) {
+            const __m256 mx = _mm256_maskload_ps(x + i, tailMask(d - i));
+            msum = _mm256_fmadd_ps(mx, mx, msum);
+        }
+        return horizontalSum(msum);
+    }
+
+    void l2sqrBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                     size_t d, float *dis) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        __m256 msum2 = _mm256_setzero_ps();
+        __m256 msum3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m256 mx = _mm256_loadu_ps(x + i);
+            const __m256 a_m_b0 = _mm256_sub_ps(mx, _mm256_loadu_ps(y0 + i));
+            const __m256 a_m_b1 = _mm256_sub_ps(mx, _mm256_loadu_ps(y1 + i));
+            const __m256 a_m_b2 = _mm256_sub_ps(mx, _mm256_loadu_ps(y2 + i));
+            const __m256 a_m_b3 = _mm256_sub_ps(mx, _mm256_loadu_ps(y3 + i));
+            msum0 = _mm256_fmadd_ps(a_m_b0, a_m_b0, msum0);
+            msum1 = _mm256_fmadd_ps(a_m_b1, a_m_b1, msum1);
+            msum2 = _mm256_fmadd_ps(a_m_b2, a_m_b2, msum2);
+            msum3 = _mm256_fmadd_ps(a_m_b3, a_m_b3, msum3);
+        }
+        if (i < d) {
+            const __m256i mask = tailMask(d - i);
+            const __m256 mx = _mm256_maskload_ps(x + i, mask);
+            const __m256 a_m_b0 = _mm256_sub_ps(mx, _mm256_maskload_ps(y0 + i, mask));
+            const __m256 a_m_b1 = _mm256_sub_ps(mx, _mm256_maskload_ps(y1 + i, mask));
+            const __m256 a_m_b2 = _mm256_sub_ps(mx, _mm256_maskload_ps(y2 + i, mask));
+            const __m256 a_m_b3 = _mm256_sub_ps(mx, _mm256_maskload_ps(y3 + i, mask));
+            msum0 = _mm256_fmadd_ps(a_m_b0, a_m_b0, msum0);
+            msum1 = _mm256_fmadd_ps(a_m_b1, a_m_b1, msum1);
+            msum2 = _mm256_fmadd_ps(a_m_b2, a_m_b2, msum2);
+            msum3 = _mm256_fmadd_ps(a_m_b3, a_m_b3, msum3);
+        }
+        // pairwise sums of the halves, then [dis0, dis1, dis2, dis3]
+        const __m256 sums = _mm256_hadd_ps(_mm256_hadd_ps(msum0, msum1), _mm256_hadd_ps(msum2, msum3));
+        _mm_storeu_ps(dis, _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)));
+    }
+
+    void innerProductBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                            size_t d, float *dis) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        __m256 msum2 = _mm256_setzero_ps();
+        __m256 msum3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m256 mx = _mm256_loadu_ps(x + i);
+            msum0 = _mm256_fmadd_ps(mx, _mm256_loadu_ps(y0 + i), msum0);
+            msum1 = _mm256_fmadd_ps(mx, _mm256_loadu_ps(y1 + i), msum1);
+            msum2 = _mm256_fmadd_ps(mx, _mm256_loadu_ps(y2 + i), msum2);
+            msum3 = _mm256_fmadd_ps(mx, _mm256_loadu_ps(y3 + i), msum3);
+        }
+        if (i < d) {
+            const __m256i mask = tailMask(d - i);
+            const __m256 mx = _mm256_maskload_ps(x + i, mask);
+            msum0 = _mm256_fmadd_ps(mx, _mm256_maskload_ps(y0 + i, mask), msum0);
+            msum1 = _mm256_fmadd_ps(mx, _mm256_maskload_ps(y1 + i, mask), msum1);
+            msum2 = _mm256_fmadd_ps(mx, _mm256_maskload_ps(y2 + i, mask), msum2);
+            msum3 = _mm256_fmadd_ps(mx, _mm256_maskload_ps(y3 + i, mask), msum3);
+        }
+        const __m256 sums = _mm256_hadd_ps(_mm256_hadd_ps(msum0, msum1), _mm256_hadd_ps(msum2, msum3));
+        _mm_storeu_ps(dis, _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)));
+    }
+
+    // four rows per pass, the remaining rows one by one
+    void l2sqrNy(const float *x, const float *y, size_t n, size_t d, float *dis) {
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float *yj = y + j * d;
+            l2sqrBatch4(x, yj, yj + d, yj + 2 * d, yj + 3 * d, d, dis + j);
+        }
+        for (; j < n; ++j) {
+            dis[j] = l2sqr(x, y + j * d, d);
+        }
+    }
+
+    void innerProductNy(const float *x, const float *y, size_t n, size_t d, float *dis) {
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float *yj = y + j * d;
+            innerProductBatch4(x, yj, yj + d, yj + 2 * d, yj + 3 * d, d, dis + j);
+        }
+        for (; j < n; ++j) {
+            dis[j] = innerProduct(x, y + j * d, d);
+        }
+    }
+
+    void l2sqrBlocked8(const float *x, const float *block, size_t d, float *dis) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 2 <= d; i += 2) {
+            const __m256 a_m_b0 = _mm256_sub_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(block + i * 8));
+            const __m256 a_m_b1 = _mm256_sub_ps(_mm256_set1_ps(x[i + 1]), _mm256_loadu_ps(block + i * 8 + 8));
+            msum0 = _mm256_fmadd_ps(a_m_b0, a_m_b0, msum0);
+            msum1 = _mm256_fmadd_ps(a_m_b1, a_m_b1, msum1);
+        }
+        if (i < d) {
+            const __m256 a_m_b = _mm256_sub_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(block + i * 8));
+            msum0 = _mm256_fmadd_ps(a_m_b, a_m_b, msum0);
+        }
+        _mm256_storeu_ps(dis, _mm256_add_ps(msum0, msum1));
+    }
+
+    void innerProductBlocked8(const float *x, const float *block, size_t d, float *dis) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 2 <= d; i += 2) {
+            msum0 = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(block + i * 8), msum0);
+            msum1 = _mm256_fmadd_ps(_mm256_set1_ps(x[i + 1]), _mm256_loadu_ps(block + i * 8 + 8), msum1);
+        }
+        if (i < d) {
+            msum0 = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(block + i * 8), msum0);
+        }
+        _mm256_storeu_ps(dis, _mm256_add_ps(msum0, msum1));
+    }
+
+    // one load of a group component feeds an accumulator per query
+    void innerProductBlocked4x8(const float *x, const float *block, size_t d, float *dis) {
+        __m256 msum0 = _mm256_setzero_ps();
+        __m256 msum1 = _mm256_setzero_ps();
+        __m256 msum2 = _mm256_setzero_ps();
+        __m256 msum3 = _mm256_setzero_ps();
+        for (size_t i = 0; i < d; ++i) {
+            const __m256 mb = _mm256_loadu_ps(block + i * 8);
+            msum0 = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), mb, msum0);
+            msum1 = _mm256_fmadd_ps(_mm256_set1_ps(x[d + i]), mb, msum1);
+            msum2 = _mm256_fmadd_ps(_mm256_set1_ps(x[2 * d + i]), mb, msum2);
+            msum3 = _mm256_fmadd_ps(_mm256_set1_ps(x[3 * d + i]), mb, msum3);
+        }
+        _mm256_storeu_ps(dis, msum0);
+        _mm256_storeu_ps(dis + 8, msum1);
+        _mm256_storeu_ps(dis + 16, msum2);
+        _mm256_storeu_ps(dis + 24, msum3);
+    }
+
+    // 16 byte components widened to 16-bit lanes
+    inline __m256i widen16(const u_int8_t *x) {
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x)));
+    }
+
+    inline __m256i widen16(const int8_t *x) {
+        return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x)));
+    }
+
+    inline u_int32_t horizontalSumEpi32(__m256i v) {
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        return static_cast<u_int32_t>(_mm_cvtsi128_si32(sum));
+    }
+
+    // 8 int16 components converted to float, every int16 is exact in float
+    inline __m256 loadInt16(const int16_t *x) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x))));
+    }
+
+    // differences of bytes fit 16 bits, madd sums pairs of their squares into 32-bit lanes
+    template<typename T>
+    float byteL2sqr(const T *x, const T *y, size_t d) {
+        __m256i msum0 = _mm256_setzero_si256();
+        __m256i msum1 = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 32 <= d; i += 32) {
+            const __m256i a_m_b0 = _mm256_sub_epi16(widen16(x + i), widen16(y + i));
+            const __m256i a_m_b1 = _mm256_sub_epi16(widen16(x + i + 16), widen16(y + i + 16));
+            msum0 = _mm256_add_epi32(msum0, _mm256_madd_epi16(a_m_b0, a_m_b0));
+            msum1 = _mm256_add_epi32(msum1, _mm256_madd_epi16(a_m_b1, a_m_b1));
+        }
+        for (; i + 16 <= d; i += 16) {
+            const __m256i a_m_b = _mm256_sub_epi16(widen16(x + i), widen16(y + i));
+            msum0 = _mm256_add_epi32(msum0, _mm256_madd_epi16(a_m_b, a_m_b));
+        }
+        u_int32_t res = horizontalSumEpi32(_mm256_add_epi32(msum0, msum1));
+        for (; i < d; ++i) {
+            const int32_t tmp = static_cast<int32_t>(x[i]) - static_cast<int32_t>(y[i]);
+            res += static_cast<u_int32_t>(tmp * tmp);
+        }
+        return static_cast<float>(res);
+    }
+
+    // maddubs would saturate u8 x u8 and u8 x i8 pairs in 16 bits, both sides are widened instead
+    template<typename T>
+    float byteInnerProduct(const T *x, const T *y, size_t d) {
+        __m256i msum0 = _mm256_setzero_si256();
+        __m256i msum1 = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 32 <= d; i += 32) {
+            msum0 = _mm256_add_epi32(msum0, _mm256_madd_epi16(widen16(x + i), widen16(y + i)));
+            msum1 = _mm256_add_epi32(msum1, _mm256_madd_epi16(widen16(x + i + 16), widen16(y + i + 16)));
+        }
+        for (; i + 16 <= d; i += 16) {
+            msum0 = _mm256_add_epi32(msum0, _mm256_madd_epi16(widen16(x + i), widen16(y + i)));
+        }
+        u_int32_t res = horizontalSumEpi32(_mm256_add_epi32(msum0, msum1));
+        for (; i < d; ++i) {
+            res += static_cast<u_int32_t>(static_cast<int32_t>(x[i]) * static_cast<int32_t>(y[i]));
+        }
+        if constexpr (std::is_signed_v<T>) {
+            return static_cast<float>(static_cast<int32_t>(res));
+        } else {
+            return static_cast<float>(res);
+        }
+    }
+
+    float u8L2sqr(const u_int8_t *x, const u_int8_t *y, size_t d) {
+        return byteL2sqr(x, y, d);
+    }
+
+    float u8InnerProduct(const u_int8_t *x, const u_int8_t *y, size_t d) {
+        return byteInnerProduct(x, y, d);
+    }
+
+    float i8L2sqr(const int8_t *x, const int8_t *y, size_t d) {
+        return byteL2sqr(x, y, d);
+    }
+
+    float i8InnerProduct(const int8_t *x, const int8_t *y, size_t d) {
+        return byteInnerProduct(x, y, d);
+    }
+
+    float i16L2sqr(const int16_t *x, const int16_t *y, size_t d) {
+        __m256 msum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m256 a_m_b = _mm256_sub_ps(loadInt16(x + i), loadInt16(y + i));
+            msum = _mm256_fmadd_ps(a_m_b, a_m_b, msum);
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            const float tmp = static_cast<float>(x[i]) - static_cast<float>(y[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+
+    float i16InnerProduct(const int16_t *x, const int16_t *y, size_t d) {
+        __m256 msum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            msum = _mm256_fmadd_ps(loadInt16(x + i), loadInt16(y + i), msum);
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            res += static_cast<float>(x[i]) * static_cast<float>(y[i]);
+        }
+        return res;
+    }
+
+    // gathers the table entries of 8 sub-quantizers at once
+    float pqAdcDistance(const float *lut, const u_int8_t *code, size_t m) {
+        const __m256i offsets = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+        __m256 msum = _mm256_setzero_ps();
+        size_t j = 0;
+        for (; j + 8 <= m; j += 8) {
+            __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(code + j)));
+            idx = _mm256_add_epi32(idx, offsets);
+            msum = _mm256_add_ps(msum, _mm256_i32gather_ps(lut + j * 256, idx, 4));
+        }
+        float res = horizontalSum(msum);
+        for (; j < m; ++j) {
+            res += lut[j * 256 + code[j]];
+        }
+        return res;
+    }
+
+    float sq8L2sqr(const float *x, const u_int8_t *code, const float *vmin, const float *scale, size_t d) {
+        __m256 msum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m256i codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(code + i)));
+            const __m256 decoded = _mm256_fmadd_ps(_mm256_cvtepi32_ps(codes), _mm256_loadu_ps(scale + i),
+                                                   _mm256_loadu_ps(vmin + i));
+            const __m256 a_m_b = _mm256_sub_ps(_mm256_loadu_ps(x + i), decoded);
+            msum = _mm256_fmadd_ps(a_m_b, a_m_b, msum);
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            const float tmp = x[i] - (vmin[i] + static_cast<float>(code[i]) * scale[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+
+    float fp16L2sqr(const float *x, const u_int16_t *code, size_t d) {
+        __m256 msum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m256 decoded = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(code + i)));
+            const __m256 a_m_b = _mm256_sub_ps(_mm256_loadu_ps(x + i), decoded);
+            msum = _mm256_fmadd_ps(a_m_b, a_m_b, msum);
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            const float tmp = x[i] - _cvtsh_ss(code[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+}
+
+const DistanceKernels &getAvx2DistanceKernels() {
+    static const DistanceKernels kernels = {
+            SimdLevel::kAVX2, "avx2+fma",
+            l2sqr, innerProduct, normL2sqr, l2sqrBatch4,
+            l2sqrNy, innerProductNy,
+            l2sqrBlocked8, innerProductBlocked8, innerProductBlocked4x8,
+            u8L2sqr, u8InnerProduct, i8L2sqr, i8InnerProduct, i16L2sqr, i16InnerProduct,
+            pqAdcDistance, sq8L2sqr, fp16L2sqr
+    };
+    return kernels;
+}
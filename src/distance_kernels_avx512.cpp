@@ -0,0 +1,268 @@
+// Built with -mavx512f -mavx2 -mfma -mf16c. Only intrinsics and functions local to this file may be used here: an
+// inline function shared with other translation units could be emitted with AVX-512 code and picked by the linker.
+
+#include "distance_kernels.hpp"
+
+#include <immintrin.h>
+
+
+namespace {
+    // lanes [0, rest) enabled, masked loads do not touch disabled lanes
+    inline __mmask16 tailMask(size_t rest) {
+        return static_cast<__mmask16>((1u << rest) - 1);
+    }
+
+    inline float horizontalSum(__m256 v) {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        return _mm_cvtss_f32(sum);
+    }
+
+    // sum of the lower and upper 8 lanes
+    inline __m256 foldHalves(__m512 v) {
+        return _mm256_add_ps(_mm512_castps512_ps256(v),
+                             _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+    }
+
+    float l2sqr(const float *x, const float *y, size_t d) {
+        __m512 msum0 = _mm512_setzero_ps();
+        __m512 msum1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= d; i += 32) {
+            const __m512 a_m_b0 = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+            const __m512 a_m_b1 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16));
+            msum0 = _mm512_fmadd_ps(a_m_b0, a_m_b0, msum0);
+            msum1 = _mm512_fmadd_ps(a_m_b1, a_m_b1, msum1);
+        }
+        for (; i + 16 <= d; i += 16) {
+            const __m512 a_m_b = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+            msum0 = _mm512_fmadd_ps(a_m_b, a_m_b, msum0);
+        }
+        if (i < d) {
+            const __mmask16 mask = tailMask(d - i);
+            const __m512 a_m_b = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+            msum1 = _mm512_fmadd_ps(a_m_b, a_m_b, msum1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(msum0, msum1));
+    }
+
+    float innerProduct(const float *x, const float *y, size_t d) {
+        __m512 msum0 = _mm512_setzero_ps();
+        __m512 msum1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= d; i += 32) {
+            msum0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), msum0);
+            msum1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), msum1);
+        }
+        for (; i + 16 <= d; i += 16) {
+            msum0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), msum0);
+        }
+        if (i < d) {
+            const __mmask16 mask = tailMask(d - i);
+            msum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i), msum1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(msum0, msum1));
+    }
+
+    float normL2sqr(const float *x, size_t d) {
+        __m512 msum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= d; i += 16) {
+            const __m512 mx = _mm512_loadu_ps(x + i);
+            msum = _mm512_fmadd_ps(mx, mx, msum);
+        }
+        if (i < d) {
+            const __m512 mx = _mm512_maskz_loadu_ps(tailMask(d - i), x + i);
+            msum = _mm512_fmadd_ps(mx, mx, msum);
+        }
+        return _mm512_reduce_add_ps(msum);
+    }
+
+    void l2sqrBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                     size_t d, float *dis) {
+        __m512 msum0 = _mm512_setzero_ps();
+        __m512 msum1 = _mm512_setzero_ps();
+        __m512 msum2 = _mm512_setzero_ps();
+        __m512 msum3 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i < d; i += 16) {
+            const __mmask16 mask = d - i >= 16 ? static_cast<__mmask16>(0xffff) : tailMask(d - i);
+            const __m512 mx = _mm512_maskz_loadu_ps(mask, x + i);
+            const __m512 a_m_b0 = _mm512_sub_ps(mx, _mm512_maskz_loadu_ps(mask, y0 + i));
+            const __m512 a_m_b1 = _mm512_sub_ps(mx, _mm512_maskz_loadu_ps(mask, y1 + i));
+            const __m512 a_m_b2 = _mm512_sub_ps(mx, _mm512_maskz_loadu_ps(mask, y2 + i));
+            const __m512 a_m_b3 = _mm512_sub_ps(mx, _mm512_maskz_loadu_ps(mask, y3 + i));
+            msum0 = _mm512_fmadd_ps(a_m_b0, a_m_b0, msum0);
+            msum1 = _mm512_fmadd_ps(a_m_b1, a_m_b1, msum1);
+            msum2 = _mm512_fmadd_ps(a_m_b2, a_m_b2, msum2);
+            msum3 = _mm512_fmadd_ps(a_m_b3, a_m_b3, msum3);
+        }
+        dis[0] = _mm512_reduce_add_ps(msum0);
+        dis[1] = _mm512_reduce_add_ps(msum1);
+        dis[2] = _mm512_reduce_add_ps(msum2);
+        dis[3] = _mm512_reduce_add_ps(msum3);
+    }
+
+    void innerProductBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                            size_t d, float *dis) {
+        __m512 msum0 = _mm512_setzero_ps();
+        __m512 msum1 = _mm512_setzero_ps();
+        __m512 msum2 = _mm512_setzero_ps();
+        __m512 msum3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < d; i += 16) {
+            const __mmask16 mask = d - i >= 16 ? static_cast<__mmask16>(0xffff) : tailMask(d - i);
+            const __m512 mx = _mm512_maskz_loadu_ps(mask, x + i);
+            msum0 = _mm512_fmadd_ps(mx, _mm512_maskz_loadu_ps(mask, y0 + i), msum0);
+            msum1 = _mm512_fmadd_ps(mx, _mm512_maskz_loadu_ps(mask, y1 + i), msum1);
+            msum2 = _mm512_fmadd_ps(mx, _mm512_maskz_loadu_ps(mask, y2 + i), msum2);
+            msum3 = _mm512_fmadd_ps(mx, _mm512_maskz_loadu_ps(mask, y3 + i), msum3);
+        }
+        dis[0] = _mm512_reduce_add_ps(msum0);
+        dis[1] = _mm512_reduce_add_ps(msum1);
+        dis[2] = _mm512_reduce_add_ps(msum2);
+        dis[3] = _mm512_reduce_add_ps(msum3);
+    }
+
+    // four rows per pass, the remaining rows one by one
+    void l2sqrNy(const float *x, const float *y, size_t n, size_t d, float *dis) {
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float *yj = y + j * d;
+            l2sqrBatch4(x, yj, yj + d, yj + 2 * d, yj + 3 * d, d, dis + j);
+        }
+        for (; j < n; ++j) {
+            dis[j] = l2sqr(x, y + j * d, d);
+        }
+    }
+
+    void innerProductNy(const float *x, const float *y, size_t n, size_t d, float *dis) {
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float *yj = y + j * d;
+            innerProductBatch4(x, yj, yj + d, yj + 2 * d, yj + 3 * d, d, dis + j);
+        }
+        for (; j < n; ++j) {
+            dis[j] = innerProduct(x, y + j * d, d);
+        }
+    }
+
+    // two components of the group per step: lanes [0, 8) take component i, lanes [8, 16) component i + 1
+    void l2sqrBlocked8(const float *x, const float *block, size_t d, float *dis) {
+        __m512 msum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 2 <= d; i += 2) {
+            const __m512 mx = _mm512_mask_blend_ps(0xff00, _mm512_set1_ps(x[i]), _mm512_set1_ps(x[i + 1]));
+            const __m512 a_m_b = _mm512_sub_ps(mx, _mm512_loadu_ps(block + i * 8));
+            msum = _mm512_fmadd_ps(a_m_b, a_m_b, msum);
+        }
+        __m256 result = foldHalves(msum);
+        if (i < d) {
+            const __m256 a_m_b = _mm256_sub_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(block + i * 8));
+            result = _mm256_fmadd_ps(a_m_b, a_m_b, result);
+        }
+        _mm256_storeu_ps(dis, result);
+    }
+
+    void innerProductBlocked8(const float *x, const float *block, size_t d, float *dis) {
+        __m512 msum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 2 <= d; i += 2) {
+            const __m512 mx = _mm512_mask_blend_ps(0xff00, _mm512_set1_ps(x[i]), _mm512_set1_ps(x[i + 1]));
+            msum = _mm512_fmadd_ps(mx, _mm512_loadu_ps(block + i * 8), msum);
+        }
+        __m256 result = foldHalves(msum);
+        if (i < d) {
+            result = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(block + i * 8), result);
+        }
+        _mm256_storeu_ps(dis, result);
+    }
+
+    // two components of the group per step as in innerProductBlocked8, one load feeds an accumulator per query
+    void innerProductBlocked4x8(const float *x, const float *block, size_t d, float *dis) {
+        __m512 msum[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+        size_t i = 0;
+        for (; i + 2 <= d; i += 2) {
+            const __m512 mb = _mm512_loadu_ps(block + i * 8);
+            for (size_t q = 0; q < 4; ++q) {
+                const __m512 mx = _mm512_mask_blend_ps(0xff00, _mm512_set1_ps(x[q * d + i]),
+                                                       _mm512_set1_ps(x[q * d + i + 1]));
+                msum[q] = _mm512_fmadd_ps(mx, mb, msum[q]);
+            }
+        }
+        for (size_t q = 0; q < 4; ++q) {
+            __m256 result = foldHalves(msum[q]);
+            if (i < d) {
+                result = _mm256_fmadd_ps(_mm256_set1_ps(x[q * d + i]), _mm256_loadu_ps(block + i * 8), result);
+            }
+            _mm256_storeu_ps(dis + q * 8, result);
+        }
+    }
+
+    // gathers the table entries of 16 sub-quantizers at once
+    float pqAdcDistance(const float *lut, const u_int8_t *code, size_t m) {
+        const __m512i offsets = _mm512_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792,
+                                                  2048, 2304, 2560, 2816, 3072, 3328, 3584, 3840);
+        __m512 msum = _mm512_setzero_ps();
+        size_t j = 0;
+        for (; j + 16 <= m; j += 16) {
+            __m512i idx = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(code + j)));
+            idx = _mm512_add_epi32(idx, offsets);
+            msum = _mm512_add_ps(msum, _mm512_i32gather_ps(idx, lut + j * 256, 4));
+        }
+        float res = _mm512_reduce_add_ps(msum);
+        for (; j < m; ++j) {
+            res += lut[j * 256 + code[j]];
+        }
+        return res;
+    }
+
+    float sq8L2sqr(const float *x, const u_int8_t *code, const float *vmin, const float *scale, size_t d) {
+        __m512 msum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= d; i += 16) {
+            const __m512i codes = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(code + i)));
+            const __m512 decoded = _mm512_fmadd_ps(_mm512_cvtepi32_ps(codes), _mm512_loadu_ps(scale + i),
+                                                   _mm512_loadu_ps(vmin + i));
+            const __m512 a_m_b = _mm512_sub_ps(_mm512_loadu_ps(x + i), decoded);
+            msum = _mm512_fmadd_ps(a_m_b, a_m_b, msum);
+        }
+        float res = _mm512_reduce_add_ps(msum);
+        for (; i < d; ++i) {
+            const float tmp = x[i] - (vmin[i] + static_cast<float>(code[i]) * scale[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+
+    float fp16L2sqr(const float *x, const u_int16_t *code, size_t d) {
+        __m512 msum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= d; i += 16) {
+            const __m512 decoded = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(code + i)));
+            const __m512 a_m_b = _mm512_sub_ps(_mm512_loadu_ps(x + i), decoded);
+            msum = _mm512_fmadd_ps(a_m_b, a_m_b, msum);
+        }
+        float res = _mm512_reduce_add_ps(msum);
+        for (; i < d; ++i) {
+            const float tmp = x[i] - _cvtsh_ss(code[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+}
+
+const DistanceKernels &getAvx512DistanceKernels() {
+    // byte and word arithmetic on 512-bit registers needs AVX-512BW, integer vectors use the AVX2 kernels
+    const DistanceKernels &avx2 = getAvx2DistanceKernels();
+    static const DistanceKernels kernels = {
+            SimdLevel::kAVX512, "avx512f",
+            l2sqr, innerProduct, normL2sqr, l2sqrBatch4,
+            l2sqrNy, innerProductNy,
+            l2sqrBlocked8, innerProductBlocked8, innerProductBlocked4x8,
+            avx2.u8L2sqr, avx2.u8InnerProduct, avx2.i8L2sqr, avx2.i8InnerProduct,
+            avx2.i16L2sqr, avx2.i16InnerProduct,
+            pqAdcDistance, sq8L2sqr, fp16L2sqr
+    };
+    return kernels;
+}
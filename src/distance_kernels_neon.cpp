@@ -0,0 +1,65 @@
+// NEON is part of the aarch64 baseline, no extra target flags are needed. Kernels without a NEON version use
+// the scalar ones.
+
+#include "distance_kernels.hpp"
+
+#include <arm_neon.h>
+
+
+namespace {
+    float l2sqr(const float *x, const float *y, size_t d) {
+        float32x4_t accu = vdupq_n_f32(0);
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            float32x4_t sq = vsubq_f32(vld1q_f32(x + i), vld1q_f32(y + i));
+            accu = vfmaq_f32(accu, sq, sq);
+        }
+        float res = vaddvq_f32(accu);
+        for (; i < d; ++i) {
+            const float tmp = x[i] - y[i];
+            res += tmp * tmp;
+        }
+        return res;
+    }
+
+    float innerProduct(const float *x, const float *y, size_t d) {
+        float32x4_t accu = vdupq_n_f32(0);
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            accu = vfmaq_f32(accu, vld1q_f32(x + i), vld1q_f32(y + i));
+        }
+        float res = vaddvq_f32(accu);
+        for (; i < d; ++i) {
+            res += x[i] * y[i];
+        }
+        return res;
+    }
+
+    float normL2sqr(const float *x, size_t d) {
+        float32x4_t accu = vdupq_n_f32(0);
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            float32x4_t xi = vld1q_f32(x + i);
+            accu = vfmaq_f32(accu, xi, xi);
+        }
+        float res = vaddvq_f32(accu);
+        for (; i < d; ++i) {
+            res += x[i] * x[i];
+        }
+        return res;
+    }
+}
+
+const DistanceKernels &getNeonDistanceKernels() {
+    const DistanceKernels &scalar = getScalarDistanceKernels();
+    static const DistanceKernels kernels = {
+            SimdLevel::kNEON, "neon",
+            l2sqr, innerProduct, normL2sqr, scalar.l2sqrBatch4,
+            scalar.l2sqrNy, scalar.innerProductNy,
+            scalar.l2sqrBlocked8, scalar.innerProductBlocked8, scalar.innerProductBlocked4x8,
+            scalar.u8L2sqr, scalar.u8InnerProduct, scalar.i8L2sqr, scalar.i8InnerProduct,
+            scalar.i16L2sqr, scalar.i16InnerProduct,
+            scalar.pqAdcDistance, scalar.sq8L2sqr, scalar.fp16L2sqr
+    };
+    return kernels;
+}
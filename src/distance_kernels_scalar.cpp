@@ -0,0 +1,21 @@
+#include "calc_distance.hpp"
+
+
+namespace {
+    void l2sqrBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                     size_t d, float *dis) {
+        fvecL2sqrBatch4Ref(x, y0, y1, y2, y3, d, dis[0], dis[1], dis[2], dis[3]);
+    }
+}
+
+const DistanceKernels &getScalarDistanceKernels() {
+    static const DistanceKernels kernels = {
+            SimdLevel::kScalar, "scalar",
+            fvecL2sqrRef, fvecInnerProductRef, fvecNormL2sqrRef, l2sqrBatch4,
+            fvecL2sqrNyRef, fvecInnerProductNyRef,
+            fvecL2sqrBlocked8Ref, fvecInnerProductBlocked8Ref, fvecInnerProductBlocked4x8Ref,
+            u8L2sqrRef, u8InnerProductRef, i8L2sqrRef, i8InnerProductRef, i16L2sqrRef, i16InnerProductRef,
+            pqAdcDistanceRef, sq8L2sqrRef, fp16L2sqrRef
+    };
+    return kernels;
+}
@@ -0,0 +1,323 @@
+// Built with -msse4.1. Only intrinsics and functions local to this file may be used here: an inline function
+// shared with other translation units could be emitted with SSE4.1 code and picked by the linker for all of them.
+
+#include "distance_kernels.hpp"
+
+#include <immintrin.h>
+#include <type_traits>
+
+
+namespace {
+    // reads 0 <= d < 4 floats as __m128
+    inline __m128 maskedRead(size_t d, const float *x) {
+        float buf[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i < d; ++i) {
+            buf[i] = x[i];
+        }
+        return _mm_loadu_ps(buf);
+    }
+
+    inline float horizontalSum(__m128 v) {
+        v = _mm_hadd_ps(v, v);
+        v = _mm_hadd_ps(v, v);
+        return _mm_cvtss_f32(v);
+    }
+
+    float l2sqr(const float *x, const float *y, size_t d) {
+        __m128 msum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            const __m128 a_m_b = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i));
+            msum = _mm_add_ps(msum, _mm_mul_ps(a_m_b, a_m_b));
+        }
+        if (i < d) {
+            const __m128 a_m_b = _mm_sub_ps(maskedRead(d - i, x + i), maskedRead(d - i, y + i));
+            msum = _mm_add_ps(msum, _mm_mul_ps(a_m_b, a_m_b));
+        }
+        return horizontalSum(msum);
+    }
+
+    float innerProduct(const float *x, const float *y, size_t d) {
+        __m128 msum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            msum = _mm_add_ps(msum, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+        }
+        if (i < d) {
+            msum = _mm_add_ps(msum, _mm_mul_ps(maskedRead(d - i, x + i), maskedRead(d - i, y + i)));
+        }
+        return horizontalSum(msum);
+    }
+
+    float normL2sqr(const float *x, size_t d) {
+        __m128 msum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            const __m128 mx = _mm_loadu_ps(x + i);
+            msum = _mm_add_ps(msum, _mm_mul_ps(mx, mx));
+        }
+        if (i < d) {
+            const __m128 mx = maskedRead(d - i, x + i);
+            msum = _mm_add_ps(msum, _mm_mul_ps(mx, mx));
+        }
+        return horizontalSum(msum);
+    }
+
+    void l2sqrBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                     size_t d, float *dis) {
+        __m128 msum0 = _mm_setzero_ps();
+        __m128 msum1 = _mm_setzero_ps();
+        __m128 msum2 = _mm_setzero_ps();
+        __m128 msum3 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            const __m128 mx = _mm_loadu_ps(x + i);
+            const __m128 a_m_b0 = _mm_sub_ps(mx, _mm_loadu_ps(y0 + i));
+            const __m128 a_m_b1 = _mm_sub_ps(mx, _mm_loadu_ps(y1 + i));
+            const __m128 a_m_b2 = _mm_sub_ps(mx, _mm_loadu_ps(y2 + i));
+            const __m128 a_m_b3 = _mm_sub_ps(mx, _mm_loadu_ps(y3 + i));
+            msum0 = _mm_add_ps(msum0, _mm_mul_ps(a_m_b0, a_m_b0));
+            msum1 = _mm_add_ps(msum1, _mm_mul_ps(a_m_b1, a_m_b1));
+            msum2 = _mm_add_ps(msum2, _mm_mul_ps(a_m_b2, a_m_b2));
+            msum3 = _mm_add_ps(msum3, _mm_mul_ps(a_m_b3, a_m_b3));
+        }
+        if (i < d) {
+            const size_t rest = d - i;
+            const __m128 mx = maskedRead(rest, x + i);
+            const __m128 a_m_b0 = _mm_sub_ps(mx, maskedRead(rest, y0 + i));
+            const __m128 a_m_b1 = _mm_sub_ps(mx, maskedRead(rest, y1 + i));
+            const __m128 a_m_b2 = _mm_sub_ps(mx, maskedRead(rest, y2 + i));
+            const __m128 a_m_b3 = _mm_sub_ps(mx, maskedRead(rest, y3 + i));
+            msum0 = _mm_add_ps(msum0, _mm_mul_ps(a_m_b0, a_m_b0));
+            msum1 = _mm_add_ps(msum1, _mm_mul_ps(a_m_b1, a_m_b1));
+            msum2 = _mm_add_ps(msum2, _mm_mul_ps(a_m_b2, a_m_b2));
+            msum3 = _mm_add_ps(msum3, _mm_mul_ps(a_m_b3, a_m_b3));
+        }
+        // [dis0, dis1, dis2, dis3]
+        _mm_storeu_ps(dis, _mm_hadd_ps(_mm_hadd_ps(msum0, msum1), _mm_hadd_ps(msum2, msum3)));
+    }
+
+    void innerProductBatch4(const float *x, const float *y0, const float *y1, const float *y2, const float *y3,
+                            size_t d, float *dis) {
+        __m128 msum0 = _mm_setzero_ps();
+        __m128 msum1 = _mm_setzero_ps();
+        __m128 msum2 = _mm_setzero_ps();
+        __m128 msum3 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            const __m128 mx = _mm_loadu_ps(x + i);
+            msum0 = _mm_add_ps(msum0, _mm_mul_ps(mx, _mm_loadu_ps(y0 + i)));
+            msum1 = _mm_add_ps(msum1, _mm_mul_ps(mx, _mm_loadu_ps(y1 + i)));
+            msum2 = _mm_add_ps(msum2, _mm_mul_ps(mx, _mm_loadu_ps(y2 + i)));
+            msum3 = _mm_add_ps(msum3, _mm_mul_ps(mx, _mm_loadu_ps(y3 + i)));
+        }
+        if (i < d) {
+            const size_t rest = d - i;
+            const __m128 mx = maskedRead(rest, x + i);
+            msum0 = _mm_add_ps(msum0, _mm_mul_ps(mx, maskedRead(rest, y0 + i)));
+            msum1 = _mm_add_ps(msum1, _mm_mul_ps(mx, maskedRead(rest, y1 + i)));
+            msum2 = _mm_add_ps(msum2, _mm_mul_ps(mx, maskedRead(rest, y2 + i)));
+            msum3 = _mm_add_ps(msum3, _mm_mul_ps(mx, maskedRead(rest, y3 + i)));
+        }
+        _mm_storeu_ps(dis, _mm_hadd_ps(_mm_hadd_ps(msum0, msum1), _mm_hadd_ps(msum2, msum3)));
+    }
+
+    // four rows per pass, the remaining rows one by one
+    void l2sqrNy(const float *x, const float *y, size_t n, size_t d, float *dis) {
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float *yj = y + j * d;
+            l2sqrBatch4(x, yj, yj + d, yj + 2 * d, yj + 3 * d, d, dis + j);
+        }
+        for (; j < n; ++j) {
+            dis[j] = l2sqr(x, y + j * d, d);
+        }
+    }
+
+    void innerProductNy(const float *x, const float *y, size_t n, size_t d, float *dis) {
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float *yj = y + j * d;
+            innerProductBatch4(x, yj, yj + d, yj + 2 * d, yj + 3 * d, d, dis + j);
+        }
+        for (; j < n; ++j) {
+            dis[j] = innerProduct(x, y + j * d, d);
+        }
+    }
+
+    void l2sqrBlocked8(const float *x, const float *block, size_t d, float *dis) {
+        __m128 msumLo = _mm_setzero_ps();
+        __m128 msumHi = _mm_setzero_ps();
+        for (size_t i = 0; i < d; ++i) {
+            const __m128 mx = _mm_set1_ps(x[i]);
+            const __m128 a_m_bLo = _mm_sub_ps(mx, _mm_loadu_ps(block + i * 8));
+            const __m128 a_m_bHi = _mm_sub_ps(mx, _mm_loadu_ps(block + i * 8 + 4));
+            msumLo = _mm_add_ps(msumLo, _mm_mul_ps(a_m_bLo, a_m_bLo));
+            msumHi = _mm_add_ps(msumHi, _mm_mul_ps(a_m_bHi, a_m_bHi));
+        }
+        _mm_storeu_ps(dis, msumLo);
+        _mm_storeu_ps(dis + 4, msumHi);
+    }
+
+    void innerProductBlocked8(const float *x, const float *block, size_t d, float *dis) {
+        __m128 msumLo = _mm_setzero_ps();
+        __m128 msumHi = _mm_setzero_ps();
+        for (size_t i = 0; i < d; ++i) {
+            const __m128 mx = _mm_set1_ps(x[i]);
+            msumLo = _mm_add_ps(msumLo, _mm_mul_ps(mx, _mm_loadu_ps(block + i * 8)));
+            msumHi = _mm_add_ps(msumHi, _mm_mul_ps(mx, _mm_loadu_ps(block + i * 8 + 4)));
+        }
+        _mm_storeu_ps(dis, msumLo);
+        _mm_storeu_ps(dis + 4, msumHi);
+    }
+
+    // both halves of a group component are loaded once and used by all 4 queries, 8 accumulators
+    void innerProductBlocked4x8(const float *x, const float *block, size_t d, float *dis) {
+        __m128 msumLo[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+        __m128 msumHi[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+        for (size_t i = 0; i < d; ++i) {
+            const __m128 mbLo = _mm_loadu_ps(block + i * 8);
+            const __m128 mbHi = _mm_loadu_ps(block + i * 8 + 4);
+            for (size_t q = 0; q < 4; ++q) {
+                const __m128 mx = _mm_set1_ps(x[q * d + i]);
+                msumLo[q] = _mm_add_ps(msumLo[q], _mm_mul_ps(mx, mbLo));
+                msumHi[q] = _mm_add_ps(msumHi[q], _mm_mul_ps(mx, mbHi));
+            }
+        }
+        for (size_t q = 0; q < 4; ++q) {
+            _mm_storeu_ps(dis + q * 8, msumLo[q]);
+            _mm_storeu_ps(dis + q * 8 + 4, msumHi[q]);
+        }
+    }
+
+    // 8 byte components widened to 16-bit lanes
+    inline __m128i widen8(const u_int8_t *x) {
+        return _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(x)));
+    }
+
+    inline __m128i widen8(const int8_t *x) {
+        return _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(x)));
+    }
+
+    inline u_int32_t horizontalSumEpi32(__m128i v) {
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+        return static_cast<u_int32_t>(_mm_cvtsi128_si32(v));
+    }
+
+    // 4 int16 components converted to float, every int16 is exact in float
+    inline __m128 loadInt16(const int16_t *x) {
+        return _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(x))));
+    }
+
+    // differences of bytes fit 16 bits, madd sums pairs of their squares into 32-bit lanes
+    template<typename T>
+    float byteL2sqr(const T *x, const T *y, size_t d) {
+        __m128i msum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            const __m128i a_m_b = _mm_sub_epi16(widen8(x + i), widen8(y + i));
+            msum = _mm_add_epi32(msum, _mm_madd_epi16(a_m_b, a_m_b));
+        }
+        u_int32_t res = horizontalSumEpi32(msum);
+        for (; i < d; ++i) {
+            const int32_t tmp = static_cast<int32_t>(x[i]) - static_cast<int32_t>(y[i]);
+            res += static_cast<u_int32_t>(tmp * tmp);
+        }
+        return static_cast<float>(res);
+    }
+
+    template<typename T>
+    float byteInnerProduct(const T *x, const T *y, size_t d) {
+        __m128i msum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            msum = _mm_add_epi32(msum, _mm_madd_epi16(widen8(x + i), widen8(y + i)));
+        }
+        u_int32_t res = horizontalSumEpi32(msum);
+        for (; i < d; ++i) {
+            res += static_cast<u_int32_t>(static_cast<int32_t>(x[i]) * static_cast<int32_t>(y[i]));
+        }
+        if constexpr (std::is_signed_v<T>) {
+            return static_cast<float>(static_cast<int32_t>(res));
+        } else {
+            return static_cast<float>(res);
+        }
+    }
+
+    float u8L2sqr(const u_int8_t *x, const u_int8_t *y, size_t d) {
+        return byteL2sqr(x, y, d);
+    }
+
+    float u8InnerProduct(const u_int8_t *x, const u_int8_t *y, size_t d) {
+        return byteInnerProduct(x, y, d);
+    }
+
+    float i8L2sqr(const int8_t *x, const int8_t *y, size_t d) {
+        return byteL2sqr(x, y, d);
+    }
+
+    float i8InnerProduct(const int8_t *x, const int8_t *y, size_t d) {
+        return byteInnerProduct(x, y, d);
+    }
+
+    float i16L2sqr(const int16_t *x, const int16_t *y, size_t d) {
+        __m128 msum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            const __m128 a_m_b = _mm_sub_ps(loadInt16(x + i), loadInt16(y + i));
+            msum = _mm_add_ps(msum, _mm_mul_ps(a_m_b, a_m_b));
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            const float tmp = static_cast<float>(x[i]) - static_cast<float>(y[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+
+    float i16InnerProduct(const int16_t *x, const int16_t *y, size_t d) {
+        __m128 msum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            msum = _mm_add_ps(msum, _mm_mul_ps(loadInt16(x + i), loadInt16(y + i)));
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            res += static_cast<float>(x[i]) * static_cast<float>(y[i]);
+        }
+        return res;
+    }
+
+    float sq8L2sqr(const float *x, const u_int8_t *code, const float *vmin, const float *scale, size_t d) {
+        __m128 msum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= d; i += 4) {
+            int packed;
+            __builtin_memcpy(&packed, code + i, sizeof(packed));
+            const __m128 codes = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+            const __m128 decoded = _mm_add_ps(_mm_loadu_ps(vmin + i), _mm_mul_ps(codes, _mm_loadu_ps(scale + i)));
+            const __m128 a_m_b = _mm_sub_ps(_mm_loadu_ps(x + i), decoded);
+            msum = _mm_add_ps(msum, _mm_mul_ps(a_m_b, a_m_b));
+        }
+        float res = horizontalSum(msum);
+        for (; i < d; ++i) {
+            const float tmp = x[i] - (vmin[i] + static_cast<float>(code[i]) * scale[i]);
+            res += tmp * tmp;
+        }
+        return res;
+    }
+}
+
+const DistanceKernels &getSseDistanceKernels() {
+    // no gather and no half conversion below AVX2, those stay scalar
+    static const DistanceKernels kernels = {
+            SimdLevel::kSSE, "sse4.1",
+            l2sqr, innerProduct, normL2sqr, l2sqrBatch4,
+            l2sqrNy, innerProductNy,
+            l2sqrBlocked8, innerProductBlocked8, innerProductBlocked4x8,
+            u8L2sqr, u8InnerProduct, i8L2sqr, i8InnerProduct, i16L2sqr, i16InnerProduct,
+            getScalarDistanceKernels().pqAdcDistance, sq8L2sqr, getScalarDistanceKernels().fp16L2sqr
+    };
+    return kernels;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "page.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+
+// Small process-wide numbers for threads, reused after a thread exits. EpochManager keeps one slot per number.
+class ThreadSlotRegistry {
+public:
+    static constexpr size_t kMaxThreadCount = 1024;
+
+    static ThreadSlotRegistry &get() {
+        static ThreadSlotRegistry registry;
+        return registry;
+    }
+
+    // number of the calling thread
+    static size_t getThreadSlot() {
+        thread_local ThreadSlot slot(get());
+        return slot.index;
+    }
+
+    // every thread number handed out so far is below it
+    [[nodiscard]] size_t getSlotCount() const {
+        return slotCount.load(std::memory_order_acquire);
+    }
+
+private:
+    struct ThreadSlot {
+        ThreadSlotRegistry &registry;
+        size_t index;
+
+        explicit ThreadSlot(ThreadSlotRegistry &registry) : registry(registry), index(registry.acquire()) {}
+
+        ~ThreadSlot() {
+            registry.release(index);
+        }
+    };
+
+    std::mutex mutex;
+    std::vector<size_t> freeSlots;
+    std::atomic<size_t> slotCount{0};
+
+    size_t acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeSlots.empty()) {
+            size_t index = freeSlots.back();
+            freeSlots.pop_back();
+            return index;
+        }
+        size_t index = slotCount.load(std::memory_order_relaxed);
+        if (index == kMaxThreadCount) {
+            throw std::runtime_error("Too many threads use epoch based reclamation.");
+        }
+        slotCount.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    void release(size_t index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(index);
+    }
+};
+
+// Epoch based reclamation of pages a writer has unlinked while lock-free readers may still walk them.
+// A reader pins the current epoch for the length of an operation with an EpochGuard. The writer retires
+// unlinked pages under the current epoch and advances it, reclaim then hands out pages retired before the
+// oldest pinned epoch. Pinning is a store to a per-thread cache line, so readers never wait for writers.
+// retire and reclaim are called by one writer at a time.
+class EpochManager {
+public:
+    EpochManager() : slots(new Slot[ThreadSlotRegistry::kMaxThreadCount]) {}
+
+    EpochManager(const EpochManager &) = delete;
+
+    EpochManager &operator=(const EpochManager &) = delete;
+
+    // returns the previous pin of the thread, nested pins keep the outer one
+    u_int64_t pin() const {
+        std::atomic<u_int64_t> &slot = slots[ThreadSlotRegistry::getThreadSlot()].epoch;
+        const u_int64_t pinned = slot.load(std::memory_order_relaxed);
+        if (pinned == 0) {
+            slot.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+            // orders the pin before the reads of the operation, pairs with the fence in reclaim
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return pinned;
+    }
+
+    void unpin(u_int64_t pinned) const {
+        if (pinned == 0) {
+            slots[ThreadSlotRegistry::getThreadSlot()].epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // pages are already unreachable for readers that pin from now on
+    void retire(std::vector<BlockNumber> pages) {
+        if (pages.empty()) {
+            return;
+        }
+        retired.push_back(Retired{epoch.load(std::memory_order_relaxed), std::move(pages)});
+        epoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    // calls release(page) for every retired page no reader can see anymore and returns how many there were
+    template<typename F>
+    size_t reclaim(F release) {
+        if (retired.empty()) {
+            return 0;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        u_int64_t oldestPinned = std::numeric_limits<u_int64_t>::max();
+        const size_t slotCount = ThreadSlotRegistry::get().getSlotCount();
+        for (size_t i = 0; i < slotCount; ++i) {
+            const u_int64_t pinned = slots[i].epoch.load(std::memory_order_acquire);
+            if (pinned != 0) {
+                oldestPinned = std::min(oldestPinned, pinned);
+            }
+        }
+
+        size_t releasedCount = 0;
+        auto it = retired.begin();
+        for (; it != retired.end() && it->epoch < oldestPinned; ++it) {
+            for (BlockNumber page: it->pages) {
+                release(page);
+            }
+            releasedCount += it->pages.size();
+        }
+        retired.erase(retired.begin(), it);
+        return releasedCount;
+    }
+
+    [[nodiscard]] size_t getRetiredPageCount() const {
+        size_t count = 0;
+        for (const Retired &batch: retired) {
+            count += batch.pages.size();
+        }
+        return count;
+    }
+
+private:
+    struct alignas(kCacheLineSize) Slot {
+        // 0 if the thread is not reading
+        std::atomic<u_int64_t> epoch{0};
+    };
+
+    struct Retired {
+        u_int64_t epoch;
+        std::vector<BlockNumber> pages;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    // starts at 1, 0 marks a free slot
+    std::atomic<u_int64_t> epoch{1};
+    std::vector<Retired> retired;
+};
+
+// pins the epoch of the manager for the life of the guard
+class EpochGuard {
+public:
+    explicit EpochGuard(const EpochManager &epochs) : epochs(epochs), pinned(epochs.pin()) {}
+
+    EpochGuard(const EpochGuard &) = delete;
+
+    EpochGuard &operator=(const EpochGuard &) = delete;
+
+    ~EpochGuard() {
+        epochs.unpin(pinned);
+    }
+
+private:
+    const EpochManager &epochs;
+    const u_int64_t pinned;
+};
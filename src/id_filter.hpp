@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include <sys/types.h>
+
+
+// Set of vector ids for PaseIVFFlat::searchFiltered, one bit per id below the capacity.
+// Any callable bool(u_int32_t id) works as a filter as well, the bitmap is the cheap one to evaluate per slot.
+class IdBitmap {
+public:
+    explicit IdBitmap(size_t capacity) : words((capacity + 63) / 64, 0), capacity(capacity) {}
+
+    void set(u_int32_t id) {
+        checkId(id);
+        words[id / 64] |= u_int64_t(1) << (id % 64);
+    }
+
+    void reset(u_int32_t id) {
+        checkId(id);
+        words[id / 64] &= ~(u_int64_t(1) << (id % 64));
+    }
+
+    // ids above the capacity are not in the set
+    inline bool operator()(u_int32_t id) const {
+        return id < capacity && ((words[id / 64] >> (id % 64)) & 1);
+    }
+
+    [[nodiscard]] size_t count() const {
+        size_t result = 0;
+        for (u_int64_t word: words) {
+            result += __builtin_popcountll(word);
+        }
+        return result;
+    }
+
+    [[nodiscard]] inline size_t getCapacity() const {
+        return capacity;
+    }
+
+private:
+    std::vector<u_int64_t> words;
+    size_t capacity;
+
+    void checkId(u_int32_t id) const {
+        if (id >= capacity) {
+            throw std::invalid_argument("Id does not fit into the bitmap.");
+        }
+    }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "metric.hpp"
+#include "page.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <sys/types.h>
+#include <type_traits>
+#include <vector>
+
+
+// On-disk index layout, every block is PG_PAGE_SIZE bytes:
+//   block 0                      IndexFileHeader, zero padded
+//   blocks 1..centroidPageCount  centroid records, see CentroidRecordHeader
+//   following dataPageCount      DataPage<T> exactly as laid out in the PageArena, in pageLayout
+// Page links are numbers of data pages counted from the first one, kInvalidBlockNumber ends a chain,
+// so the data pages can be searched in place when the file is mapped, see PaseIVFFlat::map.
+
+static constexpr char kIndexFileMagic[8] = {'P', 'A', 'S', 'E', 'I', 'V', 'F', '\0'};
+static constexpr u_int32_t kIndexFileVersion = 5;
+// IndexFileHeader::flags: some vectors are stored in a cluster other than that of their nearest centroid
+static constexpr u_int64_t kIndexFileFlagBalancedAssignment = 1;
+
+enum class ElementType : u_int32_t {
+    kUnknown = 0,
+    kFloat = 1,
+    kDouble = 2,
+    kInt8 = 3,
+    kUInt8 = 4,
+    kInt16 = 5,
+    kUInt16 = 6,
+    kInt32 = 7,
+    kUInt32 = 8,
+    kChar = 9
+};
+
+template<typename T>
+constexpr ElementType elementTypeOf() {
+    using U = typename std::remove_cv<T>::type;
+    if constexpr (std::is_same<U, float>::value) {
+        return ElementType::kFloat;
+    } else if constexpr (std::is_same<U, double>::value) {
+        return ElementType::kDouble;
+    } else if constexpr (std::is_same<U, char>::value) {
+        return ElementType::kChar;
+    } else if constexpr (std::is_same<U, int8_t>::value) {
+        return ElementType::kInt8;
+    } else if constexpr (std::is_same<U, u_int8_t>::value) {
+        return ElementType::kUInt8;
+    } else if constexpr (std::is_same<U, int16_t>::value) {
+        return ElementType::kInt16;
+    } else if constexpr (std::is_same<U, u_int16_t>::value) {
+        return ElementType::kUInt16;
+    } else if constexpr (std::is_same<U, int32_t>::value) {
+        return ElementType::kInt32;
+    } else if constexpr (std::is_same<U, u_int32_t>::value) {
+        return ElementType::kUInt32;
+    }
+    return ElementType::kUnknown;
+}
+
+struct IndexFileHeader {
+    char magic[8];
+    u_int32_t version;
+    u_int32_t pageSize;
+    u_int64_t dimension;
+    u_int64_t clusterCount;
+    u_int32_t elementType;
+    u_int32_t elementSize;
+    u_int32_t metric;
+    u_int32_t pageLayout;
+    u_int64_t centroidPageCount;
+    u_int64_t dataPageCount;
+    // see PaseIVFFlat::setMaxClusterSize, 0 for no cap
+    u_int64_t maxClusterSize;
+    // kIndexFileFlag* bits
+    u_int64_t flags;
+};
+
+// precedes the centroid vector of every record on a centroid page
+struct CentroidRecordHeader {
+    u_int64_t vectorCount;
+    BlockNumber firstDataPage;
+    u_int32_t reserved;
+};
+
+template<typename T>
+inline size_t calcCentroidRecordSize(size_t dimension) {
+    return sizeof(CentroidRecordHeader) + dimension * sizeof(T);
+}
+
+template<typename T>
+inline size_t calcCentroidRecordsPerPage(size_t dimension) {
+    return PG_PAGE_SIZE / calcCentroidRecordSize<T>(dimension);
+}
+
+inline void writeBlock(std::ofstream &out, const char *block) {
+    out.write(block, static_cast<std::streamsize>(PG_PAGE_SIZE));
+    if (!out) {
+        throw std::runtime_error("Failed to write index page.");
+    }
+}
+
+inline void readBlock(std::ifstream &in, char *block) {
+    in.read(block, static_cast<std::streamsize>(PG_PAGE_SIZE));
+    if (!in) {
+        throw std::runtime_error("Index file is truncated.");
+    }
+}
+
+inline IndexFileHeader parseIndexFileHeader(const char *block, const std::string &path) {
+    IndexFileHeader header{};
+    std::memcpy(&header, block, sizeof(header));
+    if (std::memcmp(header.magic, kIndexFileMagic, sizeof(kIndexFileMagic)) != 0) {
+        throw std::runtime_error("File '" + path + "' is not a PASE index.");
+    }
+    if (header.version != kIndexFileVersion) {
+        throw std::runtime_error("Index file '" + path + "' has unsupported version " +
+                                 std::to_string(header.version) + ".");
+    }
+    if (header.pageSize != PG_PAGE_SIZE) {
+        throw std::runtime_error("Index file '" + path + "' was written with a different page size.");
+    }
+    return header;
+}
+
+inline IndexFileHeader readIndexFileHeader(std::ifstream &in, const std::string &path) {
+    std::vector<char> block(PG_PAGE_SIZE);
+    readBlock(in, block.data());
+    return parseIndexFileHeader(block.data(), path);
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "calc_distance.hpp"
+#include "clustering.hpp"
+#include "metric.hpp"
+#include "nearest_centroid.hpp"
+#include "page.hpp"
+#include "page_arena.hpp"
+#include "parallel.hpp"
+#include "top_k.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+
+// Coarse quantizer and code pages shared by the IVF indexes that store cluster contents as codeSize byte codes on
+// DataPage<u_int8_t> pages. Holds the centroids, assigns vectors to them, selects the clusters to probe and appends
+// codes to the page chains; derived indexes decide how a vector is encoded and how a code is scored.
+struct IVFCodeIndex {
+    const size_t dimension;
+    const size_t clusterCount;
+    // bytes per stored vector
+    const size_t codeSize;
+
+    // coarse centroids by cluster id with the heads of their code page chains
+    std::vector<CentroidTuple<float>> centroids;
+    // the same centroids stored row after row (clusterCount x dimension) for the one-vs-many distance kernels
+    std::vector<float> centroidRows;
+    PageArena pageArena;
+
+    IVFCodeIndex(size_t dimension, size_t clusterCount, size_t codeSize)
+            : dimension(dimension), clusterCount(clusterCount), codeSize(codeSize) {
+        if (DataPage<u_int8_t>::calcVectorCount(codeSize) == 0) {
+            throw std::logic_error("Code size is too big. Even one code can not be stored on 8 KB page.");
+        }
+    }
+
+    IVFCodeIndex(const IVFCodeIndex &) = delete;
+
+    IVFCodeIndex &operator=(const IVFCodeIndex &) = delete;
+
+    inline DataPage<u_int8_t> *getDataPage(BlockNumber pageNumber) {
+        return reinterpret_cast<DataPage<u_int8_t> *>(pageArena.getPage(pageNumber));
+    }
+
+    inline const DataPage<u_int8_t> *getDataPage(BlockNumber pageNumber) const {
+        return reinterpret_cast<const DataPage<u_int8_t> *>(pageArena.getPage(pageNumber));
+    }
+
+protected:
+    template<typename T>
+    void setCentroids(const IVFFlatClusterData<T> &data) {
+        centroids.assign(clusterCount, CentroidTuple<float>());
+        centroidRows.resize(clusterCount * dimension);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            centroids[c].vec.assign(data.centroids[c].begin(), data.centroids[c].end());
+            std::copy(data.centroids[c].begin(), data.centroids[c].end(), centroidRows.begin() + c * dimension);
+        }
+    }
+
+    // Assigns points to their nearest clusters with the tiled assignment kernel, encodes them in parallel and appends
+    // the codes to the pages of their clusters in input order. encode(point, clusterId, code) receives the point
+    // converted to float and writes codeSize bytes.
+    template<typename T, typename Encode>
+    void addCodes(const std::vector<std::vector<T>> &points, const std::vector<u_int32_t> &ids, Encode encode) {
+        if (centroids.empty()) {
+            throw std::logic_error("Index is not trained.");
+        }
+        const size_t pointsCount = points.size();
+        std::vector<u_int32_t> clusterIds(pointsCount);
+        findNearestCentroids<MetricType::kL2>(centroidRows.data(), clusterCount, dimension, points, clusterIds.data(),
+                                              nullptr);
+        std::vector<u_int8_t> codes(pointsCount * codeSize);
+        parallelFor(pointsCount, calcChunkSize(pointsCount, 256), [&](size_t begin, size_t end) {
+            std::vector<float> point(dimension);
+            for (size_t p = begin; p < end; ++p) {
+                std::copy(points[p].begin(), points[p].end(), point.begin());
+                encode(point.data(), clusterIds[p], codes.data() + p * codeSize);
+            }
+        });
+        for (size_t p = 0; p < pointsCount; ++p) {
+            appendCode(clusterIds[p], codes.data() + p * codeSize, ids[p]);
+        }
+    }
+
+    // Writes the ids of the probeCount clusters closest to the query to clusterIds in ascending order of distance
+    // and returns how many were written. distances and clusterIds are the caller's scratch and only grow.
+    size_t selectClusters(const float *query, const size_t probeCount, std::vector<float> &distances,
+                          std::vector<u_int32_t> &clusterIds) const {
+        if (distances.size() < probeCount) {
+            distances.resize(probeCount);
+            clusterIds.resize(probeCount);
+        }
+        thread_local std::vector<float> centroidDistances;
+        centroidDistances.resize(clusterCount);
+        fvecL2sqrNy(query, centroidRows.data(), clusterCount, dimension, centroidDistances.data());
+        TopK<u_int32_t> topClusters(distances.data(), clusterIds.data(), probeCount);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            topClusters.push(centroidDistances[c], static_cast<u_int32_t>(c));
+        }
+        topClusters.finalize();
+        return topClusters.size();
+    }
+
+    // calls f(codes, ids, count) for every code page of the cluster
+    template<typename F>
+    void forEachCodePage(const u_int32_t clusterId, F f) const {
+        for (BlockNumber pageNumber = centroids[clusterId].firstDataPage; pageNumber != kInvalidBlockNumber;) {
+            const DataPage<u_int8_t> *pg = getDataPage(pageNumber);
+            f(pg->getVectors(), pg->getIds(codeSize), static_cast<size_t>(pg->header.vectorCount));
+            pageNumber = pg->header.nextPage;
+        }
+    }
+
+    void appendCode(u_int32_t clusterId, const u_int8_t *code, u_int32_t id) {
+        CentroidTuple<float> &cluster = centroids[clusterId];
+        if (cluster.lastDataPage == kInvalidBlockNumber ||
+            getDataPage(cluster.lastDataPage)->header.vectorCount == DataPage<u_int8_t>::calcVectorCount(codeSize)) {
+            BlockNumber newPage = pageArena.allocatePage();
+            getDataPage(newPage)->init(PageLayout::kRowMajor);
+            if (cluster.lastDataPage == kInvalidBlockNumber) {
+                cluster.firstDataPage = newPage;
+            } else {
+                getDataPage(cluster.lastDataPage)->header.nextPage = newPage;
+            }
+            cluster.lastDataPage = newPage;
+        }
+        getDataPage(cluster.lastDataPage)->appendVector(code, id, codeSize);
+        ++cluster.vectorCount;
+    }
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "page.hpp"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Read-only shared mapping of a page file. Pages are faulted in by the kernel on first access
+// and shared through the page cache between all processes mapping the same file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file '" + path + "'.");
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat file '" + path + "'.");
+        }
+        size = static_cast<size_t>(st.st_size);
+        void *ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            throw std::runtime_error("Failed to map file '" + path + "'.");
+        }
+        data = static_cast<const char *>(ptr);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        ::munmap(const_cast<char *>(data), size);
+    }
+
+    [[nodiscard]] inline size_t getBlockCount() const {
+        return size / PG_PAGE_SIZE;
+    }
+
+    [[nodiscard]] inline const char *getBlock(size_t blockNumber) const {
+        if (blockNumber >= getBlockCount()) {
+            throw std::runtime_error("Page link points outside of the mapped index.");
+        }
+        return data + blockNumber * PG_PAGE_SIZE;
+    }
+
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "calc_distance.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <sys/types.h>
+#include <type_traits>
+
+
+enum class MetricType : u_int32_t {
+    // squared euclidean distance
+    kL2 = 0,
+    // maximum inner product search
+    kInnerProduct = 1,
+    // cosine similarity, vectors are normalized once when they enter the index and then compared by inner product
+    kCosine = 2
+};
+
+// element types with their own SIMD kernels, vectors of two such types of the same kind skip float conversion
+template<typename T>
+constexpr bool hasDistanceKernels() {
+    using U = typename std::remove_cv<T>::type;
+    return std::is_same<U, float>::value || std::is_same<U, u_int8_t>::value || std::is_same<U, int8_t>::value ||
+           std::is_same<U, int16_t>::value;
+}
+
+template<typename T>
+inline float vecL2sqr(const T *x, const T *y, size_t d) {
+    using U = typename std::remove_cv<T>::type;
+    if constexpr (std::is_same<U, float>::value) {
+        return fvecL2sqr(x, y, d);
+    } else if constexpr (std::is_same<U, u_int8_t>::value) {
+        return u8L2sqr(x, y, d);
+    } else if constexpr (std::is_same<U, int8_t>::value) {
+        return i8L2sqr(x, y, d);
+    } else {
+        static_assert(std::is_same<U, int16_t>::value, "No distance kernels for the element type.");
+        return i16L2sqr(x, y, d);
+    }
+}
+
+template<typename T>
+inline float vecInnerProduct(const T *x, const T *y, size_t d) {
+    using U = typename std::remove_cv<T>::type;
+    if constexpr (std::is_same<U, float>::value) {
+        return fvecInnerProduct(x, y, d);
+    } else if constexpr (std::is_same<U, u_int8_t>::value) {
+        return u8InnerProduct(x, y, d);
+    } else if constexpr (std::is_same<U, int8_t>::value) {
+        return i8InnerProduct(x, y, d);
+    } else {
+        static_assert(std::is_same<U, int16_t>::value, "No distance kernels for the element type.");
+        return i16InnerProduct(x, y, d);
+    }
+}
+
+// Distance under the metric, smaller is closer: squared L2 for kL2 and the negated inner product otherwise,
+// so a single bounded min-selection serves every metric.
+template<MetricType Metric, typename T, typename U>
+inline float metricDistance(const T *x, const U *y, size_t d) {
+    if constexpr (std::is_same<typename std::remove_cv<T>::type, typename std::remove_cv<U>::type>::value &&
+                  hasDistanceKernels<T>()) {
+        if constexpr (Metric == MetricType::kL2) {
+            return vecL2sqr(x, y, d);
+        } else {
+            return -vecInnerProduct(x, y, d);
+        }
+    } else {
+        float result = 0;
+        for (size_t i = 0; i < d; ++i) {
+            if constexpr (Metric == MetricType::kL2) {
+                float diff = static_cast<float>(x[i]) - static_cast<float>(y[i]);
+                result += diff * diff;
+            } else {
+                result += static_cast<float>(x[i]) * static_cast<float>(y[i]);
+            }
+        }
+        return Metric == MetricType::kL2 ? result : -result;
+    }
+}
+
+// metricDistance from x to n vectors stored row after row at y, float vectors go through the one-vs-many kernels
+template<MetricType Metric, typename T>
+inline void metricDistances(const T *x, const T *y, size_t n, size_t d, float *out) {
+    if constexpr (std::is_same<float, typename std::remove_cv<T>::type>::value) {
+        if constexpr (Metric == MetricType::kL2) {
+            fvecL2sqrNy(x, y, n, d, out);
+        } else {
+            fvecInnerProductNy(x, y, n, d, out);
+            for (size_t j = 0; j < n; ++j) {
+                out[j] = -out[j];
+            }
+        }
+    } else {
+        for (size_t j = 0; j < n; ++j) {
+            out[j] = metricDistance<Metric>(x, y + j * d, d);
+        }
+    }
+}
+
+// scales x to unit length in place, zero vectors are left as they are
+template<typename T>
+inline void normalizeVector(T *x, size_t d) {
+    static_assert(std::is_floating_point<T>::value, "Only floating point vectors can be normalized.");
+    float norm = 0;
+    for (size_t i = 0; i < d; ++i) {
+        norm += static_cast<float>(x[i]) * static_cast<float>(x[i]);
+    }
+    if (norm > 0) {
+        const float invNorm = 1 / std::sqrt(norm);
+        for (size_t i = 0; i < d; ++i) {
+            x[i] = static_cast<T>(x[i] * invNorm);
+        }
+    }
+}
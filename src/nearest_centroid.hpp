@@ -0,0 +1,168 @@
+#pragma once
+
+#include "calc_distance.hpp"
+#include "metric.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include <sys/types.h>
+
+
+// Tile of the assignment: a block of points is run against one block of centroids at a time. 256 centroids of
+// 128 floats are 128 KiB and stay in L2 while every point of the block passes over them.
+constexpr size_t kAssignPointBlockSize = 64;
+constexpr size_t kAssignCentroidBlockSize = 256;
+
+// Nearest centroid of every point under the metric, for k-means assignment and index build.
+// centroids holds centroidCount float rows of dimension values. kL2 distances come from ||x||² − 2x·c + ||c||²
+// with the centroid norms computed once, the other metrics use −x·c, so the inner loop is a dot product of a point
+// against a run of centroid rows. labels and distances receive one entry per point, distances may be nullptr.
+// Runs on the thread pool in chunks of whole point blocks, must not be called from a pool task.
+template<MetricType Metric, typename T>
+void findNearestCentroids(const float *centroids, const size_t centroidCount, const size_t dimension,
+                          const std::vector<std::vector<T>> &points, u_int32_t *labels, float *distances) {
+    const size_t pointsCount = points.size();
+    if (centroidCount == 0 || pointsCount == 0) {
+        return;
+    }
+    std::vector<float> centroidNorms(centroidCount, 0);
+    if constexpr (Metric == MetricType::kL2) {
+        for (size_t c = 0; c < centroidCount; ++c) {
+            centroidNorms[c] = fvecNormL2sqr(centroids + c * dimension, dimension);
+        }
+    }
+
+    const size_t chunkSize = calcChunkSize(pointsCount, kAssignPointBlockSize);
+    parallelFor(pointsCount, chunkSize, [&](size_t begin, size_t end) {
+        // points of the block converted to float and stored row after row
+        std::vector<float> block(kAssignPointBlockSize * dimension);
+        std::vector<float> pointNorms(kAssignPointBlockSize);
+        std::vector<float> minDistances(kAssignPointBlockSize);
+        std::vector<u_int32_t> nearest(kAssignPointBlockSize);
+        std::vector<float> products(kAssignCentroidBlockSize);
+
+        for (size_t blockBegin = begin; blockBegin < end; blockBegin += kAssignPointBlockSize) {
+            const size_t blockSize = std::min(kAssignPointBlockSize, end - blockBegin);
+            for (size_t i = 0; i < blockSize; ++i) {
+                const std::vector<T> &point = points[blockBegin + i];
+                float *row = block.data() + i * dimension;
+                std::copy(point.begin(), point.begin() + dimension, row);
+                if constexpr (Metric == MetricType::kL2) {
+                    pointNorms[i] = fvecNormL2sqr(row, dimension);
+                }
+                minDistances[i] = std::numeric_limits<float>::max();
+                nearest[i] = 0;
+            }
+
+            for (size_t centroidBegin = 0; centroidBegin < centroidCount; centroidBegin += kAssignCentroidBlockSize) {
+                const size_t centroidBlockSize = std::min(kAssignCentroidBlockSize, centroidCount - centroidBegin);
+                const float *centroidBlock = centroids + centroidBegin * dimension;
+                for (size_t i = 0; i < blockSize; ++i) {
+                    fvecInnerProductNy(block.data() + i * dimension, centroidBlock, centroidBlockSize, dimension,
+                                       products.data());
+                    // the point norm is the same for every centroid and is added once the minimum is known
+                    for (size_t c = 0; c < centroidBlockSize; ++c) {
+                        float dist;
+                        if constexpr (Metric == MetricType::kL2) {
+                            dist = centroidNorms[centroidBegin + c] - 2 * products[c];
+                        } else {
+                            dist = -products[c];
+                        }
+                        if (dist < minDistances[i]) {
+                            minDistances[i] = dist;
+                            nearest[i] = static_cast<u_int32_t>(centroidBegin + c);
+                        }
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < blockSize; ++i) {
+                labels[blockBegin + i] = nearest[i];
+                if (distances != nullptr) {
+                    if constexpr (Metric == MetricType::kL2) {
+                        // the expansion may cancel slightly below zero
+                        distances[blockBegin + i] = std::max(0.0f, pointNorms[i] + minDistances[i]);
+                    } else {
+                        distances[blockBegin + i] = minDistances[i];
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Caps the clusters at maxClusterSize points, 0 leaves the assignment alone. A cluster over the cap keeps its
+// closest points, the others move to the nearest cluster that still has room. A round only adds points to open
+// clusters and closes the ones it fills, so at most centroidCount rounds run. labels and distances come from
+// findNearestCentroids and are updated in place. Throws if the points do not fit into the clusters.
+template<MetricType Metric, typename T>
+void balanceAssignment(const float *centroids, const size_t centroidCount, const size_t dimension,
+                       const std::vector<std::vector<T>> &points, u_int32_t *labels, float *distances,
+                       const size_t maxClusterSize) {
+    const size_t pointsCount = points.size();
+    if (maxClusterSize == 0 || pointsCount == 0) {
+        return;
+    }
+    if (maxClusterSize * centroidCount < pointsCount) {
+        throw std::invalid_argument("Points do not fit into the clusters at the maximum cluster size.");
+    }
+    // closer first, ties by index keep the result independent of the thread count
+    auto isCloser = [distances](u_int32_t lhs, u_int32_t rhs) {
+        return distances[lhs] < distances[rhs] || (distances[lhs] == distances[rhs] && lhs < rhs);
+    };
+    std::vector<std::vector<u_int32_t>> candidates(centroidCount);
+    for (size_t j = 0; j < pointsCount; ++j) {
+        candidates[labels[j]].push_back(static_cast<u_int32_t>(j));
+    }
+    std::vector<size_t> sizes(centroidCount, 0);
+    std::vector<u_int32_t> overflow;
+    std::vector<float> openCentroids;
+    std::vector<u_int32_t> openIds;
+    std::vector<std::vector<T>> movedPoints;
+    std::vector<u_int32_t> movedLabels;
+    std::vector<float> movedDistances;
+    while (true) {
+        // clusters accept their closest candidates up to the cap
+        overflow.clear();
+        for (size_t c = 0; c < centroidCount; ++c) {
+            std::vector<u_int32_t> &incoming = candidates[c];
+            const size_t room = maxClusterSize - sizes[c];
+            if (incoming.size() > room) {
+                std::nth_element(incoming.begin(), incoming.begin() + room, incoming.end(), isCloser);
+                overflow.insert(overflow.end(), incoming.begin() + room, incoming.end());
+                incoming.resize(room);
+            }
+            sizes[c] += incoming.size();
+            incoming.clear();
+        }
+        if (overflow.empty()) {
+            return;
+        }
+
+        openCentroids.clear();
+        openIds.clear();
+        for (size_t c = 0; c < centroidCount; ++c) {
+            if (sizes[c] < maxClusterSize) {
+                openCentroids.insert(openCentroids.end(), centroids + c * dimension, centroids + (c + 1) * dimension);
+                openIds.push_back(static_cast<u_int32_t>(c));
+            }
+        }
+        movedPoints.clear();
+        for (u_int32_t j: overflow) {
+            movedPoints.push_back(points[j]);
+        }
+        movedLabels.resize(overflow.size());
+        movedDistances.resize(overflow.size());
+        findNearestCentroids<Metric>(openCentroids.data(), openIds.size(), dimension, movedPoints,
+                                     movedLabels.data(), movedDistances.data());
+        for (size_t i = 0; i < overflow.size(); ++i) {
+            const u_int32_t j = overflow[i];
+            labels[j] = openIds[movedLabels[i]];
+            distances[j] = movedDistances[i];
+            candidates[labels[j]].push_back(j);
+        }
+    }
+}
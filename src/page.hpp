@@ -1,9 +1,30 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
+#include <limits>
+#include <sys/types.h>
 
 
-static size_t PG_PAGE_SIZE = 8192;  // 8 KB
+static constexpr size_t PG_PAGE_SIZE = 8192;  // 8 KB
+
+// page number inside a PageArena or an index page file
+using BlockNumber = u_int32_t;
+
+static constexpr BlockNumber kInvalidBlockNumber = std::numeric_limits<BlockNumber>::max();
+
+// Fields that a writer changes while lock-free readers walk the pages, see PaseIVFFlat. The writer publishes
+// with storeRelease after the data it covers is written, readers read them with loadAcquire.
+template<typename U>
+inline U loadAcquire(const U &value) {
+    return std::atomic_ref<U>(const_cast<U &>(value)).load(std::memory_order_acquire);
+}
+
+template<typename U>
+inline void storeRelease(U &value, const U newValue) {
+    std::atomic_ref<U>(value).store(newValue, std::memory_order_release);
+}
 
 template<typename T>
 struct Page {
@@ -16,41 +37,184 @@ struct Page {
         return (PG_PAGE_SIZE - sizeof(Page<T> *)) / sizeof(T);
     }
 
-    static size_t calcVectorCount(size_t dimension) {
-        return calcTuplesSize() * sizeof(T) / (sizeof(T) * dimension + 4);
-    }
-
     [[nodiscard]] inline bool hasNextPage() const {
         return nextPage != nullptr;
     }
+};
 
-    inline typename std::vector<T>::const_iterator getEndTuples(size_t dimension) const {
-        return tuples.cbegin() + calcVectorCount(dimension) * dimension;
-    }
+// How vectors are laid out in the body of a data page.
+// kRowMajor stores vectors one after another. kBlocked groups kBlockedLanes vectors and stores them
+// dimension by dimension, so kBlockedLanes distances can be computed at once with SIMD.
+enum class PageLayout : u_int32_t {
+    kRowMajor = 0,
+    kBlocked = 1
 };
 
-template<typename T>
-using DataPage = Page<T>;
+static constexpr size_t kBlockedLanes = 8;
+static constexpr size_t kCacheLineSize = 64;
 
+struct alignas(kCacheLineSize) DataPageHeader {
+    // used slots, deleted ones included
+    u_int32_t vectorCount;
+    BlockNumber nextPage;
+    PageLayout layout;
+    // slots marked in the tombstone bitmap
+    u_int32_t deadCount;
+    u_int32_t reserved[12];
+};
+
+static_assert(sizeof(DataPageHeader) == kCacheLineSize);
+
+// Fixed size page placed in a PageArena, byte-identical in memory and in a page file:
+// inline header, cache line aligned vector storage, a packed array of ids, then a tombstone bitmap with a set
+// bit for every deleted slot. Scans skip the bitmap while header.deadCount is 0.
 template<typename T>
-struct CentroidTuple {
-    std::vector<T> vec;
-    DataPage<T> *firstDataPage;
-    size_t vectorCount = 0;
+struct DataPage {
+    static constexpr size_t kBodySize = PG_PAGE_SIZE - sizeof(DataPageHeader);
+    // bound on calcVectorCount for any dimension and layout, sizes per page scratch buffers
+    static constexpr size_t kMaxVectorCount = kBodySize / (sizeof(T) + sizeof(u_int32_t));
+
+    DataPageHeader header;
+    alignas(kCacheLineSize) unsigned char body[kBodySize];
+
+    static size_t calcVectorCount(size_t dimension, PageLayout layout = PageLayout::kRowMajor) {
+        const size_t vectorSize = dimension * sizeof(T);
+        // a slot takes its vector, its id and one bit, alignment padding is dropped slot by slot below
+        const size_t step = layout == PageLayout::kBlocked ? kBlockedLanes : 1;
+        size_t vectorCount = kBodySize * 8 / (8 * (vectorSize + sizeof(u_int32_t)) + 1) / step * step;
+        while (vectorCount != 0 && calcBodySize(vectorCount, dimension) > kBodySize) {
+            vectorCount -= step;
+        }
+        return vectorCount;
+    }
+
+    void init(PageLayout layout) {
+        header.vectorCount = 0;
+        header.nextPage = kInvalidBlockNumber;
+        header.layout = layout;
+        header.deadCount = 0;
+    }
+
+    [[nodiscard]] inline bool hasNextPage() const {
+        return header.nextPage != kInvalidBlockNumber;
+    }
+
+    [[nodiscard]] inline PageLayout getLayout() const {
+        return header.layout;
+    }
+
+    inline T *getVectors() {
+        return reinterpret_cast<T *>(body);
+    }
+
+    inline const T *getVectors() const {
+        return reinterpret_cast<const T *>(body);
+    }
+
+    inline u_int32_t *getIds(size_t dimension) {
+        return reinterpret_cast<u_int32_t *>(body + calcIdsOffset(dimension, header.layout));
+    }
+
+    inline const u_int32_t *getIds(size_t dimension) const {
+        return reinterpret_cast<const u_int32_t *>(body + calcIdsOffset(dimension, header.layout));
+    }
 
-    ~CentroidTuple() {
-        auto curDataPage = firstDataPage;
-        if (curDataPage == nullptr) {
+    inline u_int64_t *getTombstones(size_t dimension) {
+        return reinterpret_cast<u_int64_t *>(body + calcTombstonesOffset(dimension, header.layout));
+    }
+
+    inline const u_int64_t *getTombstones(size_t dimension) const {
+        return reinterpret_cast<const u_int64_t *>(body + calcTombstonesOffset(dimension, header.layout));
+    }
+
+    static inline bool isDead(const u_int64_t *tombstones, size_t slot) {
+        const u_int64_t word = std::atomic_ref<u_int64_t>(const_cast<u_int64_t &>(tombstones[slot / 64]))
+                .load(std::memory_order_relaxed);
+        return (word >> (slot % 64)) & 1;
+    }
+
+    // returns false if the slot was already deleted; the bit is set before deadCount tells readers to look
+    bool markDead(size_t slot, size_t dimension) {
+        u_int64_t *tombstones = getTombstones(dimension);
+        if (isDead(tombstones, slot)) {
+            return false;
+        }
+        std::atomic_ref<u_int64_t>(tombstones[slot / 64]).fetch_or(u_int64_t(1) << (slot % 64),
+                                                                   std::memory_order_relaxed);
+        storeRelease(header.deadCount, header.deadCount + 1);
+        return true;
+    }
+
+    // contiguous vector, only for kRowMajor pages
+    inline const T *getVector(size_t slot, size_t dimension) const {
+        return getVectors() + slot * dimension;
+    }
+
+    void copyVector(size_t slot, size_t dimension, T *out) const {
+        if (header.layout == PageLayout::kRowMajor) {
+            std::copy(getVector(slot, dimension), getVector(slot, dimension) + dimension, out);
             return;
         }
-        DataPage<T> *nextDataPage = nullptr;
-        while (curDataPage->hasNextPage()) {
-            nextDataPage = curDataPage->nextPage;
-            delete curDataPage;
-            curDataPage = nextDataPage;
+        const T *group = getVectors() + slot / kBlockedLanes * kBlockedLanes * dimension;
+        for (size_t d = 0; d < dimension; ++d) {
+            out[d] = group[d * kBlockedLanes + slot % kBlockedLanes];
+        }
+    }
+
+    // caller checks that the page is not full
+    void appendVector(const T *vec, u_int32_t id, size_t dimension) {
+        writeVector(header.vectorCount, vec, id, dimension);
+        storeRelease(header.vectorCount, header.vectorCount + 1);
+    }
+
+    // overwrites a slot below the capacity, vectorCount and tombstones are left to the caller
+    void writeVector(size_t slot, const T *vec, u_int32_t id, size_t dimension) {
+        if (header.layout == PageLayout::kRowMajor) {
+            std::copy(vec, vec + dimension, getVectors() + slot * dimension);
+        } else {
+            T *group = getVectors() + slot / kBlockedLanes * kBlockedLanes * dimension;
+            for (size_t d = 0; d < dimension; ++d) {
+                group[d * kBlockedLanes + slot % kBlockedLanes] = vec[d];
+            }
         }
-        delete curDataPage;
+        getIds(dimension)[slot] = id;
+    }
+
+private:
+    static inline size_t alignUp(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // ids and tombstones of a page with vectorCount slots
+    static inline size_t calcIdsOffsetFor(size_t vectorCount, size_t dimension) {
+        return alignUp(vectorCount * dimension * sizeof(T), alignof(u_int32_t));
+    }
+
+    static inline size_t calcTombstonesOffsetFor(size_t vectorCount, size_t dimension) {
+        return alignUp(calcIdsOffsetFor(vectorCount, dimension) + vectorCount * sizeof(u_int32_t), alignof(u_int64_t));
+    }
+
+    static inline size_t calcBodySize(size_t vectorCount, size_t dimension) {
+        return calcTombstonesOffsetFor(vectorCount, dimension) + (vectorCount + 63) / 64 * sizeof(u_int64_t);
+    }
+
+    static inline size_t calcIdsOffset(size_t dimension, PageLayout layout) {
+        return calcIdsOffsetFor(calcVectorCount(dimension, layout), dimension);
     }
+
+    static inline size_t calcTombstonesOffset(size_t dimension, PageLayout layout) {
+        return calcTombstonesOffsetFor(calcVectorCount(dimension, layout), dimension);
+    }
+};
+
+template<typename T>
+struct CentroidTuple {
+    std::vector<T> vec;
+    BlockNumber firstDataPage = kInvalidBlockNumber;
+    // tail of the chain, appends neither walk it nor rewrite it; not stored in index files
+    BlockNumber lastDataPage = kInvalidBlockNumber;
+    // live vectors only, tombstoned slots are counted by PaseIVFFlat
+    size_t vectorCount = 0;
 };
 
 template<typename T>
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "page.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <vector>
+
+
+// Hands out PG_PAGE_SIZE pages from 2 MB chunks, pages are addressed by BlockNumber.
+// Pages never move, so a BlockNumber stays valid for the life of the arena, and releasing
+// the arena frees whole chunks. Released pages keep their numbers and are handed out again
+// first. An arena can also be attached to an external read-only region (a mapped page file)
+// which it then addresses the same way without owning it.
+class PageArena {
+public:
+    static constexpr size_t kPagesPerChunk = 256;
+    static constexpr size_t kChunkSize = kPagesPerChunk * PG_PAGE_SIZE;
+    static constexpr size_t kMaxChunkCount = 1 << 16;  // 128 GB of pages
+
+    explicit PageArena(bool useHugePages = false)
+            : chunks(new char *[kMaxChunkCount]()), useHugePages(useHugePages) {}
+
+    PageArena(const PageArena &) = delete;
+
+    PageArena &operator=(const PageArena &) = delete;
+
+    ~PageArena() {
+        if (!ownsChunks) {
+            return;
+        }
+        for (size_t i = 0; i < chunkCount; ++i) {
+            std::free(chunks[i]);
+        }
+    }
+
+    // returns a zeroed page, safe to call from several threads
+    BlockNumber allocatePage() {
+        size_t blockNumber;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ownsChunks) {
+                throw std::logic_error("Page arena is read-only.");
+            }
+            if (!freePages.empty()) {
+                blockNumber = freePages.back();
+                freePages.pop_back();
+            } else {
+                blockNumber = pageCount.load(std::memory_order_relaxed);
+                if (blockNumber == chunkCount * kPagesPerChunk) {
+                    allocateChunk();
+                }
+                pageCount.store(blockNumber + 1, std::memory_order_release);
+            }
+        }
+        char *page = getPage(blockNumber);
+        std::memset(page, 0, PG_PAGE_SIZE);
+        return static_cast<BlockNumber>(blockNumber);
+    }
+
+    // the caller unlinks the page first, its content is left as is until it is handed out again
+    void releasePage(BlockNumber blockNumber) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ownsChunks) {
+            throw std::logic_error("Page arena is read-only.");
+        }
+        if (blockNumber >= pageCount.load(std::memory_order_relaxed)) {
+            throw std::invalid_argument("Released page does not belong to the arena.");
+        }
+        freePages.push_back(blockNumber);
+    }
+
+    // addresses pageCount pages starting at base, must be called on an empty arena
+    void attach(const char *base, size_t attachedPageCount) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pageCount.load(std::memory_order_relaxed) != 0) {
+            throw std::logic_error("Only an empty page arena can be attached.");
+        }
+        size_t attachedChunkCount = (attachedPageCount + kPagesPerChunk - 1) / kPagesPerChunk;
+        if (attachedChunkCount > kMaxChunkCount) {
+            throw std::runtime_error("Too many pages for a page arena.");
+        }
+        for (size_t i = 0; i < attachedChunkCount; ++i) {
+            chunks[i] = const_cast<char *>(base) + i * kChunkSize;
+        }
+        chunkCount = attachedChunkCount;
+        ownsChunks = false;
+        pageCount.store(attachedPageCount, std::memory_order_release);
+    }
+
+    [[nodiscard]] inline char *getPage(size_t blockNumber) {
+        return chunks[blockNumber / kPagesPerChunk] + (blockNumber % kPagesPerChunk) * PG_PAGE_SIZE;
+    }
+
+    [[nodiscard]] inline const char *getPage(size_t blockNumber) const {
+        return chunks[blockNumber / kPagesPerChunk] + (blockNumber % kPagesPerChunk) * PG_PAGE_SIZE;
+    }
+
+    [[nodiscard]] inline size_t getPageCount() const {
+        return pageCount.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] size_t getFreePageCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return freePages.size();
+    }
+
+    [[nodiscard]] inline bool isReadOnly() const {
+        return !ownsChunks;
+    }
+
+private:
+    std::unique_ptr<char *[]> chunks;
+    size_t chunkCount = 0;
+    std::atomic<size_t> pageCount{0};
+    std::vector<BlockNumber> freePages;
+    mutable std::mutex mutex;
+    bool useHugePages;
+    bool ownsChunks = true;
+
+    void allocateChunk() {
+        if (chunkCount == kMaxChunkCount) {
+            throw std::runtime_error("Page arena is full.");
+        }
+        // chunk sized and aligned to a huge page so that transparent huge pages can back it
+        void *chunk = std::aligned_alloc(kChunkSize, kChunkSize);
+        if (chunk == nullptr) {
+            throw std::bad_alloc();
+        }
+        if (useHugePages) {
+            ::madvise(chunk, kChunkSize, MADV_HUGEPAGE);
+        }
+        chunks[chunkCount++] = static_cast<char *>(chunk);
+    }
+};
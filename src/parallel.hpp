@@ -0,0 +1,33 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+
+// chunk size giving a few chunks per hardware thread, but not less than minChunkSize
+inline size_t calcChunkSize(const size_t count, const size_t minChunkSize) {
+    const size_t chunkCount = 4 * std::max<size_t>(1, std::thread::hardware_concurrency());
+    return std::max(minChunkSize, (count + chunkCount - 1) / chunkCount);
+}
+
+// runs f(begin, end) on the thread pool for consecutive chunks of [0, count) and waits for all of them,
+// must not be called from a pool task
+template<typename F>
+void parallelFor(const size_t count, const size_t chunkSize, F f) {
+    auto &threadPool = getThreadPool();
+    std::vector<boost::unique_future<void>> pendingTasks;
+    for (size_t begin = 0; begin < count; begin += chunkSize) {
+        size_t end = std::min(count, begin + chunkSize);
+        Task task([&f, begin, end]() {
+            f(begin, end);
+        });
+        boost::unique_future<void> fut = task.get_future();
+        pendingTasks.push_back(std::move(fut));
+        threadPool.Submit(std::move(task));
+    }
+    boost::wait_for_all(pendingTasks.begin(), pendingTasks.end());
+}
@@ -4,6 +4,8 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
+#include <cstdint>
+#include <stdexcept>
 
 
 template<typename T>
@@ -35,3 +37,54 @@ public:
         return result;
     }
 };
+
+// Streams an fvecs (T = float) or bvecs (T = u_int8_t) file a few vectors at a time, every record is a 4 byte
+// dimension followed by the values. Only the vectors of one read are in memory.
+template<typename T>
+class VecsReader {
+    std::string pathToFile;
+    size_t dimension;
+    size_t vectorCount;
+    std::ifstream data;
+    std::vector<char> buf;
+
+public:
+    VecsReader(std::string pathToFile, size_t dimension)
+            : pathToFile(std::move(pathToFile)), dimension(dimension), buf(sizeof(int32_t) + sizeof(T) * dimension) {
+        data.open(this->pathToFile, std::ios::binary | std::ios::ate);
+        if (!data.is_open()) {
+            throw std::runtime_error("Failed to open file '" + this->pathToFile + "'.");
+        }
+        const auto fileSize = static_cast<size_t>(data.tellg());
+        if (fileSize % buf.size() != 0) {
+            throw std::runtime_error("File '" + this->pathToFile + "' does not hold vectors of the dimension.");
+        }
+        vectorCount = fileSize / buf.size();
+        data.seekg(0);
+    }
+
+    [[nodiscard]] size_t getVectorCount() const {
+        return vectorCount;
+    }
+
+    // the next read starts at the vector with the index
+    void seek(size_t index) {
+        data.clear();
+        data.seekg(static_cast<std::streamoff>(index * buf.size()));
+    }
+
+    // replaces out with up to count vectors from the current position, returns how many there were
+    size_t read(size_t count, std::vector<std::vector<T>> &out) {
+        out.clear();
+        while (out.size() < count && data.read(buf.data(), static_cast<std::streamsize>(buf.size()))) {
+            int32_t recordDimension;
+            std::memcpy(&recordDimension, buf.data(), sizeof(recordDimension));
+            if (recordDimension != static_cast<int32_t>(dimension)) {
+                throw std::runtime_error("Vector dimension in '" + pathToFile + "' does not match.");
+            }
+            std::vector<T> &vec = out.emplace_back(dimension);
+            std::memcpy(vec.data(), buf.data() + sizeof(int32_t), sizeof(T) * dimension);
+        }
+        return out.size();
+    }
+};
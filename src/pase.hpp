@@ -2,9 +2,19 @@
 
 #include "calc_distance.hpp"
 #include "clustering.hpp"
+#include "epoch.hpp"
+#include "id_filter.hpp"
+#include "index_file.hpp"
+#include "mapped_file.hpp"
+#include "nearest_centroid.hpp"
+#include "metric.hpp"
 #include "page.hpp"
+#include "page_arena.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "search_result.hpp"
 #include "thread_pool.hpp"
+#include "top_k.hpp"
 #include "utils.hpp"
 
 #include <functional>
@@ -13,25 +23,77 @@
 #include <stdexcept>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <thread>
 #include <unordered_map>
 
 
-template<typename T>
+enum class BatchSearchMode {
+    kQueryMajor = 0,
+    kClusterMajor = 1
+};
+
+// When PaseIVFFlat::searchAdaptive stops visiting clusters. Clusters are visited in order of centroid distance
+// until neighbourCount vectors are collected, the limits below only apply after that. The search then stops
+// once at least minClusterCount clusters are visited and any of the limits holds.
+struct ProbePolicy {
+    size_t minClusterCount = 1;
+    size_t maxClusterCount = std::numeric_limits<size_t>::max();
+    // live vectors of the visited clusters
+    size_t maxVectorCount = std::numeric_limits<size_t>::max();
+    // stops once the k-th distance is at most stopRatio times the distance to the next centroid, both as squared
+    // L2 distances, so larger values stop earlier; 0 disables the rule, kInnerProduct indexes ignore it
+    float stopRatio = 0.0f;
+};
+
+// Metric is fixed at compile time and used for training, assignment and search. kCosine indexes store unit
+// length vectors, findNearestVectors returns them normalized.
+// Searches run concurrently with insert, remove and vacuum. Writers take writeMutex and publish page links,
+// vector counts and tombstones with release stores, readers never lock. vacuum copies surviving vectors to new
+// pages and retires the old ones, which are reused only after every search that could still walk them ended.
+template<typename T, MetricType Metric = MetricType::kL2>
 struct PaseIVFFlat {
+    static_assert(Metric != MetricType::kCosine || std::is_floating_point<T>::value,
+                  "Cosine similarity needs floating point vectors.");
+
     const size_t dimension;
     const size_t clusterCount;
+    // layout of newly allocated data pages
+    const PageLayout pageLayout;
 
     CentroidPage<T> *firstCentroidPage = nullptr;
     CentroidPage<T> *lastCentroidPage = nullptr;
     typename std::vector<CentroidTuple<T>>::iterator lastCentroidElemIt;
+    // squared L2 norms of centroids by cluster id, used by the batched query-to-centroid product
+    std::vector<float> centroidNorms;
+    // centroid vectors by cluster id stored row after row, scanned with one call per centroid page
+    std::vector<T> centroidVectors;
+    // float indexes only: the centroids again in column-blocked groups of kBlockedLanes, component i of centroid
+    // g * kBlockedLanes + j at centroidBlocks[(g * dimension + i) * kBlockedLanes + j], the last group zero padded
+    std::vector<float> centroidBlocks;
+    // data pages of all clusters, chains are linked by page numbers
+    PageArena pageArena;
+    // set for indexes opened with map, pageArena then addresses the mapped data pages
+    std::unique_ptr<MappedFile> mappedFile;
 
-    explicit PaseIVFFlat(size_t dimension, size_t clusterCount) : dimension(dimension), clusterCount(clusterCount) {
-        if (dimension > Page<T>::calcTuplesSize()) {
+    explicit PaseIVFFlat(size_t dimension, size_t clusterCount, PageLayout pageLayout = PageLayout::kRowMajor,
+                         bool useHugePages = false)
+            : dimension(dimension), clusterCount(clusterCount), pageLayout(pageLayout), pageArena(useHugePages),
+              deadCounts(clusterCount, 0) {
+        if (DataPage<T>::calcVectorCount(dimension, pageLayout) == 0) {
             throw std::logic_error("Vector size is too big. Even one vector can not be stored on 8 KB page.");
         }
     }
 
+    PaseIVFFlat(const PaseIVFFlat &) = delete;
+
+    PaseIVFFlat &operator=(const PaseIVFFlat &) = delete;
+
     ~PaseIVFFlat() {
         auto curCentroidPage = firstCentroidPage;
         if (curCentroidPage == nullptr) {
@@ -49,10 +111,78 @@ struct PaseIVFFlat {
     void buildIndex(const std::vector<std::vector<T>> &learnVectors,
                     const std::vector<std::vector<T>> &baseVectors,
                     const std::vector<u_int32_t> &ids,
-                    const size_t maxEpochs, const float tol) {
-        auto centroids = train(learnVectors, maxEpochs, tol);
-        addCentroids(centroids);
-        add(baseVectors, ids);
+                    const size_t maxEpochs, const float tol,
+                    const kMeansSamplingMode samplingMode = kMeansSamplingMode::kNormal,
+                    const u_int64_t seed = kDefaultKMeansSeed) {
+        checkWritable();
+        std::lock_guard<std::mutex> lock(writeMutex);
+        checkClusterCapacity(baseVectors.size());
+        const size_t learnClusterSize = calcLearnClusterSize(learnVectors.size(), baseVectors.size());
+        if constexpr (Metric == MetricType::kCosine) {
+            const auto normalizedLearnVectors = normalizeVectors(learnVectors);
+            const auto normalizedBaseVectors = normalizeVectors(baseVectors);
+            auto centroids = train(normalizedLearnVectors, maxEpochs, tol, samplingMode, seed, learnClusterSize);
+            addCentroids(centroids);
+            add(normalizedBaseVectors, ids);
+        } else {
+            auto centroids = train(learnVectors, maxEpochs, tol, samplingMode, seed, learnClusterSize);
+            addCentroids(centroids);
+            add(baseVectors, ids);
+        }
+    }
+
+    // Caps the live vectors per cluster, 0 for no cap. buildIndex then trains balanced k-means whose assignment
+    // moves the points of a full cluster to the nearest one with room, and distributes the base vectors the same
+    // way, so no probed list is much longer than the others. insert takes the nearest cluster below the cap while
+    // there is one. Vectors are then no longer all in the cluster of their nearest centroid, so rangeSearch scans
+    // every cluster. The cap is saved with the index and can only be set before it is built, the clusters of a built
+    // index are not rebalanced.
+    void setMaxClusterSize(const size_t size) {
+        checkWritable();
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (firstCentroidPage != nullptr) {
+            throw std::logic_error("Cluster size cap can only be set before the index is built.");
+        }
+        storeRelease(maxClusterSize, size);
+    }
+
+    [[nodiscard]] size_t getMaxClusterSize() const {
+        return loadAcquire(maxClusterSize);
+    }
+
+    // live vectors by cluster id, to check how balanced the lists are
+    [[nodiscard]] std::vector<size_t> getClusterSizes() const {
+        std::vector<size_t> sizes;
+        sizes.reserve(clusterCount);
+        for (CentroidPage<T> *pg = firstCentroidPage; pg != nullptr && sizes.size() < clusterCount; pg = pg->nextPage) {
+            for (size_t i = 0; i < pg->tuples.size() && sizes.size() < clusterCount; ++i) {
+                sizes.push_back(loadAcquire(pg->tuples[i].vectorCount));
+            }
+        }
+        return sizes;
+    }
+
+    // builds from centroids trained beforehand, e.g. by miniBatchKMeans on a learn set streamed from a file
+    void buildIndex(const IVFFlatClusterData<T> &trained,
+                    const std::vector<std::vector<T>> &baseVectors,
+                    const std::vector<u_int32_t> &ids) {
+        checkWritable();
+        if (trained.centroids.size() != clusterCount) {
+            throw std::invalid_argument("Trained centroid count does not match the cluster count.");
+        }
+        for (const auto &centroid: trained.centroids) {
+            if (centroid.size() != dimension) {
+                throw std::invalid_argument("Trained centroid dimension does not match the index.");
+            }
+        }
+        std::lock_guard<std::mutex> lock(writeMutex);
+        checkClusterCapacity(baseVectors.size());
+        addCentroids(trained);
+        if constexpr (Metric == MetricType::kCosine) {
+            add(normalizeVectors(baseVectors), ids);
+        } else {
+            add(baseVectors, ids);
+        }
     }
 
     std::vector<std::vector<T>>
@@ -81,6 +211,417 @@ struct PaseIVFFlat {
         return result;
     }
 
+    // ids of the nearest vectors passing filter, see searchFiltered
+    template<typename Filter>
+    std::vector<u_int32_t>
+    findNearestVectorIds(const std::vector<T> &vec, const size_t neighbourCount, const size_t clusterCountToSelect,
+                         const Filter &filter) const {
+        std::vector<u_int32_t> ids(neighbourCount);
+        std::vector<float> distances(neighbourCount);
+        ids.resize(searchFiltered(vec.data(), vec.size(), neighbourCount, clusterCountToSelect, filter, ids.data(),
+                                  distances.data()));
+        return ids;
+    }
+
+    // Allocation-free lookup for executors calling the index directly. Writes up to neighbourCount ids and
+    // distances into caller-owned buffers and returns how many were found. If vectors is not null it receives
+    // pointers into index pages instead of copies, which needs kRowMajor pages. They stay valid only until the
+    // next insert, remove or vacuum, any of which may reinitialise and reuse pages vacuum retired.
+    // Runs on the calling thread, scratch space is thread local and only grows.
+    size_t searchInto(const T *query, const size_t queryDimension, const size_t neighbourCount,
+                      const size_t clusterCountToSelect, u_int32_t *ids, float *distances,
+                      const T **vectors = nullptr) const {
+        if (queryDimension != dimension) {
+            throw std::invalid_argument("Query dimension does not match index dimension.");
+        }
+        if (vectors != nullptr && pageLayout != PageLayout::kRowMajor) {
+            throw std::logic_error("Vectors of blocked pages can not be returned in place.");
+        }
+        const size_t probeCount = std::min(clusterCountToSelect, clusterCount);
+        if (neighbourCount == 0 || probeCount == 0) {
+            return 0;
+        }
+        EpochGuard guard(epochs);
+        thread_local std::vector<T> normalizedQuery;
+        query = prepareQuery(query, normalizedQuery);
+
+        thread_local std::vector<float> probeDistances;
+        thread_local std::vector<const CentroidTuple<T> *> probeClusters;
+        if (probeDistances.size() < probeCount) {
+            probeDistances.resize(probeCount);
+            probeClusters.resize(probeCount);
+        }
+        thread_local std::vector<float> centroidDistances;
+        centroidDistances.resize(clusterCount);
+        TopK<const CentroidTuple<T> *> topClusters(probeDistances.data(), probeClusters.data(), probeCount);
+        size_t clustersLeft = clusterCount;
+        for (CentroidPage<T> *pg = firstCentroidPage; pg != nullptr; pg = pg->nextPage) {
+            size_t centroidCountOnPage = std::min(pg->tuples.size(), clustersLeft);
+            calcCentroidPageDistances(query, clusterCount - clustersLeft, centroidCountOnPage,
+                                      centroidDistances.data());
+            for (size_t i = 0; i < centroidCountOnPage; ++i) {
+                topClusters.push(centroidDistances[i], &pg->tuples[i]);
+            }
+            clustersLeft -= centroidCountOnPage;
+        }
+        topClusters.finalize();
+
+        if (vectors == nullptr) {
+            TopK<u_int32_t> topK(distances, ids, neighbourCount);
+            for (size_t i = 0; i < topClusters.size(); ++i) {
+                scanCluster(query, probeClusters[i], topK);
+            }
+            topK.finalize();
+            return topK.size();
+        }
+
+        thread_local std::vector<VecRef> topVectors;
+        if (topVectors.size() < neighbourCount) {
+            topVectors.resize(neighbourCount);
+        }
+        TopK<VecRef> topK(distances, topVectors.data(), neighbourCount);
+        for (size_t i = 0; i < topClusters.size(); ++i) {
+            scanCluster(query, probeClusters[i], topK);
+        }
+        topK.finalize();
+        for (size_t i = 0; i < topK.size(); ++i) {
+            ids[i] = topVectors[i].id;
+            vectors[i] = topVectors[i].page->getVector(topVectors[i].slot, dimension);
+        }
+        return topK.size();
+    }
+
+    // searchInto over the vectors whose id passes filter, a callable bool(u_int32_t id) such as IdBitmap. The
+    // filter is evaluated in the page scan before distances are computed, so rejected vectors cost an id check.
+    // Scans the clusterCountToSelect closest clusters first and keeps adding the next closest one until
+    // neighbourCount vectors passed the filter or every cluster is scanned, so selective filters still get
+    // neighbourCount results. Returns how many were found.
+    template<typename Filter>
+    size_t searchFiltered(const T *query, const size_t queryDimension, const size_t neighbourCount,
+                          const size_t clusterCountToSelect, const Filter &filter, u_int32_t *ids,
+                          float *distances) const {
+        if (queryDimension != dimension) {
+            throw std::invalid_argument("Query dimension does not match index dimension.");
+        }
+        if (neighbourCount == 0 || firstCentroidPage == nullptr) {
+            return 0;
+        }
+        EpochGuard guard(epochs);
+        thread_local std::vector<T> normalizedQuery;
+        query = prepareQuery(query, normalizedQuery);
+
+        ProbePolicy policy;
+        policy.minClusterCount = clusterCountToSelect;
+        policy.maxClusterCount = clusterCountToSelect;
+        TopK<u_int32_t> topK(distances, ids, neighbourCount);
+        probeClusters(query, policy, topK, [&](const CentroidTuple<T> *cluster) {
+            scanClusterFiltered(query, cluster, filter, topK);
+        });
+        topK.finalize();
+        return topK.size();
+    }
+
+    // searchInto with a number of probed clusters that follows the query: clusters are visited in order of
+    // centroid distance until neighbourCount vectors are found and policy stops the search. Writes the number
+    // of visited clusters to probedClusterCount if it is not null. Returns how many vectors were found.
+    size_t searchAdaptive(const T *query, const size_t queryDimension, const size_t neighbourCount,
+                          const ProbePolicy &policy, u_int32_t *ids, float *distances,
+                          size_t *probedClusterCount = nullptr) const {
+        if (queryDimension != dimension) {
+            throw std::invalid_argument("Query dimension does not match index dimension.");
+        }
+        if (neighbourCount == 0 || firstCentroidPage == nullptr) {
+            return 0;
+        }
+        EpochGuard guard(epochs);
+        thread_local std::vector<T> normalizedQuery;
+        query = prepareQuery(query, normalizedQuery);
+
+        TopK<u_int32_t> topK(distances, ids, neighbourCount);
+        size_t visitedCount = probeClusters(query, policy, topK, [&](const CentroidTuple<T> *cluster) {
+            scanCluster(query, cluster, topK);
+        });
+        if (probedClusterCount != nullptr) {
+            *probedClusterCount = visitedCount;
+        }
+        topK.finalize();
+        return topK.size();
+    }
+
+    // Calls consume(id, distance) for every vector within radius of the query, distance <= radius with the
+    // distances of searchInto, and returns their number. Hits are passed on as the pages are scanned, in no
+    // particular order and without a bound on their number. kL2 indexes skip clusters whose Voronoi cell lies
+    // farther than radius from the query unless a cluster size cap placed vectors outside the cell of their
+    // nearest centroid, other metrics scan every cluster.
+    template<typename Consumer>
+    size_t rangeSearch(const T *query, const size_t queryDimension, const float radius, Consumer consume) const {
+        if (queryDimension != dimension) {
+            throw std::invalid_argument("Query dimension does not match index dimension.");
+        }
+        if (firstCentroidPage == nullptr) {
+            return 0;
+        }
+        EpochGuard guard(epochs);
+        thread_local std::vector<T> normalizedQuery;
+        query = prepareQuery(query, normalizedQuery);
+
+        thread_local std::vector<float> centroidDistances;
+        centroidDistances.resize(clusterCount);
+        calcCentroidPageDistances(query, 0, clusterCount, centroidDistances.data());
+        const auto nearestClusterId = static_cast<u_int32_t>(
+                std::min_element(centroidDistances.begin(), centroidDistances.end()) - centroidDistances.begin());
+        const bool canPrune = loadAcquire(maxClusterSize) == 0 && !loadAcquire(balancedAssignment);
+
+        size_t hitCount = 0;
+        u_int32_t clusterId = 0;
+        for (CentroidPage<T> *pg = firstCentroidPage; clusterId < clusterCount; pg = pg->nextPage) {
+            for (size_t i = 0; i < pg->tuples.size() && clusterId < clusterCount; ++i, ++clusterId) {
+                if (!canPrune || mayContainHits(clusterId, nearestClusterId, centroidDistances.data(), radius)) {
+                    hitCount += scanClusterInRange(query, &pg->tuples[i], radius, consume);
+                }
+            }
+        }
+        return hitCount;
+    }
+
+    RangeSearchResult rangeSearch(const std::vector<T> &query, const float radius) const {
+        RangeSearchResult result;
+        rangeSearch(query.data(), query.size(), radius, [&result](u_int32_t id, float distance) {
+            result.ids.push_back(id);
+            result.distances.push_back(distance);
+        });
+        result.offsets.push_back(result.ids.size());
+        return result;
+    }
+
+    // rangeSearch for queryCount queries stored contiguously (queryCount x dimension), queries are spread
+    // over the thread pool
+    RangeSearchResult rangeSearchBatch(const T *queries, const size_t queryCount, const float radius) const {
+        std::vector<std::vector<u_int32_t>> hitIds(queryCount);
+        std::vector<std::vector<float>> hitDistances(queryCount);
+        parallelFor(queryCount, calcChunkSize(queryCount, 1), [&](size_t begin, size_t end) {
+            for (size_t q = begin; q < end; ++q) {
+                rangeSearch(queries + q * dimension, dimension, radius, [&](u_int32_t id, float distance) {
+                    hitIds[q].push_back(id);
+                    hitDistances[q].push_back(distance);
+                });
+            }
+        });
+
+        RangeSearchResult result;
+        result.offsets.resize(queryCount + 1);
+        for (size_t q = 0; q < queryCount; ++q) {
+            result.offsets[q + 1] = result.offsets[q] + hitIds[q].size();
+        }
+        result.ids.reserve(result.offsets.back());
+        result.distances.reserve(result.offsets.back());
+        for (size_t q = 0; q < queryCount; ++q) {
+            result.ids.insert(result.ids.end(), hitIds[q].begin(), hitIds[q].end());
+            result.distances.insert(result.distances.end(), hitDistances[q].begin(), hitDistances[q].end());
+        }
+        return result;
+    }
+
+    // Searches queryCount queries stored contiguously (queryCount x dimension) at once.
+    // Query-to-centroid distances are computed block-wise from q.c (kL2 as ||q||^2 - 2 * q.c + ||c||^2) and work is
+    // scheduled once per batch. kQueryMajor scans probed clusters query by query, kClusterMajor reads
+    // every probed cluster once and scores it against all queries that selected it.
+    BatchSearchResult
+    searchBatch(const T *queries, const size_t queryCount, const size_t neighbourCount,
+                const size_t clusterCountToSelect,
+                const BatchSearchMode mode = BatchSearchMode::kQueryMajor) const {
+        if (queryCount == 0 || neighbourCount == 0 || firstCentroidPage == nullptr) {
+            return BatchSearchResult(queryCount, neighbourCount);
+        }
+        const size_t probeCount = std::min(clusterCountToSelect, clusterCount);
+        const auto clusterIdToPointer = findClusterIdToPointer();
+        // pool tasks scan under the pin of the calling thread
+        EpochGuard guard(epochs);
+        std::vector<T> normalizedQueries;
+        if constexpr (Metric == MetricType::kCosine) {
+            normalizedQueries.assign(queries, queries + queryCount * dimension);
+            for (size_t i = 0; i < queryCount; ++i) {
+                normalizeVector(normalizedQueries.data() + i * dimension, dimension);
+            }
+            queries = normalizedQueries.data();
+        }
+
+        if (mode == BatchSearchMode::kClusterMajor) {
+            return searchBatchClusterMajor(queries, queryCount, neighbourCount, probeCount, clusterIdToPointer);
+        }
+
+        BatchSearchResult result(queryCount, neighbourCount);
+        parallelFor(queryCount, calcChunkSize(queryCount, kQueryBlockSize), [&](size_t begin, size_t end) {
+            std::vector<float> centrDists(kQueryBlockSize * clusterCount);
+            std::vector<u_int32_t> clusterIds(clusterCount);
+
+            for (size_t blockBegin = begin; blockBegin < end; blockBegin += kQueryBlockSize) {
+                size_t blockSize = std::min(end - blockBegin, kQueryBlockSize);
+                calcCentroidDistances(queries + blockBegin * dimension, blockSize, centrDists.data());
+
+                for (size_t i = 0; i < blockSize; ++i) {
+                    const T *query = queries + (blockBegin + i) * dimension;
+                    selectClusters(centrDists.data() + i * clusterCount, probeCount, clusterIds);
+
+                    TopK<u_int32_t> topK(result.getDistances(blockBegin + i), result.getIds(blockBegin + i),
+                                         neighbourCount);
+                    for (size_t j = 0; j < probeCount; ++j) {
+                        scanCluster(query, clusterIdToPointer[clusterIds[j]], topK);
+                    }
+                    topK.finalize();
+                }
+            }
+        });
+        return result;
+    }
+
+    // Writes centroid and data pages into a versioned page file, see index_file.hpp for the layout.
+    void save(const std::string &path) const {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable vectors can be saved.");
+        checkWritable();
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (firstCentroidPage == nullptr) {
+            throw std::logic_error("Index is not built.");
+        }
+        const size_t recordsPerPage = calcCentroidRecordsPerPage<T>(dimension);
+        if (recordsPerPage == 0) {
+            throw std::logic_error("Vector size is too big. Centroid record can not be stored on 8 KB page.");
+        }
+        const size_t centroidPageCount = (clusterCount + recordsPerPage - 1) / recordsPerPage;
+        const auto clusterIdToPointer = findClusterIdToPointer();
+        const size_t dataPageCount = pageArena.getPageCount();
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Failed to open file '" + path + "'.");
+        }
+        std::vector<char> block(PG_PAGE_SIZE, 0);
+
+        IndexFileHeader header{};
+        std::memcpy(header.magic, kIndexFileMagic, sizeof(kIndexFileMagic));
+        header.version = kIndexFileVersion;
+        header.pageSize = PG_PAGE_SIZE;
+        header.dimension = dimension;
+        header.clusterCount = clusterCount;
+        header.elementType = static_cast<u_int32_t>(elementTypeOf<T>());
+        header.elementSize = sizeof(T);
+        header.metric = static_cast<u_int32_t>(Metric);
+        header.pageLayout = static_cast<u_int32_t>(pageLayout);
+        header.centroidPageCount = centroidPageCount;
+        header.dataPageCount = dataPageCount;
+        header.maxClusterSize = maxClusterSize;
+        header.flags = balancedAssignment ? kIndexFileFlagBalancedAssignment : 0;
+        std::memcpy(block.data(), &header, sizeof(header));
+        writeBlock(out, block.data());
+
+        const size_t recordSize = calcCentroidRecordSize<T>(dimension);
+        for (size_t c = 0; c < clusterCount; c += recordsPerPage) {
+            std::fill(block.begin(), block.end(), 0);
+            for (size_t r = 0; r < recordsPerPage && c + r < clusterCount; ++r) {
+                const CentroidTuple<T> *centroid = clusterIdToPointer[c + r];
+                CentroidRecordHeader record{centroid->vectorCount, centroid->firstDataPage, 0};
+                char *recordPtr = block.data() + r * recordSize;
+                std::memcpy(recordPtr, &record, sizeof(record));
+                std::memcpy(recordPtr + sizeof(record), centroid->vec.data(), dimension * sizeof(T));
+            }
+            writeBlock(out, block.data());
+        }
+
+        // data pages are stored as they are laid out in the arena
+        for (size_t i = 0; i < dataPageCount; ++i) {
+            writeBlock(out, pageArena.getPage(i));
+        }
+    }
+
+    // Restores an index written by save with one sequential pass over the page file.
+    static std::unique_ptr<PaseIVFFlat> load(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("Failed to open file '" + path + "'.");
+        }
+        const IndexFileHeader header = readIndexFileHeader(in, path);
+        checkIndexFileHeader(header, path);
+
+        auto index = std::make_unique<PaseIVFFlat>(header.dimension, header.clusterCount,
+                                                      static_cast<PageLayout>(header.pageLayout));
+        const size_t dimension = index->dimension;
+        const size_t clusterCount = index->clusterCount;
+        const size_t recordsPerPage = calcCentroidRecordsPerPage<T>(dimension);
+        const size_t recordSize = calcCentroidRecordSize<T>(dimension);
+
+        std::vector<char> block(PG_PAGE_SIZE);
+        std::vector<CentroidRecordHeader> records(clusterCount);
+        std::vector<T> centroid(dimension);
+        for (size_t c = 0; c < clusterCount; c += recordsPerPage) {
+            readBlock(in, block.data());
+            for (size_t r = 0; r < recordsPerPage && c + r < clusterCount; ++r) {
+                const char *recordPtr = block.data() + r * recordSize;
+                std::memcpy(&records[c + r], recordPtr, sizeof(CentroidRecordHeader));
+                std::memcpy(centroid.data(), recordPtr + sizeof(CentroidRecordHeader), dimension * sizeof(T));
+                index->addCentroid(centroid);
+            }
+        }
+
+        for (size_t i = 0; i < header.dataPageCount; ++i) {
+            BlockNumber pageNumber = index->pageArena.allocatePage();
+            readBlock(in, index->pageArena.getPage(pageNumber));
+        }
+        index->checkPageLinks(records, path);
+
+        const auto clusterIdToPointer = index->findClusterIdToPointer();
+        for (size_t c = 0; c < clusterCount; ++c) {
+            clusterIdToPointer[c]->vectorCount = records[c].vectorCount;
+            clusterIdToPointer[c]->firstDataPage = records[c].firstDataPage;
+            clusterIdToPointer[c]->lastDataPage = index->findLastDataPage(clusterIdToPointer[c]);
+        }
+        index->restoreDeadCounts(clusterIdToPointer);
+        index->restoreBalancing(header);
+        return index;
+    }
+
+    // Opens a page file written by save read-only and searches its data pages in place. Only centroids
+    // are copied and the pages are shared through the page cache. Page headers and chains are checked
+    // like load does, which reads the header of every data page once. Modifying a mapped index throws.
+    static std::unique_ptr<PaseIVFFlat> map(const std::string &path) {
+        auto file = std::make_unique<MappedFile>(path);
+        const IndexFileHeader header = parseIndexFileHeader(file->getBlock(0), path);
+        checkIndexFileHeader(header, path);
+        if (file->getBlockCount() < 1 + header.centroidPageCount + header.dataPageCount) {
+            throw std::runtime_error("Index file is truncated.");
+        }
+
+        auto index = std::make_unique<PaseIVFFlat>(header.dimension, header.clusterCount,
+                                                      static_cast<PageLayout>(header.pageLayout));
+        const size_t dimension = index->dimension;
+        const size_t clusterCount = index->clusterCount;
+        const size_t recordsPerPage = calcCentroidRecordsPerPage<T>(dimension);
+        const size_t recordSize = calcCentroidRecordSize<T>(dimension);
+
+        std::vector<CentroidRecordHeader> records(clusterCount);
+        std::vector<T> centroid(dimension);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            const char *recordPtr = file->getBlock(1 + c / recordsPerPage) + (c % recordsPerPage) * recordSize;
+            std::memcpy(&records[c], recordPtr, sizeof(CentroidRecordHeader));
+            std::memcpy(centroid.data(), recordPtr + sizeof(CentroidRecordHeader), dimension * sizeof(T));
+            index->addCentroid(centroid);
+        }
+
+        if (header.dataPageCount != 0) {
+            index->pageArena.attach(file->getBlock(1 + header.centroidPageCount), header.dataPageCount);
+        }
+        index->mappedFile = std::move(file);
+        index->checkPageLinks(records, path);
+        const auto clusterIdToPointer = index->findClusterIdToPointer();
+        for (size_t c = 0; c < clusterCount; ++c) {
+            clusterIdToPointer[c]->vectorCount = records[c].vectorCount;
+            clusterIdToPointer[c]->firstDataPage = records[c].firstDataPage;
+            // rejects chains with a cycle
+            clusterIdToPointer[c]->lastDataPage = index->findLastDataPage(clusterIdToPointer[c]);
+        }
+        index->restoreBalancing(header);
+        return index;
+    }
+
 // TODO: make methods private and remove tests
     void addCentroid(const std::vector<T> &centroidVector) {
         if (!firstCentroidPage) {
@@ -97,41 +638,436 @@ struct PaseIVFFlat {
         }
         lastCentroidElemIt->vec = centroidVector;
         lastCentroidElemIt += 1;
+        centroidNorms.push_back(normL2sqr(centroidVector.data(), centroidVector.size()));
+        centroidVectors.insert(centroidVectors.end(), centroidVector.begin(), centroidVector.end());
+        if constexpr (std::is_same<T, float>::value) {
+            const size_t centroidId = centroidNorms.size() - 1;
+            if (centroidId % kBlockedLanes == 0) {
+                centroidBlocks.resize(centroidBlocks.size() + kBlockedLanes * dimension, 0);
+            }
+            float *group = centroidBlocks.data() + centroidId / kBlockedLanes * kBlockedLanes * dimension;
+            for (size_t i = 0; i < dimension; ++i) {
+                group[i * kBlockedLanes + centroidId % kBlockedLanes] = centroidVector[i];
+            }
+        }
     }
 
 
     void addData(const std::vector<std::reference_wrapper<const std::vector<T>>> &data,
                  const std::vector<u_int32_t> &ids, CentroidTuple<T> *centroidInfo) {
-        auto lastDataPage = findLastDataPage(centroidInfo);
-        if (lastDataPage == nullptr) {
-            auto *firstDataPage = new DataPage<T>();
-            centroidInfo->firstDataPage = firstDataPage;
-            lastDataPage = firstDataPage;
+        checkWritable();
+        for (size_t i = 0; i < data.size(); ++i) {
+            appendVector(centroidInfo, data[i].get().data(), ids[i]);
         }
-        centroidInfo->vectorCount = data.size();
+    }
 
-        auto lastDataElemIt = lastDataPage->tuples.begin();
-        auto endTuplesIt = lastDataPage->getEndTuples(dimension);
-        auto nextIdPtr = (u_int32_t *) &(*endTuplesIt);
+    // Adds a vector to a built index: it goes to the cluster of its nearest centroid and is appended to the
+    // tail page of the cluster in O(1). Centroids are not retrained. Concurrent searches see the vector once
+    // its slot is published.
+    void insert(const std::vector<T> &vec, const u_int32_t id) {
+        checkInsertable(vec.size());
+        thread_local std::vector<T> normalizedVector;
+        thread_local std::vector<float> centroidDistances;
+        const T *point = prepareQuery(vec.data(), normalizedVector);
+        const u_int32_t nearestClusterId = findNearestCluster(point, centroidDistances);
+        std::lock_guard<std::mutex> lock(writeMutex);
+        reclaimPages();
+        const u_int32_t clusterId = selectInsertCluster(point, nearestClusterId, centroidDistances);
+        if (clusterId != nearestClusterId) {
+            storeRelease(balancedAssignment, true);
+        }
+        CentroidTuple<T> *cluster = getCentroid(clusterId);
+        appendVector(cluster, point, id);
+        recordLocation(clusterId, cluster, id);
+    }
 
-        for (size_t i = 0; i < data.size(); ++i) {
-            if (lastDataElemIt == endTuplesIt) {
-                auto newDataPage = new DataPage<T>();
-                lastDataPage->nextPage = newDataPage;
-                lastDataPage = newDataPage;
-                lastDataElemIt = lastDataPage->tuples.begin();
-                endTuplesIt = lastDataPage->getEndTuples(dimension);
-                nextIdPtr = (u_int32_t *) &(*endTuplesIt);
+    // insert for several vectors, nearest centroids are found in parallel, appends keep the input order
+    void insertBatch(const std::vector<std::vector<T>> &vectors, const std::vector<u_int32_t> &ids) {
+        if (vectors.size() != ids.size()) {
+            throw std::invalid_argument("Every vector needs exactly one id.");
+        }
+        for (const std::vector<T> &vec: vectors) {
+            checkInsertable(vec.size());
+        }
+        const size_t count = vectors.size();
+        std::vector<u_int32_t> clusterIds(count);
+        // kCosine vectors are normalized once in the parallel pass and appended from here (count x dimension)
+        std::vector<T> normalizedVectors(Metric == MetricType::kCosine ? count * dimension : 0);
+        auto getPoint = [&](size_t i) -> const T * {
+            return Metric == MetricType::kCosine ? normalizedVectors.data() + i * dimension : vectors[i].data();
+        };
+        parallelFor(count, calcChunkSize(count, 64), [&](size_t begin, size_t end) {
+            std::vector<float> centroidDistances;
+            for (size_t i = begin; i < end; ++i) {
+                if constexpr (Metric == MetricType::kCosine) {
+                    std::copy(vectors[i].begin(), vectors[i].end(), normalizedVectors.begin() + i * dimension);
+                    normalizeVector(normalizedVectors.data() + i * dimension, dimension);
+                }
+                clusterIds[i] = findNearestCluster(getPoint(i), centroidDistances);
             }
+        });
+        const auto clusterIdToPointer = findClusterIdToPointer();
+        std::lock_guard<std::mutex> lock(writeMutex);
+        reclaimPages();
+        std::vector<float> centroidDistances;
+        for (size_t i = 0; i < count; ++i) {
+            const T *point = getPoint(i);
+            const u_int32_t clusterId = selectInsertCluster(point, clusterIds[i], centroidDistances);
+            if (clusterId != clusterIds[i]) {
+                storeRelease(balancedAssignment, true);
+            }
+            CentroidTuple<T> *cluster = clusterIdToPointer[clusterId];
+            appendVector(cluster, point, ids[i]);
+            recordLocation(clusterId, cluster, ids[i]);
+        }
+    }
 
-            auto &vec = data[i];
-            lastDataElemIt = std::copy(vec.get().begin(), vec.get().end(), lastDataElemIt);
-            std::memcpy(nextIdPtr, &ids[i], 4);
-            nextIdPtr += 4;
+    // Marks the vector with the given id deleted and returns false if there is none. The slot stays on its page
+    // as a tombstone that scans skip until vacuum compacts the cluster. Ids are expected to be unique, the first
+    // call indexes all stored ids. A search running concurrently may still return the vector.
+    bool remove(const u_int32_t id) {
+        checkWritable();
+        if (firstCentroidPage == nullptr) {
+            throw std::logic_error("Index is not built.");
+        }
+        std::lock_guard<std::mutex> lock(writeMutex);
+        reclaimPages();
+        buildLocator();
+        auto it = locator.find(id);
+        if (it == locator.end()) {
+            return false;
         }
+        const VectorLocation location = it->second;
+        locator.erase(it);
+        getDataPage(location.page)->markDead(location.slot, dimension);
+        CentroidTuple<T> *cluster = getCentroid(location.clusterId);
+        storeRelease(cluster->vectorCount, cluster->vectorCount - 1);
+        ++deadCounts[location.clusterId];
+        return true;
+    }
+
+    // Compacts the page chains of clusters with tombstones. Surviving vectors are copied to new pages that
+    // replace the chain behind its last page without deletions, the replaced pages go back to the page arena
+    // once no search walks them anymore. Clusters are compacted in parallel, sparsest first, at most
+    // maxClusterCount of them per call and only those with at least minDeadFraction of their slots deleted, so
+    // a deletion-heavy workload can vacuum in small steps while searches keep running. Returns by how many
+    // pages the chains shrank.
+    size_t vacuum(const size_t maxClusterCount = std::numeric_limits<size_t>::max(),
+                  const float minDeadFraction = 0.0f) {
+        checkWritable();
+        if (firstCentroidPage == nullptr) {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lock(writeMutex);
+        const auto clusterIdToPointer = findClusterIdToPointer();
+        auto calcDeadFraction = [this, &clusterIdToPointer](u_int32_t clusterId) {
+            return static_cast<float>(deadCounts[clusterId]) /
+                   static_cast<float>(deadCounts[clusterId] + clusterIdToPointer[clusterId]->vectorCount);
+        };
+        std::vector<u_int32_t> clusterIds;
+        for (u_int32_t c = 0; c < clusterCount; ++c) {
+            if (deadCounts[c] != 0 && calcDeadFraction(c) >= minDeadFraction) {
+                clusterIds.push_back(c);
+            }
+        }
+        const size_t vacuumCount = std::min(maxClusterCount, clusterIds.size());
+        std::partial_sort(clusterIds.begin(), clusterIds.begin() + vacuumCount, clusterIds.end(),
+                          [&calcDeadFraction](u_int32_t lhs, u_int32_t rhs) {
+                              return calcDeadFraction(lhs) > calcDeadFraction(rhs);
+                          });
+
+        std::vector<std::vector<BlockNumber>> replacedPages(vacuumCount);
+        std::vector<size_t> allocatedPageCounts(vacuumCount, 0);
+        parallelFor(vacuumCount, calcChunkSize(vacuumCount, 1), [&](size_t begin, size_t end) {
+            std::vector<T> vec(dimension);
+            for (size_t i = begin; i < end; ++i) {
+                allocatedPageCounts[i] = compactCluster(clusterIds[i], clusterIdToPointer[clusterIds[i]], vec,
+                                                        replacedPages[i]);
+            }
+        });
+
+        std::vector<BlockNumber> retiredPages;
+        for (const auto &pages: replacedPages) {
+            retiredPages.insert(retiredPages.end(), pages.begin(), pages.end());
+        }
+        const size_t allocatedPageCount = std::accumulate(allocatedPageCounts.begin(), allocatedPageCounts.end(),
+                                                          size_t(0));
+        epochs.retire(retiredPages);
+        reclaimPages();
+        return retiredPages.size() - allocatedPageCount;
+    }
+
+    inline DataPage<T> *getDataPage(BlockNumber pageNumber) {
+        return reinterpret_cast<DataPage<T> *>(pageArena.getPage(pageNumber));
+    }
+
+    inline const DataPage<T> *getDataPage(BlockNumber pageNumber) const {
+        return reinterpret_cast<const DataPage<T> *>(pageArena.getPage(pageNumber));
     }
 
 private:
+    void checkWritable() const {
+        if (mappedFile) {
+            throw std::logic_error("Index is mapped read-only.");
+        }
+    }
+
+    static void checkIndexFileHeader(const IndexFileHeader &header, const std::string &path) {
+        if (header.elementType != static_cast<u_int32_t>(elementTypeOf<T>()) || header.elementSize != sizeof(T)) {
+            throw std::runtime_error("Index file '" + path + "' stores vectors of another type.");
+        }
+        if (header.metric != static_cast<u_int32_t>(Metric)) {
+            throw std::runtime_error("Index file '" + path + "' uses another metric.");
+        }
+        if (header.pageLayout != static_cast<u_int32_t>(PageLayout::kRowMajor) &&
+            header.pageLayout != static_cast<u_int32_t>(PageLayout::kBlocked)) {
+            throw std::runtime_error("Index file '" + path + "' has an unknown page layout.");
+        }
+        const size_t recordsPerPage = calcCentroidRecordsPerPage<T>(header.dimension);
+        if (recordsPerPage == 0 ||
+            header.centroidPageCount != (header.clusterCount + recordsPerPage - 1) / recordsPerPage) {
+            throw std::runtime_error("Index file '" + path + "' has inconsistent centroid pages.");
+        }
+        if ((header.flags & ~kIndexFileFlagBalancedAssignment) != 0) {
+            throw std::runtime_error("Index file '" + path + "' has unknown flags.");
+        }
+    }
+
+    void restoreBalancing(const IndexFileHeader &header) {
+        maxClusterSize = header.maxClusterSize;
+        balancedAssignment = (header.flags & kIndexFileFlagBalancedAssignment) != 0;
+    }
+
+    // calls f(page) for every data page of the cluster
+    template<typename F>
+    void forEachDataPage(const CentroidTuple<T> *cluster, F f) const {
+        BlockNumber pageNumber = loadAcquire(cluster->firstDataPage);
+        // a chain visits every page at most once, more steps mean a cycle
+        for (size_t step = 0; pageNumber != kInvalidBlockNumber; ++step) {
+            // read again, concurrent appends add pages
+            const size_t pageCount = pageArena.getPageCount();
+            if (pageNumber >= pageCount) {
+                throw std::runtime_error("Page link points outside of the index.");
+            }
+            if (step == pageCount) {
+                throw std::runtime_error("Page chain of a cluster is broken.");
+            }
+            const DataPage<T> *pg = getDataPage(pageNumber);
+            f(pg);
+            pageNumber = loadAcquire(pg->header.nextPage);
+        }
+    }
+
+    BlockNumber allocateDataPage() {
+        BlockNumber pageNumber = pageArena.allocatePage();
+        getDataPage(pageNumber)->init(pageLayout);
+        return pageNumber;
+    }
+
+    // appends to the tail page of the cluster, a full tail gets a successor; readers find a new page only after
+    // it is initialized and a new slot only after it is written
+    void appendVector(CentroidTuple<T> *cluster, const T *vec, const u_int32_t id) {
+        if (cluster->lastDataPage == kInvalidBlockNumber ||
+            getDataPage(cluster->lastDataPage)->header.vectorCount ==
+            DataPage<T>::calcVectorCount(dimension, pageLayout)) {
+            BlockNumber newPage = allocateDataPage();
+            if (cluster->lastDataPage == kInvalidBlockNumber) {
+                storeRelease(cluster->firstDataPage, newPage);
+            } else {
+                storeRelease(getDataPage(cluster->lastDataPage)->header.nextPage, newPage);
+            }
+            cluster->lastDataPage = newPage;
+        }
+        getDataPage(cluster->lastDataPage)->appendVector(vec, id, dimension);
+        storeRelease(cluster->vectorCount, cluster->vectorCount + 1);
+    }
+
+    // hands pages retired by vacuum to the page arena once no search can reach them
+    void reclaimPages() {
+        epochs.reclaim([this](BlockNumber pageNumber) {
+            // released pages stay consistent, a saved index passes the page checks on load
+            getDataPage(pageNumber)->init(pageLayout);
+            pageArena.releasePage(pageNumber);
+        });
+    }
+
+    // keeps the locator in sync with a vector just appended to the tail of the cluster
+    void recordLocation(const u_int32_t clusterId, const CentroidTuple<T> *cluster, const u_int32_t id) {
+        if (locatorBuilt) {
+            const u_int32_t slot = getDataPage(cluster->lastDataPage)->header.vectorCount - 1;
+            locator[id] = VectorLocation{clusterId, cluster->lastDataPage, slot};
+        }
+    }
+
+    void buildLocator() {
+        if (locatorBuilt) {
+            return;
+        }
+        const auto clusterIdToPointer = findClusterIdToPointer();
+        for (u_int32_t c = 0; c < clusterCount; ++c) {
+            locator.reserve(locator.size() + clusterIdToPointer[c]->vectorCount);
+            BlockNumber pageNumber = clusterIdToPointer[c]->firstDataPage;
+            while (pageNumber != kInvalidBlockNumber) {
+                const DataPage<T> *pg = getDataPage(pageNumber);
+                const u_int32_t *ids = pg->getIds(dimension);
+                const u_int64_t *tombstones = pg->getTombstones(dimension);
+                for (u_int32_t i = 0; i < pg->header.vectorCount; ++i) {
+                    if (!DataPage<T>::isDead(tombstones, i)) {
+                        locator[ids[i]] = VectorLocation{c, pageNumber, i};
+                    }
+                }
+                pageNumber = pg->header.nextPage;
+            }
+        }
+        locatorBuilt = true;
+    }
+
+    // Copies the live vectors behind the last page of the cluster without deletions to new pages and links them
+    // in place of the old ones with one release store, so a concurrent scan walks either chain completely.
+    // The replaced pages are returned for retirement. Runs on a pool thread: it only touches this cluster and
+    // values of existing locator entries. Returns the number of allocated pages.
+    size_t compactCluster(const u_int32_t clusterId, CentroidTuple<T> *cluster, std::vector<T> &vec,
+                          std::vector<BlockNumber> &replacedPages) {
+        // pages before the first one with tombstones are full and stay
+        BlockNumber keptTail = kInvalidBlockNumber;
+        BlockNumber pageNumber = cluster->firstDataPage;
+        while (pageNumber != kInvalidBlockNumber && getDataPage(pageNumber)->header.deadCount == 0) {
+            keptTail = pageNumber;
+            pageNumber = getDataPage(pageNumber)->header.nextPage;
+        }
+
+        const size_t vectorsPerPage = DataPage<T>::calcVectorCount(dimension, pageLayout);
+        BlockNumber firstNewPage = kInvalidBlockNumber;
+        BlockNumber lastNewPage = kInvalidBlockNumber;
+        size_t allocatedPageCount = 0;
+        for (; pageNumber != kInvalidBlockNumber; pageNumber = getDataPage(pageNumber)->header.nextPage) {
+            replacedPages.push_back(pageNumber);
+            const DataPage<T> *pg = getDataPage(pageNumber);
+            const u_int32_t *ids = pg->getIds(dimension);
+            const u_int64_t *tombstones = pg->getTombstones(dimension);
+            for (u_int32_t i = 0; i < pg->header.vectorCount; ++i) {
+                if (DataPage<T>::isDead(tombstones, i)) {
+                    continue;
+                }
+                if (lastNewPage == kInvalidBlockNumber ||
+                    getDataPage(lastNewPage)->header.vectorCount == vectorsPerPage) {
+                    BlockNumber newPage = allocateDataPage();
+                    ++allocatedPageCount;
+                    if (lastNewPage == kInvalidBlockNumber) {
+                        firstNewPage = newPage;
+                    } else {
+                        getDataPage(lastNewPage)->header.nextPage = newPage;
+                    }
+                    lastNewPage = newPage;
+                }
+                DataPage<T> *target = getDataPage(lastNewPage);
+                pg->copyVector(i, dimension, vec.data());
+                target->appendVector(vec.data(), ids[i], dimension);
+                auto it = locator.find(ids[i]);
+                if (it != locator.end() && it->second.page == pageNumber && it->second.slot == i) {
+                    it->second = VectorLocation{clusterId, lastNewPage, target->header.vectorCount - 1};
+                }
+            }
+        }
+
+        if (keptTail == kInvalidBlockNumber) {
+            storeRelease(cluster->firstDataPage, firstNewPage);
+        } else {
+            storeRelease(getDataPage(keptTail)->header.nextPage, firstNewPage);
+        }
+        cluster->lastDataPage = lastNewPage != kInvalidBlockNumber ? lastNewPage : keptTail;
+        deadCounts[clusterId] = 0;
+        return allocatedPageCount;
+    }
+
+    // counts tombstones of loaded clusters and returns pages no chain links to the page arena
+    void restoreDeadCounts(const std::vector<CentroidTuple<T> *> &clusterIdToPointer) {
+        std::vector<bool> linked(pageArena.getPageCount(), false);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            for (BlockNumber pageNumber = clusterIdToPointer[c]->firstDataPage; pageNumber != kInvalidBlockNumber;
+                 pageNumber = getDataPage(pageNumber)->header.nextPage) {
+                deadCounts[c] += getDataPage(pageNumber)->header.deadCount;
+                linked[pageNumber] = true;
+            }
+        }
+        for (size_t i = 0; i < linked.size(); ++i) {
+            if (!linked[i]) {
+                pageArena.releasePage(static_cast<BlockNumber>(i));
+            }
+        }
+    }
+
+    void checkInsertable(const size_t vectorDimension) const {
+        checkWritable();
+        if (firstCentroidPage == nullptr) {
+            throw std::logic_error("Index is not built.");
+        }
+        if (vectorDimension != dimension) {
+            throw std::invalid_argument("Vector dimension does not match index dimension.");
+        }
+    }
+
+    // centroidDistances is scratch space
+    u_int32_t findNearestCluster(const T *vec, std::vector<float> &centroidDistances) const {
+        centroidDistances.resize(clusterCount);
+        calcCentroidPageDistances(vec, 0, clusterCount, centroidDistances.data());
+        return static_cast<u_int32_t>(std::min_element(centroidDistances.begin(), centroidDistances.end()) -
+                                      centroidDistances.begin());
+    }
+
+    // the nearest cluster, or with maxClusterSize set the nearest one below it while there is one;
+    // centroidDistances is scratch
+    u_int32_t selectInsertCluster(const T *vec, const u_int32_t nearestClusterId,
+                                  std::vector<float> &centroidDistances) const {
+        if (maxClusterSize == 0 || getCentroid(nearestClusterId)->vectorCount < maxClusterSize) {
+            return nearestClusterId;
+        }
+        const auto clusterIdToPointer = findClusterIdToPointer();
+        centroidDistances.resize(clusterCount);
+        calcCentroidPageDistances(vec, 0, clusterCount, centroidDistances.data());
+        u_int32_t selected = nearestClusterId;
+        float minDistance = std::numeric_limits<float>::max();
+        for (u_int32_t c = 0; c < clusterCount; ++c) {
+            if (clusterIdToPointer[c]->vectorCount < maxClusterSize && centroidDistances[c] < minDistance) {
+                minDistance = centroidDistances[c];
+                selected = c;
+            }
+        }
+        return selected;
+    }
+
+    CentroidTuple<T> *getCentroid(u_int32_t clusterId) const {
+        CentroidPage<T> *pg = firstCentroidPage;
+        while (clusterId >= pg->tuples.size()) {
+            clusterId -= pg->tuples.size();
+            pg = pg->nextPage;
+        }
+        return &pg->tuples[clusterId];
+    }
+
+    void checkPageLinks(const std::vector<CentroidRecordHeader> &records, const std::string &path) const {
+        const size_t pageCount = pageArena.getPageCount();
+        auto isValid = [pageCount](BlockNumber pageNumber) {
+            return pageNumber == kInvalidBlockNumber || pageNumber < pageCount;
+        };
+        const size_t vectorsPerPage = DataPage<T>::calcVectorCount(dimension, pageLayout);
+        for (size_t i = 0; i < pageCount; ++i) {
+            const DataPage<T> *pg = getDataPage(i);
+            if (!isValid(pg->header.nextPage)) {
+                throw std::runtime_error("Index file '" + path + "' has a broken page link.");
+            }
+            if (pg->header.layout != pageLayout || pg->header.vectorCount > vectorsPerPage ||
+                pg->header.deadCount > pg->header.vectorCount) {
+                throw std::runtime_error("Index file '" + path + "' has a corrupted data page.");
+            }
+        }
+        for (const auto &record: records) {
+            if (!isValid(record.firstDataPage)) {
+                throw std::runtime_error("Index file '" + path + "' has a broken page link.");
+            }
+        }
+    }
+
     std::vector<CentroidTuple<T> *> findClusterIdToPointer() const {
         std::vector<CentroidTuple<T> *> clusterIdToPointer(clusterCount);
         CentroidPage<T> *curCentroidPage = firstCentroidPage;
@@ -150,21 +1086,51 @@ private:
         return clusterIdToPointer;
     }
 
-    DataPage<T> *findLastDataPage(const CentroidTuple<T> *centroidInfo) {
-        auto curDataPage = centroidInfo->firstDataPage;
-        while (curDataPage != nullptr && curDataPage->hasNextPage()) {
-            curDataPage = curDataPage->nextPage;
+    // walks the chain, only used to restore lastDataPage of loaded indexes
+    BlockNumber findLastDataPage(const CentroidTuple<T> *centroidInfo) const {
+        const size_t pageCount = pageArena.getPageCount();
+        BlockNumber pageNumber = centroidInfo->firstDataPage;
+        for (size_t step = 0; pageNumber != kInvalidBlockNumber; ++step) {
+            if (pageNumber >= pageCount || step == pageCount) {
+                throw std::runtime_error("Page chain of a cluster is broken.");
+            }
+            BlockNumber nextPage = getDataPage(pageNumber)->header.nextPage;
+            if (nextPage == kInvalidBlockNumber) {
+                return pageNumber;
+            }
+            pageNumber = nextPage;
         }
-        return curDataPage;
+        return kInvalidBlockNumber;
     }
 
-    IVFFlatClusterData<T> train(const std::vector<std::vector<T>> &points, const size_t maxEpochs, const float tol) {
+    IVFFlatClusterData<T> train(const std::vector<std::vector<T>> &points, const size_t maxEpochs, const float tol,
+                                const kMeansSamplingMode samplingMode, const u_int64_t seed,
+                                const size_t learnClusterSize) {
         Timer t("Train");
-        IVFFlatClusterData<T> data = kMeans(points, clusterCount, maxEpochs, tol);
+        IVFFlatClusterData<T> data = kMeans<T, Metric>(points, clusterCount, maxEpochs, tol, samplingMode, seed,
+                                                       learnClusterSize);
         return data;
     }
 
-    void addCentroids(IVFFlatClusterData<T> &data) {
+    void checkClusterCapacity(const size_t vectorCount) const {
+        if (maxClusterSize != 0 && maxClusterSize * clusterCount < vectorCount) {
+            throw std::invalid_argument("Base vectors do not fit into the clusters at the maximum cluster size.");
+        }
+    }
+
+    // maxClusterSize scaled to a learn set sampled from the base vectors, large enough to hold the learn set
+    size_t calcLearnClusterSize(const size_t learnVectorCount, const size_t baseVectorCount) const {
+        if (maxClusterSize == 0) {
+            return 0;
+        }
+        const size_t minSize = (learnVectorCount + clusterCount - 1) / clusterCount;
+        if (baseVectorCount == 0) {
+            return minSize;
+        }
+        return std::max(minSize, (maxClusterSize * learnVectorCount + baseVectorCount - 1) / baseVectorCount);
+    }
+
+    void addCentroids(const IVFFlatClusterData<T> &data) {
         Timer t("Filling centroid pages");
         for (u_int32_t i = 0; i < data.centroids.size(); ++i) {
             addCentroid(data.centroids[i]);
@@ -175,53 +1141,33 @@ private:
         Timer t("Adding base vectors");
         const auto clusterIdToPointer = findClusterIdToPointer();
 
-        size_t pointsCount = points.size();
-        std::vector<std::vector<u_int32_t>> idClusters(clusterCount);
-        std::vector<uint32_t> clusterIndexes(pointsCount);
-        std::vector<boost::unique_future<void>> pendingTasks;
-        auto &threadPool = getThreadPool();
-
-        for (size_t id = 0; id < pointsCount; id += 50000) {
-            auto findClosestCentroid = [this, &points, id, pointsCount, &clusterIndexes]() {
-                for (size_t pId = id; pId < std::min(pointsCount, id + 50000); ++pId) {
-                    const std::vector<T> &point = points[pId];
-                    size_t clustersLeft = clusterCount;
-                    size_t closestClusterIndex = 0;
-                    size_t centroidId = 0;
-                    float minDistance = std::numeric_limits<float>::max();
-
-                    for (CentroidPage<T> *pg = firstCentroidPage; pg != nullptr; pg = pg->nextPage) {
-                        size_t centroidCountOnPage = std::min(pg->tuples.size(), clustersLeft);
-
-                        for (size_t i = 0; i < centroidCountOnPage; ++i) {
-                            const auto &centroid = pg->tuples[i];
-                            auto curDistance = distanceCounter(centroid.vec.data(), point.data(), dimension);
-                            if (minDistance > curDistance) {
-                                minDistance = curDistance;
-                                closestClusterIndex = centroidId;
-                            }
-                            ++centroidId;
-                        }
-                        clustersLeft -= centroidCountOnPage;
-                    }
-                    clusterIndexes[pId] = closestClusterIndex;
-                }
-            };
-
-            Task task(findClosestCentroid);
-            findClosestCentroid();
-            boost::unique_future<void> fut = task.get_future();
-            pendingTasks.push_back(std::move(fut));
-            threadPool.Submit(std::move(task));
+        std::vector<uint32_t> clusterIndexes(points.size());
+        std::vector<float> centroidDistances(points.size());
+        std::vector<float> convertedCentroids;
+        const float *centroidRows;
+        if constexpr (std::is_same<float, T>::value) {
+            centroidRows = centroidVectors.data();
+        } else {
+            convertedCentroids.assign(centroidVectors.begin(), centroidVectors.end());
+            centroidRows = convertedCentroids.data();
+        }
+        findNearestCentroids<Metric>(centroidRows, clusterCount, dimension, points, clusterIndexes.data(),
+                                     centroidDistances.data());
+        if (maxClusterSize != 0 && !points.empty()) {
+            balanceAssignment<Metric>(centroidRows, clusterCount, dimension, points, clusterIndexes.data(),
+                                      centroidDistances.data(), maxClusterSize);
+            storeRelease(balancedAssignment, true);
         }
-        boost::wait_for_all(pendingTasks.begin(), pendingTasks.end());
 
-        std::unordered_map<size_t, std::vector<std::reference_wrapper<const std::vector<T>>>> centroidToPoints;
-        std::unordered_map<u_int32_t, std::vector<u_int32_t>> centroidToVectorIds;
+        // indexed by cluster id, the tasks below only read their own entries
+        std::vector<std::vector<std::reference_wrapper<const std::vector<T>>>> centroidToPoints(clusterCount);
+        std::vector<std::vector<u_int32_t>> centroidToVectorIds(clusterCount);
         for (size_t i = 0; i < points.size(); ++i) {
             centroidToPoints[clusterIndexes[i]].push_back(std::cref(points[i]));
             centroidToVectorIds[clusterIndexes[i]].push_back(ids[i]);
         }
+        std::vector<boost::unique_future<void>> pendingTasks;
+        auto &threadPool = getThreadPool();
         for (size_t i = 0; i < clusterCount; ++i) {
             auto addDataForCentroid = [this, i, &centroidToPoints, &centroidToVectorIds, &clusterIdToPointer]() {
                 addData(centroidToPoints[i], centroidToVectorIds[i], clusterIdToPointer[i]);
@@ -237,7 +1183,9 @@ private:
     std::vector<std::pair<std::vector<T>, u_int32_t>>
     search(const std::vector<T> &vec, const size_t neighbourCount, const size_t clusterCountToSelect) const {
         using CentrWithDist = std::pair<const CentroidTuple<T> *, float>;
-        using VecWithDist = std::tuple<const T *, float, u_int32_t>;
+        EpochGuard guard(epochs);
+        std::vector<T> normalizedQuery;
+        const T *query = prepareQuery(vec.data(), normalizedQuery);
 
         std::vector<CentrWithDist> centrDists(clusterCount);
 
@@ -248,11 +1196,11 @@ private:
         for (CentroidPage<T> *pg = firstCentroidPage; pg != nullptr; pg = pg->nextPage) {
             size_t centroidCountOnPage = std::min(pg->tuples.size(), clustersLeft);
 
-            auto calcDistsToCentroids = [this, &centrDists, &vec, centroidCountOnPage, clustersLeft, pg]() {
+            auto calcDistsToCentroids = [this, &centrDists, &vec, query, centroidCountOnPage, clustersLeft, pg]() {
                 for (size_t i = 0; i < centroidCountOnPage; ++i) {
                     const auto &centroid = pg->tuples[i];
                     centrDists[clusterCount - clustersLeft + i] = std::move(
-                            CentrWithDist(&centroid, distanceCounter(centroid.vec.data(), vec.data(),
+                            CentrWithDist(&centroid, distanceCounter(centroid.vec.data(), query,
                                                                      std::min(vec.size(), dimension))));
                 }
             };
@@ -265,94 +1213,560 @@ private:
         }
         boost::wait_for_all(pendingTasks.begin(), pendingTasks.end());
 
-        //TODO: find/implement a faster way to sort
-        std::sort(centrDists.begin(), centrDists.end(), [](const CentrWithDist &lhs, const CentrWithDist &rhs) {
+        auto isCloser = [](const CentrWithDist &lhs, const CentrWithDist &rhs) {
             return lhs.second < rhs.second;
-        });
+        };
+        const size_t sortedCount = std::min(clusterCountToSelect, clusterCount);
+        std::partial_sort(centrDists.begin(), centrDists.begin() + sortedCount, centrDists.end(), isCloser);
 
-        std::vector<const CentroidTuple<T> *> topClusters(clusterCountToSelect);
-        for (size_t i = 0; i < clusterCountToSelect; ++i) {
-            topClusters[i] = centrDists[i].first;
+        // the closest clusters, and the next closest ones while the selected clusters hold fewer than
+        // neighbourCount vectors, each selected when it is needed; slices are sized from a snapshot of the
+        // counts, concurrent writers may change them while scanning
+        std::vector<const CentroidTuple<T> *> topClusters;
+        std::vector<size_t> sliceSizes;
+        size_t vectorCount = 0;
+        for (size_t i = 0; i < clusterCount && (i < clusterCountToSelect || vectorCount < neighbourCount); ++i) {
+            if (i >= sortedCount) {
+                std::nth_element(centrDists.begin() + i, centrDists.begin() + i, centrDists.end(), isCloser);
+            }
+            topClusters.push_back(centrDists[i].first);
+            sliceSizes.push_back(std::min(loadAcquire(centrDists[i].first->vectorCount), neighbourCount));
+            vectorCount += sliceSizes.back();
         }
+        const size_t selectedCount = topClusters.size();
 
-        size_t vectorCount = 0;
-        for (const CentroidTuple<T> *cluster: topClusters) {
-            vectorCount += std::min(cluster->vectorCount, neighbourCount);
+        // every cluster keeps at most neighbourCount scored candidates in its own slice
+        std::vector<float> topDistances(vectorCount);
+        std::vector<VecRef> topVectors(vectorCount);
+        std::vector<size_t> sliceOffsets(selectedCount, 0);
+        for (size_t i = 1; i < selectedCount; ++i) {
+            sliceOffsets[i] = sliceOffsets[i - 1] + sliceSizes[i - 1];
         }
 
-        // TODO: select more clusters if more data needed
-        if (vectorCount < neighbourCount) {
-            throw std::runtime_error("Vector count from selected clusters is too small.");
+        for (size_t i = 0; i < selectedCount; ++i) {
+            auto getTopVectors = [this, i, &topClusters, &sliceOffsets, &sliceSizes, &topDistances, &topVectors,
+                                  query]() {
+                TopK<VecRef> topK(topDistances.data() + sliceOffsets[i], topVectors.data() + sliceOffsets[i],
+                                  sliceSizes[i]);
+                scanCluster(query, topClusters[i], topK);
+                // fewer if vectors were removed after the snapshot
+                sliceSizes[i] = topK.size();
+            };
+            Task task(getTopVectors);
+            boost::unique_future<void> fut = task.get_future();
+            pendingTasks.push_back(std::move(fut));
+            threadPool.Submit(std::move(task));
         }
+        boost::wait_for_all(pendingTasks.begin(), pendingTasks.end());
+
+        // merge the slices, distances are already known
+        std::vector<float> mergedDistances(neighbourCount);
+        std::vector<VecRef> mergedVectors(neighbourCount);
+        TopK<VecRef> topK(mergedDistances.data(), mergedVectors.data(), neighbourCount);
+        for (size_t i = 0; i < selectedCount; ++i) {
+            for (size_t j = sliceOffsets[i]; j < sliceOffsets[i] + sliceSizes[i]; ++j) {
+                topK.push(topDistances[j], topVectors[j]);
+            }
+        }
+        topK.finalize();
+
+        std::vector<std::pair<std::vector<T>, u_int32_t>> result(topK.size());
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i].first.resize(dimension);
+            mergedVectors[i].page->copyVector(mergedVectors[i].slot, dimension, result[i].first.data());
+            result[i].second = mergedVectors[i].id;
+        }
+        return result;
+    }
+
+private:
+    static constexpr size_t kQueryBlockSize = 8;
+    static constexpr size_t kMultiQueryBlockSize = 4;
+
+    struct VecRef {
+        const DataPage<T> *page;
+        u_int32_t slot;
+        u_int32_t id;
+    };
+
+    struct VectorLocation {
+        u_int32_t clusterId;
+        BlockNumber page;
+        u_int32_t slot;
+    };
+
+    // id -> slot of a live vector, built by the first remove and kept up to date by inserts and vacuum
+    std::unordered_map<u_int32_t, VectorLocation> locator;
+    bool locatorBuilt = false;
+    // tombstoned slots by cluster id, vacuum picks the clusters with the largest share
+    std::vector<size_t> deadCounts;
+    // serializes writers, searches do not take it
+    mutable std::mutex writeMutex;
+    // see setMaxClusterSize
+    size_t maxClusterSize = 0;
+    // set once a vector was placed under maxClusterSize, which may put it outside the cluster of its nearest
+    // centroid; rangeSearch then does not prune clusters
+    bool balancedAssignment = false;
+    // searches pin it, pages replaced by vacuum are reused after every pinned search has ended
+    mutable EpochManager epochs;
+
+    BatchSearchResult
+    searchBatchClusterMajor(const T *queries, const size_t queryCount, const size_t neighbourCount,
+                            const size_t probeCount,
+                            const std::vector<CentroidTuple<T> *> &clusterIdToPointer) const {
+        BatchSearchResult result(queryCount, neighbourCount);
+
+        // query -> probed clusters
+        std::vector<u_int32_t> probes(queryCount * probeCount);
+        parallelFor(queryCount, calcChunkSize(queryCount, kQueryBlockSize), [&](size_t begin, size_t end) {
+            std::vector<float> centrDists(kQueryBlockSize * clusterCount);
+            std::vector<u_int32_t> clusterIds(clusterCount);
+
+            for (size_t blockBegin = begin; blockBegin < end; blockBegin += kQueryBlockSize) {
+                size_t blockSize = std::min(end - blockBegin, kQueryBlockSize);
+                calcCentroidDistances(queries + blockBegin * dimension, blockSize, centrDists.data());
+                for (size_t i = 0; i < blockSize; ++i) {
+                    selectClusters(centrDists.data() + i * clusterCount, probeCount, clusterIds);
+                    std::copy(clusterIds.begin(), clusterIds.begin() + probeCount,
+                              probes.begin() + (blockBegin + i) * probeCount);
+                }
+            }
+        });
+
+        // cluster -> queries, entries of cluster c are [clusterOffsets[c], clusterOffsets[c + 1])
+        std::vector<size_t> clusterOffsets(clusterCount + 1, 0);
+        for (u_int32_t clusterId: probes) {
+            ++clusterOffsets[clusterId + 1];
+        }
+        std::partial_sum(clusterOffsets.begin(), clusterOffsets.end(), clusterOffsets.begin());
+
+        std::vector<u_int32_t> clusterQueries(probes.size());
+        std::vector<size_t> queryEntries(probes.size());
+        std::vector<size_t> cursor(clusterOffsets.begin(), clusterOffsets.end() - 1);
+        for (size_t i = 0; i < probes.size(); ++i) {
+            size_t entry = cursor[probes[i]]++;
+            clusterQueries[entry] = i / probeCount;
+            queryEntries[i] = entry;
+        }
+
+        // per entry top of the closest vectors of the cluster for the query
+        std::vector<float> partialDistances(probes.size() * neighbourCount);
+        std::vector<u_int32_t> partialIds(probes.size() * neighbourCount);
+        std::vector<size_t> partialSizes(probes.size(), 0);
+        parallelFor(clusterCount, calcChunkSize(clusterCount, 1), [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                if (clusterOffsets[c] != clusterOffsets[c + 1]) {
+                    scanClusterForQueries(queries, clusterIdToPointer[c], clusterQueries.data(), clusterOffsets[c],
+                                          clusterOffsets[c + 1], neighbourCount, partialDistances.data(),
+                                          partialIds.data(), partialSizes.data());
+                }
+            }
+        });
+
+        parallelFor(queryCount, calcChunkSize(queryCount, 1), [&](size_t begin, size_t end) {
+            for (size_t q = begin; q < end; ++q) {
+                TopK<u_int32_t> topK(result.getDistances(q), result.getIds(q), neighbourCount);
+                for (size_t j = 0; j < probeCount; ++j) {
+                    size_t entry = queryEntries[q * probeCount + j];
+                    const float *entryDistances = partialDistances.data() + entry * neighbourCount;
+                    const u_int32_t *entryIds = partialIds.data() + entry * neighbourCount;
+                    for (size_t i = 0; i < partialSizes[entry]; ++i) {
+                        topK.push(entryDistances[i], entryIds[i]);
+                    }
+                }
+                topK.finalize();
+            }
+        });
+        return result;
+    }
 
-        // Assume clusterCountToSelect * neighbourCount << total vector count from clusterCountToSelect clusters
-        std::vector<VecWithDist> topVectors(vectorCount);
-        size_t topVectorIdx = 0;
+    // scores every vector of the cluster against the queries of entries [entryBegin, entryEnd),
+    // kMultiQueryBlockSize queries at a time so each page vector is loaded once per query block
+    void scanClusterForQueries(const T *queries, const CentroidTuple<T> *cluster, const u_int32_t *clusterQueries,
+                               const size_t entryBegin, const size_t entryEnd, const size_t neighbourCount,
+                               float *partialDistances, u_int32_t *partialIds, size_t *partialSizes) const {
+        forEachDataPage(cluster, [&](const DataPage<T> *pg) {
+            const size_t vectorsCountOnPage = loadAcquire(pg->header.vectorCount);
+            const T *vectors = pg->getVectors();
+            const u_int32_t *ids = pg->getIds(dimension);
+            const u_int64_t *tombstones = loadAcquire(pg->header.deadCount) != 0 ? pg->getTombstones(dimension)
+                                                                                : nullptr;
+            float pageDists[DataPage<T>::kMaxVectorCount];
 
-        for (const CentroidTuple<T> *cluster: topClusters) {
-            auto getTopVectors = [this, cluster, topVectorIdx, &topVectors, &vec, neighbourCount]() {
-                size_t vectorsLeft = cluster->vectorCount;
-                auto vectorCountToSelect = std::min(vectorsLeft, neighbourCount);
-                std::vector<VecWithDist> topVectorFromCurrentCluster(vectorsLeft);
-                auto vectorIdxFromCurrentCluster = 0;
+            for (size_t entry = entryBegin; entry < entryEnd; entry += kMultiQueryBlockSize) {
+                size_t blockSize = std::min(entryEnd - entry, kMultiQueryBlockSize);
+                const T *blockQueries[kMultiQueryBlockSize];
+                for (size_t t = 0; t < kMultiQueryBlockSize; ++t) {
+                    // pad an incomplete block with its last query
+                    blockQueries[t] = queries + clusterQueries[entry + std::min(t, blockSize - 1)] * dimension;
+                }
+                std::optional<TopK<u_int32_t>> topKs[kMultiQueryBlockSize];
+                for (size_t t = 0; t < blockSize; ++t) {
+                    size_t offset = (entry + t) * neighbourCount;
+                    topKs[t].emplace(partialDistances + offset, partialIds + offset, neighbourCount,
+                                     partialSizes[entry + t]);
+                }
 
-                for (const DataPage<T> *pg = cluster->firstDataPage; pg != nullptr; pg = pg->nextPage) {
-                    size_t vectorsCountOnPage = std::min(pg->calcVectorCount(dimension), vectorsLeft);
-                    auto nextIdPtr = (u_int32_t *) &(*pg->getEndTuples(dimension));
-                    vectorsLeft -= vectorsCountOnPage;
+                if (pg->getLayout() == PageLayout::kBlocked) {
+                    // a blocked group already yields several distances per load, score query by query
+                    for (size_t t = 0; t < blockSize; ++t) {
+                        calcPageDistances(blockQueries[t], pg, vectorsCountOnPage, pageDists);
+                        for (size_t i = 0; i < vectorsCountOnPage; ++i) {
+                            if (tombstones == nullptr || !DataPage<T>::isDead(tombstones, i)) {
+                                topKs[t]->push(pageDists[i], ids[i]);
+                            }
+                        }
+                    }
+                } else {
+                    float dists[kMultiQueryBlockSize];
                     for (size_t i = 0; i < vectorsCountOnPage; ++i) {
-                        topVectorFromCurrentCluster[vectorIdxFromCurrentCluster] = std::tuple(
-                                pg->tuples.data() + i * dimension,
-                                distanceCounter(vec.data(), pg->tuples.data() + i * dimension, dimension),
-                                *nextIdPtr);
-                        nextIdPtr += 4;
-                        ++vectorIdxFromCurrentCluster;
+                        if (tombstones != nullptr && DataPage<T>::isDead(tombstones, i)) {
+                            continue;
+                        }
+                        distanceCounterBatch(vectors + i * dimension, blockQueries, dists);
+                        for (size_t t = 0; t < blockSize; ++t) {
+                            topKs[t]->push(dists[t], ids[i]);
+                        }
                     }
                 }
-                std::sort(topVectorFromCurrentCluster.begin(), topVectorFromCurrentCluster.end(),
-                          [](const VecWithDist &lhs, const VecWithDist &rhs) {
-                              return std::get<1>(lhs) < std::get<1>(rhs);
+                for (size_t t = 0; t < blockSize; ++t) {
+                    partialSizes[entry + t] = topKs[t]->size();
+                }
+            }
+        });
+    }
+
+    // keeps clusterIds[0, probeCount) as the closest clusters in ascending order of distance
+    void selectClusters(const float *dists, const size_t probeCount, std::vector<u_int32_t> &clusterIds) const {
+        std::iota(clusterIds.begin(), clusterIds.end(), 0);
+        std::partial_sort(clusterIds.begin(), clusterIds.begin() + probeCount, clusterIds.end(),
+                          [dists](u_int32_t lhs, u_int32_t rhs) {
+                              return dists[lhs] < dists[rhs];
                           });
-                std::copy(topVectorFromCurrentCluster.begin(),
-                          topVectorFromCurrentCluster.begin() + vectorCountToSelect,
-                          topVectors.begin() + topVectorIdx);
-            };
-            Task task(getTopVectors);
-            boost::unique_future<void> fut = task.get_future();
-            pendingTasks.push_back(std::move(fut));
-            threadPool.Submit(std::move(task));
+    }
 
-            topVectorIdx += std::min(cluster->vectorCount, neighbourCount);
+    // out is blockSize x clusterCount, row per query. Float indexes run 4 queries at a time against every
+    // column-blocked group of 8 centroids, so a centroid component is loaded once for 4 queries; the last queries
+    // of the block go one at a time. Other types run tiles of kAssignCentroidBlockSize contiguous centroid rows
+    // against every query of the block, so a tile stays in cache while the block passes over it.
+    void calcCentroidDistances(const T *queryBlock, const size_t blockSize, float *out) const {
+        float queryNorms[kQueryBlockSize] = {};
+        if constexpr (Metric == MetricType::kL2) {
+            for (size_t i = 0; i < blockSize; ++i) {
+                queryNorms[i] = normL2sqr(queryBlock + i * dimension, dimension);
+            }
         }
-        boost::wait_for_all(pendingTasks.begin(), pendingTasks.end());
+        // -q.c, kL2 turns it into ||q||^2 - 2 * q.c + ||c||^2
+        auto toDistance = [&](size_t queryIdx, size_t centroidId, float product) {
+            if constexpr (Metric == MetricType::kL2) {
+                return queryNorms[queryIdx] + centroidNorms[centroidId] - 2 * product;
+            } else {
+                return -product;
+            }
+        };
+        if constexpr (std::is_same<T, float>::value) {
+            float products[4 * kBlockedLanes];
+            for (size_t groupBegin = 0; groupBegin < clusterCount; groupBegin += kBlockedLanes) {
+                const float *group = centroidBlocks.data() + groupBegin * dimension;
+                const size_t groupSize = std::min(kBlockedLanes, clusterCount - groupBegin);
+                size_t i = 0;
+                for (; i + 4 <= blockSize; i += 4) {
+                    fvecInnerProductBlocked4x8(queryBlock + i * dimension, group, dimension, products);
+                    for (size_t q = 0; q < 4; ++q) {
+                        for (size_t j = 0; j < groupSize; ++j) {
+                            out[(i + q) * clusterCount + groupBegin + j] =
+                                    toDistance(i + q, groupBegin + j, products[q * kBlockedLanes + j]);
+                        }
+                    }
+                }
+                for (; i < blockSize; ++i) {
+                    fvecInnerProductBlocked8(queryBlock + i * dimension, group, dimension, products);
+                    for (size_t j = 0; j < groupSize; ++j) {
+                        out[i * clusterCount + groupBegin + j] = toDistance(i, groupBegin + j, products[j]);
+                    }
+                }
+            }
+            return;
+        }
+        for (size_t centroidBegin = 0; centroidBegin < clusterCount; centroidBegin += kAssignCentroidBlockSize) {
+            const size_t centroidBlockSize = std::min(kAssignCentroidBlockSize, clusterCount - centroidBegin);
+            const T *centroidBlock = centroidVectors.data() + centroidBegin * dimension;
+            for (size_t i = 0; i < blockSize; ++i) {
+                float *row = out + i * clusterCount + centroidBegin;
+                // -q.c for the whole tile
+                metricDistances<MetricType::kInnerProduct>(queryBlock + i * dimension, centroidBlock,
+                                                           centroidBlockSize, dimension, row);
+                for (size_t c = 0; c < centroidBlockSize; ++c) {
+                    row[c] = toDistance(i, centroidBegin + c, -row[c]);
+                }
+            }
+        }
+    }
+
+    // offers every vector of the cluster to topK, labels are ids or VecRef
+    template<typename Label>
+    void scanCluster(const T *query, const CentroidTuple<T> *cluster, TopK<Label> &topK) const {
+        forEachDataPage(cluster, [&](const DataPage<T> *pg) {
+            // slots published after this load are left to later searches
+            const size_t vectorsCountOnPage = loadAcquire(pg->header.vectorCount);
+            const u_int32_t *ids = pg->getIds(dimension);
+            // pages without deletions skip the bitmap
+            const u_int64_t *tombstones = loadAcquire(pg->header.deadCount) != 0 ? pg->getTombstones(dimension)
+                                                                                : nullptr;
+            float dists[DataPage<T>::kMaxVectorCount];
+            calcPageDistances(query, pg, vectorsCountOnPage, dists);
+            for (size_t i = 0; i < vectorsCountOnPage; ++i) {
+                if (tombstones != nullptr && DataPage<T>::isDead(tombstones, i)) {
+                    continue;
+                }
+                if constexpr (std::is_same<Label, VecRef>::value) {
+                    topK.push(dists[i], VecRef{pg, static_cast<u_int32_t>(i), ids[i]});
+                } else {
+                    topK.push(dists[i], ids[i]);
+                }
+            }
+        });
+    }
 
-        for (VecWithDist &vDist: topVectors) {
-            std::get<1>(vDist) = distanceCounter(vec.data(), std::get<0>(vDist), dimension);
+    // False if no vector of the cluster can be within radius of the query. For kL2 indexes without a cluster size
+    // cap every vector lies in the Voronoi cell of its centroid c, and the cell is at least
+    // (|q - c|^2 - |q - n|^2) / (2 |c - n|) away from a query whose nearest centroid is n.
+    bool mayContainHits(const u_int32_t clusterId, const u_int32_t nearestClusterId, const float *centroidDistances,
+                        const float radius) const {
+        if constexpr (Metric != MetricType::kL2) {
+            return true;
+        }
+        // lowered by the rounding error of the two distances
+        const float gap = centroidDistances[clusterId] - centroidDistances[nearestClusterId] -
+                          1e-5f * (centroidDistances[clusterId] + centroidDistances[nearestClusterId]);
+        if (clusterId == nearestClusterId || gap <= 0) {
+            return true;
         }
+        const float centroidGap = metricDistance<MetricType::kL2>(centroidVectors.data() + clusterId * dimension,
+                                                                  centroidVectors.data() + nearestClusterId * dimension,
+                                                                  dimension);
+        return gap * gap <= 4 * centroidGap * radius;
+    }
 
-        std::sort(topVectors.begin(), topVectors.end(), [](const VecWithDist &lhs, const VecWithDist &rhs) {
-            return std::get<1>(lhs) < std::get<1>(rhs);
+    template<typename Consumer>
+    size_t scanClusterInRange(const T *query, const CentroidTuple<T> *cluster, const float radius,
+                              Consumer &consume) const {
+        size_t hitCount = 0;
+        forEachDataPage(cluster, [&](const DataPage<T> *pg) {
+            const size_t vectorsCountOnPage = loadAcquire(pg->header.vectorCount);
+            const u_int32_t *ids = pg->getIds(dimension);
+            const u_int64_t *tombstones = loadAcquire(pg->header.deadCount) != 0 ? pg->getTombstones(dimension)
+                                                                                : nullptr;
+            float dists[DataPage<T>::kMaxVectorCount];
+            calcPageDistances(query, pg, vectorsCountOnPage, dists);
+            for (size_t i = 0; i < vectorsCountOnPage; ++i) {
+                if (dists[i] <= radius && (tombstones == nullptr || !DataPage<T>::isDead(tombstones, i))) {
+                    consume(ids[i], dists[i]);
+                    ++hitCount;
+                }
+            }
         });
+        return hitCount;
+    }
 
-        std::vector<std::pair<std::vector<T>, u_int32_t>> result(neighbourCount);
-        for (size_t i = 0; i < neighbourCount; ++i) {
-            result[i] = std::make_pair(
-                    std::vector<T>(std::get<0>(topVectors[i]), std::get<0>(topVectors[i]) + dimension),
-                    std::get<2>(topVectors[i]));
+    // Calls scan(cluster) for clusters in order of centroid distance until topK is full and policy stops the
+    // search, returns the number of visited clusters. Only the first minClusterCount clusters are sorted, the
+    // next closest one is selected when it is needed.
+    template<typename Scan>
+    size_t probeClusters(const T *query, const ProbePolicy &policy, const TopK<u_int32_t> &topK, Scan scan) const {
+        thread_local std::vector<float> centroidDistances;
+        thread_local std::vector<const CentroidTuple<T> *> clusters;
+        thread_local std::vector<u_int32_t> clusterOrder;
+        centroidDistances.resize(clusterCount);
+        clusters.resize(clusterCount);
+        clusterOrder.resize(clusterCount);
+        calcCentroidPageDistances(query, 0, clusterCount, centroidDistances.data());
+        size_t clustersLeft = clusterCount;
+        for (CentroidPage<T> *pg = firstCentroidPage; clustersLeft != 0; pg = pg->nextPage) {
+            size_t centroidCountOnPage = std::min(pg->tuples.size(), clustersLeft);
+            for (size_t i = 0; i < centroidCountOnPage; ++i) {
+                clusters[clusterCount - clustersLeft + i] = &pg->tuples[i];
+            }
+            clustersLeft -= centroidCountOnPage;
+        }
+        const size_t sortedCount = std::clamp<size_t>(policy.minClusterCount, 1, clusterCount);
+        selectClusters(centroidDistances.data(), sortedCount, clusterOrder);
+
+        size_t visitedVectorCount = 0;
+        for (size_t i = 0; i < clusterCount; ++i) {
+            if (i >= sortedCount) {
+                std::nth_element(clusterOrder.begin() + i, clusterOrder.begin() + i, clusterOrder.end(),
+                                 [](u_int32_t lhs, u_int32_t rhs) {
+                                     return centroidDistances[lhs] < centroidDistances[rhs];
+                                 });
+                if (topK.full() && (i >= policy.maxClusterCount || visitedVectorCount >= policy.maxVectorCount ||
+                                    isFarEnough(policy.stopRatio, topK.threshold(), clusterOrder[i],
+                                                centroidDistances[clusterOrder[i]]))) {
+                    return i;
+                }
+            }
+            const CentroidTuple<T> *cluster = clusters[clusterOrder[i]];
+            visitedVectorCount += loadAcquire(cluster->vectorCount);
+            scan(cluster);
+        }
+        return clusterCount;
+    }
+
+    // stopRatio rule of ProbePolicy; kCosine distances are negated products with the unit query, stored vectors
+    // are unit length and centroids are not
+    bool isFarEnough(const float stopRatio, const float kthDistance, const u_int32_t clusterId,
+                     const float centroidDistance) const {
+        if (stopRatio <= 0.0f) {
+            return false;
+        }
+        if constexpr (Metric == MetricType::kL2) {
+            return kthDistance <= stopRatio * centroidDistance;
+        } else if constexpr (Metric == MetricType::kCosine) {
+            return 2 + 2 * kthDistance <= stopRatio * (1 + centroidNorms[clusterId] + 2 * centroidDistance);
+        }
+        return false;
+    }
+
+    // scanCluster for the vectors passing filter, distances are computed only for them
+    template<typename Filter>
+    void scanClusterFiltered(const T *query, const CentroidTuple<T> *cluster, const Filter &filter,
+                             TopK<u_int32_t> &topK) const {
+        forEachDataPage(cluster, [&](const DataPage<T> *pg) {
+            const size_t vectorsCountOnPage = loadAcquire(pg->header.vectorCount);
+            const T *vectors = pg->getVectors();
+            const u_int32_t *ids = pg->getIds(dimension);
+            const u_int64_t *tombstones = loadAcquire(pg->header.deadCount) != 0 ? pg->getTombstones(dimension)
+                                                                                : nullptr;
+            u_int32_t slots[DataPage<T>::kMaxVectorCount];
+            size_t slotCount = 0;
+            for (size_t i = 0; i < vectorsCountOnPage; ++i) {
+                if ((tombstones == nullptr || !DataPage<T>::isDead(tombstones, i)) && filter(ids[i])) {
+                    slots[slotCount++] = static_cast<u_int32_t>(i);
+                }
+            }
+            if (slotCount == 0) {
+                return;
+            }
+
+            float dists[DataPage<T>::kMaxVectorCount];
+            if (slotCount == vectorsCountOnPage) {
+                calcPageDistances(query, pg, vectorsCountOnPage, dists);
+                for (size_t i = 0; i < vectorsCountOnPage; ++i) {
+                    topK.push(dists[i], ids[i]);
+                }
+            } else if (pg->getLayout() == PageLayout::kRowMajor) {
+                for (size_t j = 0; j < slotCount; ++j) {
+                    topK.push(distanceCounter(vectors + slots[j] * dimension, query, dimension), ids[slots[j]]);
+                }
+            } else {
+                // a group is scored once if any of its vectors passed
+                size_t scoredGroup = std::numeric_limits<size_t>::max();
+                for (size_t j = 0; j < slotCount; ++j) {
+                    const size_t group = slots[j] / kBlockedLanes;
+                    if (group != scoredGroup) {
+                        distanceCounterBlocked(query, vectors + group * kBlockedLanes * dimension,
+                                               dists + group * kBlockedLanes);
+                        scoredGroup = group;
+                    }
+                    topK.push(dists[slots[j]], ids[slots[j]]);
+                }
+            }
+        });
+    }
+
+    // distances to the centroids [firstClusterId, firstClusterId + count), one call per centroid page
+    void calcCentroidPageDistances(const T *query, const size_t firstClusterId, const size_t count,
+                                   float *out) const {
+        metricDistances<Metric>(query, centroidVectors.data() + firstClusterId * dimension, count, dimension, out);
+    }
+
+    // out receives a distance for each of the first vectorsCountOnPage vectors of the page, blocked pages may
+    // write up to the end of the last group
+    void calcPageDistances(const T *query, const DataPage<T> *pg, const size_t vectorsCountOnPage,
+                           float *out) const {
+        const T *vectors = pg->getVectors();
+        if (pg->getLayout() == PageLayout::kRowMajor) {
+            metricDistances<Metric>(query, vectors, vectorsCountOnPage, dimension, out);
+            return;
+        }
+        for (size_t i = 0; i < vectorsCountOnPage; i += kBlockedLanes) {
+            distanceCounterBlocked(query, vectors + i * dimension, out + i);
+        }
+    }
+
+    void distanceCounterBlocked(const T *query, const T *group, float *out) const {
+        static_assert(kBlockedLanes == 8);
+        if constexpr (std::is_same<float, typename std::remove_cv<T>::type>::value) {
+            if constexpr (Metric == MetricType::kL2) {
+                fvecL2sqrBlocked8(query, group, dimension, out);
+            } else {
+                fvecInnerProductBlocked8(query, group, dimension, out);
+                for (size_t j = 0; j < kBlockedLanes; ++j) {
+                    out[j] = -out[j];
+                }
+            }
+        } else {
+            float result[kBlockedLanes] = {};
+            for (size_t i = 0; i < dimension; ++i) {
+                for (size_t j = 0; j < kBlockedLanes; ++j) {
+                    if constexpr (Metric == MetricType::kL2) {
+                        float diff = static_cast<float>(group[i * kBlockedLanes + j]) - static_cast<float>(query[i]);
+                        result[j] += diff * diff;
+                    } else {
+                        result[j] += static_cast<float>(group[i * kBlockedLanes + j]) * static_cast<float>(query[i]);
+                    }
+                }
+            }
+            for (size_t j = 0; j < kBlockedLanes; ++j) {
+                out[j] = Metric == MetricType::kL2 ? result[j] : -result[j];
+            }
+        }
+    }
+
+    void distanceCounterBatch(const T *x, const T *const *queries, float *out) const {
+        static_assert(kMultiQueryBlockSize == 4);
+        if constexpr (std::is_same<float, typename std::remove_cv<T>::type>::value && Metric == MetricType::kL2) {
+            fvecL2sqrBatch4(x, queries[0], queries[1], queries[2], queries[3], dimension,
+                            out[0], out[1], out[2], out[3]);
+        } else {
+            for (size_t t = 0; t < kMultiQueryBlockSize; ++t) {
+                out[t] = distanceCounter(x, queries[t], dimension);
+            }
+        }
+    }
+
+    static float normL2sqr(const T *x, const size_t dim) {
+        if constexpr (std::is_same<float, typename std::remove_cv<T>::type>::value) {
+            return fvecNormL2sqr(x, dim);
+        } else if constexpr (hasDistanceKernels<T>()) {
+            return vecInnerProduct(x, x, dim);
+        }
+        float result = 0;
+        for (size_t i = 0; i < dim; ++i) {
+            result += static_cast<float>(x[i]) * static_cast<float>(x[i]);
         }
         return result;
     }
 
-private:
     float distanceCounter(const T *l, const T *r, const size_t dim) const {
-        if (std::is_same<float, typename std::remove_cv<T>::type>::value) {
-            return fvecL2sqr(l, r, dim);
+        return metricDistance<Metric>(l, r, dim);
+    }
+
+    // kCosine compares unit vectors, the query is normalized into scratch
+    const T *prepareQuery(const T *query, std::vector<T> &scratch) const {
+        if constexpr (Metric == MetricType::kCosine) {
+            scratch.assign(query, query + dimension);
+            normalizeVector(scratch.data(), dimension);
+            return scratch.data();
         }
-        float result = 0;
-        for (uint32_t i = 0; i < dim; ++i) {
-            result += static_cast<float>(r[i] - l[i]) * static_cast<float>(r[i] - l[i]);
+        return query;
+    }
+
+    static std::vector<std::vector<T>> normalizeVectors(const std::vector<std::vector<T>> &vectors) {
+        std::vector<std::vector<T>> result(vectors);
+        for (auto &vec: result) {
+            normalizeVector(vec.data(), vec.size());
         }
-        return sqrtf(result);
+        return result;
     }
 };
-
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "calc_distance.hpp"
+#include "clustering.hpp"
+#include "ivf_code_index.hpp"
+#include "top_k.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+
+// IVF index with product-quantized cluster contents. A base vector is kept as subQuantizerCount one-byte
+// codes of its residual to the cluster centroid, code j picks one of kSubCentroidCount sub-centroids trained
+// on components [j * subDimension, (j + 1) * subDimension) of the learn residuals. Codes and ids live on
+// DataPage<u_int8_t> pages. Search compares the query residual with every sub-centroid once per probed
+// cluster and scores codes by summing table entries (asymmetric distance computation).
+template<typename T>
+struct PaseIVFPQ : IVFCodeIndex {
+    static constexpr size_t kSubCentroidCount = 256;
+
+    const size_t subQuantizerCount;
+    const size_t subDimension;
+
+    // subQuantizerCount x kSubCentroidCount x subDimension
+    std::vector<float> codebooks;
+
+    PaseIVFPQ(size_t dimension, size_t clusterCount, size_t subQuantizerCount)
+            : IVFCodeIndex(dimension, clusterCount, subQuantizerCount), subQuantizerCount(subQuantizerCount),
+              subDimension(subQuantizerCount == 0 ? 0 : dimension / subQuantizerCount) {
+        if (subQuantizerCount == 0 || dimension % subQuantizerCount != 0) {
+            throw std::logic_error("Dimension must be divisible by the number of sub-quantizers.");
+        }
+    }
+
+    void buildIndex(const std::vector<std::vector<T>> &learnVectors,
+                    const std::vector<std::vector<T>> &baseVectors,
+                    const std::vector<u_int32_t> &ids,
+                    const size_t maxEpochs, const float tol) {
+        train(learnVectors, maxEpochs, tol);
+        add(baseVectors, ids);
+    }
+
+    // learns coarse centroids, then a codebook per sub-quantizer on the residuals of the learn vectors
+    void train(const std::vector<std::vector<T>> &learnVectors, const size_t maxEpochs, const float tol) {
+        Timer t("Train");
+        if (learnVectors.size() < std::max(clusterCount, kSubCentroidCount)) {
+            throw std::logic_error("Not enough learn vectors to train the quantizers.");
+        }
+        IVFFlatClusterData<T> data = kMeans(learnVectors, clusterCount, maxEpochs, tol);
+        setCentroids(data);
+
+        std::vector<float> residuals(learnVectors.size() * dimension);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            for (u_int32_t idx: data.idClusters[c]) {
+                calcResidual(learnVectors[idx].data(), centroids[c].vec.data(), residuals.data() + idx * dimension);
+            }
+        }
+
+        codebooks.assign(subQuantizerCount * kSubCentroidCount * subDimension, 0);
+        std::vector<std::vector<float>> subVectors(learnVectors.size(), std::vector<float>(subDimension));
+        for (size_t j = 0; j < subQuantizerCount; ++j) {
+            for (size_t i = 0; i < learnVectors.size(); ++i) {
+                const float *slice = residuals.data() + i * dimension + j * subDimension;
+                std::copy(slice, slice + subDimension, subVectors[i].begin());
+            }
+            IVFFlatClusterData<float> subData = kMeans(subVectors, kSubCentroidCount, maxEpochs, tol);
+            for (size_t k = 0; k < kSubCentroidCount; ++k) {
+                std::copy(subData.centroids[k].begin(), subData.centroids[k].end(), getSubCentroid(j, k));
+            }
+        }
+    }
+
+    // encodes base vectors in parallel and appends the codes to the pages of their clusters
+    void add(const std::vector<std::vector<T>> &points, const std::vector<u_int32_t> &ids) {
+        Timer t("Adding base vectors");
+        if (codebooks.empty()) {
+            throw std::logic_error("Index is not trained.");
+        }
+        addCodes(points, ids, [this](const float *point, u_int32_t clusterId, u_int8_t *code) {
+            thread_local std::vector<float> residual;
+            residual.resize(dimension);
+            calcResidual(point, centroids[clusterId].vec.data(), residual.data());
+            encode(residual.data(), code);
+        });
+    }
+
+    // Writes up to neighbourCount ids and approximate squared L2 distances into caller-owned buffers and
+    // returns how many were found. Runs on the calling thread, scratch space is thread local.
+    size_t searchInto(const T *query, const size_t queryDimension, const size_t neighbourCount,
+                      const size_t clusterCountToSelect, u_int32_t *ids, float *distances) const {
+        if (queryDimension != dimension) {
+            throw std::invalid_argument("Query dimension does not match index dimension.");
+        }
+        const size_t probeCount = std::min(clusterCountToSelect, centroids.size());
+        if (neighbourCount == 0 || probeCount == 0) {
+            return 0;
+        }
+
+        thread_local std::vector<float> queryVector;
+        thread_local std::vector<float> residual;
+        thread_local std::vector<float> lookupTable;
+        thread_local std::vector<float> probeDistances;
+        thread_local std::vector<u_int32_t> probeClusters;
+        queryVector.assign(query, query + dimension);
+        residual.resize(dimension);
+        lookupTable.resize(subQuantizerCount * kSubCentroidCount);
+        const size_t selectedCount = selectClusters(queryVector.data(), probeCount, probeDistances, probeClusters);
+
+        TopK<u_int32_t> topK(distances, ids, neighbourCount);
+        for (size_t i = 0; i < selectedCount; ++i) {
+            calcResidual(queryVector.data(), centroids[probeClusters[i]].vec.data(), residual.data());
+            calcLookupTable(residual.data(), lookupTable.data());
+            scanCluster(probeClusters[i], lookupTable.data(), topK);
+        }
+        topK.finalize();
+        return topK.size();
+    }
+
+    std::vector<u_int32_t>
+    findNearestVectorIds(const std::vector<T> &vec, const size_t neighbourCount,
+                         const size_t clusterCountToSelect) const {
+        std::vector<u_int32_t> ids(neighbourCount);
+        std::vector<float> distances(neighbourCount);
+        ids.resize(searchInto(vec.data(), vec.size(), neighbourCount, clusterCountToSelect, ids.data(),
+                              distances.data()));
+        return ids;
+    }
+
+private:
+    inline float *getSubCentroid(size_t subQuantizer, size_t subCentroid) {
+        return codebooks.data() + (subQuantizer * kSubCentroidCount + subCentroid) * subDimension;
+    }
+
+    inline const float *getSubCentroid(size_t subQuantizer, size_t subCentroid) const {
+        return codebooks.data() + (subQuantizer * kSubCentroidCount + subCentroid) * subDimension;
+    }
+
+    template<typename U>
+    void calcResidual(const U *vec, const float *centroid, float *out) const {
+        for (size_t i = 0; i < dimension; ++i) {
+            out[i] = static_cast<float>(vec[i]) - centroid[i];
+        }
+    }
+
+    void encode(const float *residual, u_int8_t *code) const {
+        float dists[kSubCentroidCount];
+        for (size_t j = 0; j < subQuantizerCount; ++j) {
+            fvecL2sqrNy(residual + j * subDimension, getSubCentroid(j, 0), kSubCentroidCount, subDimension, dists);
+            size_t nearest = 0;
+            float minDistance = std::numeric_limits<float>::max();
+            for (size_t k = 0; k < kSubCentroidCount; ++k) {
+                if (dists[k] < minDistance) {
+                    minDistance = dists[k];
+                    nearest = k;
+                }
+            }
+            code[j] = static_cast<u_int8_t>(nearest);
+        }
+    }
+
+    // lut[j * kSubCentroidCount + k] is the squared distance from slice j of the residual to sub-centroid k
+    void calcLookupTable(const float *residual, float *lut) const {
+        for (size_t j = 0; j < subQuantizerCount; ++j) {
+            fvecL2sqrNy(residual + j * subDimension, getSubCentroid(j, 0), kSubCentroidCount, subDimension,
+                        lut + j * kSubCentroidCount);
+        }
+    }
+
+    void scanCluster(const u_int32_t clusterId, const float *lut, TopK<u_int32_t> &topK) const {
+        forEachCodePage(clusterId, [&](const u_int8_t *codes, const u_int32_t *pageIds, const size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                topK.push(pqAdcDistance(lut, codes + i * subQuantizerCount, subQuantizerCount), pageIds[i]);
+            }
+        });
+    }
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "calc_distance.hpp"
+#include "clustering.hpp"
+#include "ivf_code_index.hpp"
+#include "top_k.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+
+enum class ScalarQuantizerType : u_int32_t {
+    // one byte per component, linear in the per-cluster range of the component
+    kSQ8 = 0,
+    // IEEE half precision per component
+    kFP16 = 1
+};
+
+// IVF index storing cluster contents as scalar quantized codes on DataPage<u_int8_t> pages. kSQ8 ranges are
+// trained per cluster and dimension from the learn vectors of the cluster and kept next to its centroid.
+// Distances are computed straight from the codes, a scan reads 4x (kSQ8) or 2x (kFP16) less than PaseIVFFlat.
+template<typename T>
+struct PaseIVFSQ : IVFCodeIndex {
+    const ScalarQuantizerType quantizerType;
+
+    // kSQ8 component i of cluster c decodes to vmins[c * dimension + i] + code * scales[c * dimension + i]
+    std::vector<float> vmins;
+    std::vector<float> scales;
+
+    PaseIVFSQ(size_t dimension, size_t clusterCount, ScalarQuantizerType quantizerType = ScalarQuantizerType::kSQ8)
+            : IVFCodeIndex(dimension, clusterCount,
+                           quantizerType == ScalarQuantizerType::kSQ8 ? dimension : dimension * sizeof(u_int16_t)),
+              quantizerType(quantizerType) {
+    }
+
+    void buildIndex(const std::vector<std::vector<T>> &learnVectors,
+                    const std::vector<std::vector<T>> &baseVectors,
+                    const std::vector<u_int32_t> &ids,
+                    const size_t maxEpochs, const float tol) {
+        train(learnVectors, maxEpochs, tol);
+        add(baseVectors, ids);
+    }
+
+    // learns centroids and the per cluster ranges, clusters without learn vectors use the global range
+    void train(const std::vector<std::vector<T>> &learnVectors, const size_t maxEpochs, const float tol) {
+        Timer t("Train");
+        if (learnVectors.size() < clusterCount) {
+            throw std::logic_error("Not enough learn vectors to train the quantizer.");
+        }
+        IVFFlatClusterData<T> data = kMeans(learnVectors, clusterCount, maxEpochs, tol);
+        setCentroids(data);
+
+        std::vector<float> globalMin(dimension, std::numeric_limits<float>::max());
+        std::vector<float> globalMax(dimension, std::numeric_limits<float>::lowest());
+        std::vector<float> vmaxs(clusterCount * dimension, std::numeric_limits<float>::lowest());
+        vmins.assign(clusterCount * dimension, std::numeric_limits<float>::max());
+        for (size_t c = 0; c < clusterCount; ++c) {
+            for (const std::vector<T> &vec: data.clusters[c]) {
+                for (size_t i = 0; i < dimension; ++i) {
+                    auto x = static_cast<float>(vec[i]);
+                    vmins[c * dimension + i] = std::min(vmins[c * dimension + i], x);
+                    vmaxs[c * dimension + i] = std::max(vmaxs[c * dimension + i], x);
+                    globalMin[i] = std::min(globalMin[i], x);
+                    globalMax[i] = std::max(globalMax[i], x);
+                }
+            }
+        }
+        scales.assign(clusterCount * dimension, 0);
+        for (size_t c = 0; c < clusterCount; ++c) {
+            const bool isEmpty = data.clusters[c].empty();
+            for (size_t i = 0; i < dimension; ++i) {
+                float &vmin = vmins[c * dimension + i];
+                float vmax = vmaxs[c * dimension + i];
+                if (isEmpty) {
+                    vmin = globalMin[i];
+                    vmax = globalMax[i];
+                }
+                scales[c * dimension + i] = (vmax - vmin) / 255;
+            }
+        }
+    }
+
+    // encodes base vectors in parallel and appends the codes to the pages of their clusters
+    void add(const std::vector<std::vector<T>> &points, const std::vector<u_int32_t> &ids) {
+        Timer t("Adding base vectors");
+        addCodes(points, ids, [this](const float *point, u_int32_t clusterId, u_int8_t *code) {
+            encode(point, clusterId, code);
+        });
+    }
+
+    // Writes up to neighbourCount ids and squared L2 distances to the decoded vectors into caller-owned
+    // buffers and returns how many were found. Runs on the calling thread, scratch space is thread local.
+    size_t searchInto(const T *query, const size_t queryDimension, const size_t neighbourCount,
+                      const size_t clusterCountToSelect, u_int32_t *ids, float *distances) const {
+        if (queryDimension != dimension) {
+            throw std::invalid_argument("Query dimension does not match index dimension.");
+        }
+        const size_t probeCount = std::min(clusterCountToSelect, centroids.size());
+        if (neighbourCount == 0 || probeCount == 0) {
+            return 0;
+        }
+
+        thread_local std::vector<float> queryVector;
+        thread_local std::vector<float> probeDistances;
+        thread_local std::vector<u_int32_t> probeClusters;
+        queryVector.assign(query, query + dimension);
+        const size_t selectedCount = selectClusters(queryVector.data(), probeCount, probeDistances, probeClusters);
+
+        TopK<u_int32_t> topK(distances, ids, neighbourCount);
+        for (size_t i = 0; i < selectedCount; ++i) {
+            scanCluster(queryVector.data(), probeClusters[i], topK);
+        }
+        topK.finalize();
+        return topK.size();
+    }
+
+    std::vector<u_int32_t>
+    findNearestVectorIds(const std::vector<T> &vec, const size_t neighbourCount,
+                         const size_t clusterCountToSelect) const {
+        std::vector<u_int32_t> ids(neighbourCount);
+        std::vector<float> distances(neighbourCount);
+        ids.resize(searchInto(vec.data(), vec.size(), neighbourCount, clusterCountToSelect, ids.data(),
+                              distances.data()));
+        return ids;
+    }
+
+private:
+    // values outside of the trained range are clamped to it
+    void encode(const float *vec, u_int32_t clusterId, u_int8_t *code) const {
+        if (quantizerType == ScalarQuantizerType::kFP16) {
+            auto *halfCode = reinterpret_cast<u_int16_t *>(code);
+            for (size_t i = 0; i < dimension; ++i) {
+                halfCode[i] = floatToHalf(vec[i]);
+            }
+            return;
+        }
+        const float *vmin = vmins.data() + clusterId * dimension;
+        const float *scale = scales.data() + clusterId * dimension;
+        for (size_t i = 0; i < dimension; ++i) {
+            float level = scale[i] > 0 ? std::round((vec[i] - vmin[i]) / scale[i]) : 0;
+            code[i] = static_cast<u_int8_t>(std::clamp(level, 0.0f, 255.0f));
+        }
+    }
+
+    void scanCluster(const float *query, u_int32_t clusterId, TopK<u_int32_t> &topK) const {
+        const float *vmin = vmins.data() + clusterId * dimension;
+        const float *scale = scales.data() + clusterId * dimension;
+        forEachCodePage(clusterId, [&](const u_int8_t *codes, const u_int32_t *pageIds, const size_t count) {
+            if (quantizerType == ScalarQuantizerType::kSQ8) {
+                for (size_t i = 0; i < count; ++i) {
+                    topK.push(sq8L2sqr(query, codes + i * codeSize, vmin, scale, dimension), pageIds[i]);
+                }
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    const auto *halfCode = reinterpret_cast<const u_int16_t *>(codes + i * codeSize);
+                    topK.push(fp16L2sqr(query, halfCode, dimension), pageIds[i]);
+                }
+            }
+        });
+    }
+};
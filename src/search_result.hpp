@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <cstddef>
+#include <sys/types.h>
+
+
+static constexpr u_int32_t kInvalidVectorId = std::numeric_limits<u_int32_t>::max();
+
+// Row-major queryCount x neighbourCount matrix of ids and distances.
+// Rows with less than neighbourCount hits are padded with kInvalidVectorId and +inf.
+struct BatchSearchResult {
+    size_t queryCount = 0;
+    size_t neighbourCount = 0;
+    std::vector<u_int32_t> ids;
+    std::vector<float> distances;
+
+    BatchSearchResult() = default;
+
+    BatchSearchResult(size_t queryCount, size_t neighbourCount)
+            : queryCount(queryCount), neighbourCount(neighbourCount),
+              ids(queryCount * neighbourCount, kInvalidVectorId),
+              distances(queryCount * neighbourCount, std::numeric_limits<float>::infinity()) {}
+
+    inline u_int32_t *getIds(size_t queryIdx) {
+        return ids.data() + queryIdx * neighbourCount;
+    }
+
+    inline const u_int32_t *getIds(size_t queryIdx) const {
+        return ids.data() + queryIdx * neighbourCount;
+    }
+
+    inline float *getDistances(size_t queryIdx) {
+        return distances.data() + queryIdx * neighbourCount;
+    }
+
+    inline const float *getDistances(size_t queryIdx) const {
+        return distances.data() + queryIdx * neighbourCount;
+    }
+};
+
+// Hits of range searches, the hits of query q are [offsets[q], offsets[q + 1]) of ids and distances.
+struct RangeSearchResult {
+    std::vector<size_t> offsets{0};
+    std::vector<u_int32_t> ids;
+    std::vector<float> distances;
+
+    [[nodiscard]] inline size_t getQueryCount() const {
+        return offsets.size() - 1;
+    }
+
+    [[nodiscard]] inline size_t getCount(size_t queryIdx) const {
+        return offsets[queryIdx + 1] - offsets[queryIdx];
+    }
+
+    [[nodiscard]] inline const u_int32_t *getIds(size_t queryIdx) const {
+        return ids.data() + offsets[queryIdx];
+    }
+
+    [[nodiscard]] inline const float *getDistances(size_t queryIdx) const {
+        return distances.data() + offsets[queryIdx];
+    }
+};
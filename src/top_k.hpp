@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <sys/types.h>
+
+
+// Bounded selection of the `capacity` smallest distances over caller-owned storage.
+// Small capacities keep distances sorted and insert with a branchless position count, larger ones use
+// a max-heap on the distance. finalize() leaves both sorted in ascending order of distance; no pushes after it.
+template<typename Label = u_int32_t>
+class TopK {
+public:
+    static constexpr size_t kSortedLimit = 100;
+
+    TopK(float *distances, Label *labels, size_t capacity, size_t count = 0)
+            : distances(distances), labels(labels), capacity(capacity), count(count),
+              sorted(capacity <= kSortedLimit) {}
+
+    inline bool push(const float dist, const Label &label) {
+        if (count == capacity) {
+            if (capacity == 0 || !(dist < worst())) {
+                return false;
+            }
+            if (sorted) {
+                insertSorted(count - 1, dist, label);
+            } else {
+                replaceTop(dist, label);
+            }
+            return true;
+        }
+        if (sorted) {
+            insertSorted(count++, dist, label);
+        } else {
+            siftUp(count++, dist, label);
+        }
+        return true;
+    }
+
+    // distance a new element has to beat to get in
+    [[nodiscard]] inline float threshold() const {
+        return count == capacity && capacity != 0 ? worst() : std::numeric_limits<float>::infinity();
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return count;
+    }
+
+    [[nodiscard]] inline bool full() const {
+        return count == capacity;
+    }
+
+    void finalize() {
+        if (sorted) {
+            return;
+        }
+        // in-place heap sort: move the current maximum behind the shrinking heap
+        for (size_t last = count; last > 1; --last) {
+            std::swap(distances[0], distances[last - 1]);
+            std::swap(labels[0], labels[last - 1]);
+            siftDown(0, last - 1);
+        }
+        sorted = true;
+    }
+
+    [[nodiscard]] inline const float *getDistances() const {
+        return distances;
+    }
+
+    [[nodiscard]] inline const Label *getLabels() const {
+        return labels;
+    }
+
+private:
+    float *distances;
+    Label *labels;
+    size_t capacity;
+    size_t count;
+    bool sorted;
+
+    [[nodiscard]] inline float worst() const {
+        return sorted ? distances[count - 1] : distances[0];
+    }
+
+    // inserts into the sorted prefix of length `length`, the element at `length` is dropped
+    inline void insertSorted(const size_t length, const float dist, const Label &label) {
+        // counts without branches, vectorizes for small k
+        size_t pos = 0;
+        for (size_t i = 0; i < length; ++i) {
+            pos += distances[i] <= dist;
+        }
+        std::copy_backward(distances + pos, distances + length, distances + length + 1);
+        std::copy_backward(labels + pos, labels + length, labels + length + 1);
+        distances[pos] = dist;
+        labels[pos] = label;
+    }
+
+    inline void siftUp(size_t pos, const float dist, const Label &label) {
+        while (pos > 0) {
+            size_t parent = (pos - 1) / 2;
+            if (!(distances[parent] < dist)) {
+                break;
+            }
+            distances[pos] = distances[parent];
+            labels[pos] = labels[parent];
+            pos = parent;
+        }
+        distances[pos] = dist;
+        labels[pos] = label;
+    }
+
+    inline void replaceTop(const float dist, const Label &label) {
+        distances[0] = dist;
+        labels[0] = label;
+        siftDown(0, count);
+    }
+
+    inline void siftDown(size_t pos, const size_t heapSize) {
+        const float dist = distances[pos];
+        Label label = labels[pos];
+        while (true) {
+            size_t child = 2 * pos + 1;
+            if (child >= heapSize) {
+                break;
+            }
+            if (child + 1 < heapSize && distances[child] < distances[child + 1]) {
+                ++child;
+            }
+            if (!(dist < distances[child])) {
+                break;
+            }
+            distances[pos] = distances[child];
+            labels[pos] = labels[child];
+            pos = child;
+        }
+        distances[pos] = dist;
+        labels[pos] = label;
+    }
+};
@@ -0,0 +1,29 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+namespace {
+    std::atomic<size_t> allocationCount{0};
+}
+
+size_t getAllocationCount() {
+    return allocationCount.load();
+}
+
+// counts heap allocations of the whole binary
+void *operator new(size_t size) {
+    ++allocationCount;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
@@ -0,0 +1,108 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <numeric>
+#include <random>
+#include <vector>
+
+
+namespace {
+    // tight groups of vectors around random centers
+    std::vector<std::vector<float>> generateGroupedVectors(size_t groupCount, size_t groupSize, size_t dimension,
+                                                           u_int32_t seed) {
+        const auto centers = generateRandomVectors(groupCount, dimension, seed);
+        std::mt19937 generator(seed);
+        std::normal_distribution<float> noise(0.0f, 0.01f);
+        std::vector<std::vector<float>> result;
+        for (size_t i = 0; i < groupCount * groupSize; ++i) {
+            std::vector<float> vec = centers[i % groupCount];
+            for (float &x: vec) {
+                x += noise(generator);
+            }
+            result.push_back(std::move(vec));
+        }
+        return result;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(AdaptiveProbe)
+
+    BOOST_AUTO_TEST_CASE(StopsOnDistanceBound) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 16;
+        const size_t nearestVectorsCount = 5;
+
+        const auto baseData = generateGroupedVectors(clusterCount, 200, dimension, 81);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 20, 1e-5);
+
+        const std::vector<std::vector<float>> testData(baseData.begin(), baseData.begin() + 50);
+        const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+
+        ProbePolicy exhaustive;
+        exhaustive.minClusterCount = clusterCount;
+        ProbePolicy adaptive;
+        adaptive.stopRatio = 0.5f;
+        size_t exhaustiveProbes = 0;
+        size_t adaptiveProbes = 0;
+        size_t hits = 0;
+        for (size_t i = 0; i < testData.size(); ++i) {
+            size_t probedClusterCount = 0;
+            BOOST_TEST(pase.searchAdaptive(testData[i].data(), dimension, nearestVectorsCount, exhaustive,
+                                           foundIds.data(), distances.data(), &probedClusterCount) ==
+                       nearestVectorsCount);
+            BOOST_TEST(foundIds == answers[i]);
+            exhaustiveProbes += probedClusterCount;
+
+            BOOST_TEST(pase.searchAdaptive(testData[i].data(), dimension, nearestVectorsCount, adaptive,
+                                           foundIds.data(), distances.data(), &probedClusterCount) ==
+                       nearestVectorsCount);
+            adaptiveProbes += probedClusterCount;
+            hits += foundIds == answers[i];
+        }
+        // the groups are far apart, the query group is enough
+        BOOST_TEST(exhaustiveProbes == testData.size() * clusterCount);
+        BOOST_TEST(adaptiveProbes < testData.size() * 2);
+        BOOST_TEST(hits == testData.size());
+    }
+
+    BOOST_AUTO_TEST_CASE(CollectsNeighbourCountFromSmallClusters) {
+        const size_t dimension = 8;
+        const size_t clusterCount = 10;
+
+        const auto baseData = generateRandomVectors(300, dimension, 82);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        // the closest cluster holds far fewer than 100 vectors
+        const size_t nearestVectorsCount = 100;
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        ProbePolicy policy;
+        policy.maxClusterCount = 1;
+        policy.maxVectorCount = 1;
+        size_t probedClusterCount = 0;
+        BOOST_TEST(pase.searchAdaptive(baseData[0].data(), dimension, nearestVectorsCount, policy, foundIds.data(),
+                                       distances.data(), &probedClusterCount) == nearestVectorsCount);
+        BOOST_TEST(probedClusterCount > 1);
+        BOOST_TEST(probedClusterCount < clusterCount);
+        BOOST_TEST(distances[0] == 0.0f);
+
+        // search selects more clusters instead of failing, an index with fewer vectors returns all of them
+        BOOST_TEST(pase.findNearestVectorIds(baseData[0], nearestVectorsCount, 1).size() == nearestVectorsCount);
+        BOOST_TEST(pase.findNearestVectorIds(baseData[0], 1000, 1).size() == baseData.size());
+        foundIds.resize(1000);
+        distances.resize(1000);
+        BOOST_TEST(pase.searchAdaptive(baseData[0].data(), dimension, 1000, policy, foundIds.data(),
+                                       distances.data(), &probedClusterCount) == baseData.size());
+        BOOST_TEST(probedClusterCount == clusterCount);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
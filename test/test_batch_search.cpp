@@ -0,0 +1,132 @@
+#include "pase.hpp"
+#include "utils.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <numeric>
+
+
+BOOST_AUTO_TEST_SUITE(BatchSearch)
+
+    BOOST_AUTO_TEST_CASE(MatchesBruteForceOnFullScan) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 20;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 50;
+
+        const auto baseData = generateRandomVectors(5000, dimension, 1);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 2);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+        const auto queries = flatten(testData);
+        BatchSearchResult result = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount,
+                                                    clusterCount);
+
+        BOOST_TEST(result.queryCount == queryVectorCount);
+        BOOST_TEST(result.neighbourCount == nearestVectorsCount);
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            const u_int32_t *foundIds = result.getIds(i);
+            const float *distances = result.getDistances(i);
+            BOOST_TEST(std::is_sorted(distances, distances + nearestVectorsCount));
+            BOOST_TEST(std::vector<u_int32_t>(foundIds, foundIds + nearestVectorsCount) == answers[i]);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(FindsIndexedVectors) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 30;
+        const size_t queryVectorCount = 200;
+
+        const auto baseData = generateRandomVectors(3000, dimension, 3);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 1000);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const auto queries = flatten(std::vector<std::vector<float>>(baseData.begin(),
+                                                                     baseData.begin() + queryVectorCount));
+        BatchSearchResult result = pase.searchBatch(queries.data(), queryVectorCount, 5, 3);
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            BOOST_TEST(result.getIds(i)[0] == ids[i]);
+            BOOST_TEST(result.getDistances(i)[0] == 0.0f);
+            BOOST_TEST(result.getIds(i)[0] == pase.findNearestVectorIds(baseData[i], 5, 3)[0]);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(ClusterMajorMatchesQueryMajor) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 25;
+        const size_t nearestVectorsCount = 20;
+        const size_t queryVectorCount = 103;
+
+        const auto baseData = generateRandomVectors(4000, dimension, 4);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 5);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const auto queries = flatten(testData);
+        BatchSearchResult queryMajor = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount, 4,
+                                                        BatchSearchMode::kQueryMajor);
+        BatchSearchResult clusterMajor = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount, 4,
+                                                          BatchSearchMode::kClusterMajor);
+        BOOST_TEST(queryMajor.ids == clusterMajor.ids);
+        for (size_t i = 0; i < queryMajor.distances.size(); ++i) {
+            BOOST_TEST(queryMajor.distances[i] == clusterMajor.distances[i], boost::test_tools::tolerance(1e-4f));
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(BlockedPagesMatchBruteForce) {
+        const size_t dimension = 24;
+        const size_t clusterCount = 10;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 30;
+
+        const auto baseData = generateRandomVectors(3001, dimension, 6);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 7);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount, PageLayout::kBlocked);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+        const auto queries = flatten(testData);
+        for (BatchSearchMode mode: {BatchSearchMode::kQueryMajor, BatchSearchMode::kClusterMajor}) {
+            BatchSearchResult result = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount,
+                                                        clusterCount, mode);
+            for (size_t i = 0; i < queryVectorCount; ++i) {
+                const u_int32_t *foundIds = result.getIds(i);
+                BOOST_TEST(std::vector<u_int32_t>(foundIds, foundIds + nearestVectorsCount) == answers[i]);
+            }
+        }
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            BOOST_TEST(pase.findNearestVectorIds(testData[i], nearestVectorsCount, clusterCount) == answers[i]);
+            auto vectors = pase.findNearestVectors(testData[i], nearestVectorsCount, clusterCount);
+            BOOST_TEST(vectors[0] == baseData[answers[i][0]]);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(UnbuiltIndexFindsNothing) {
+        const size_t dimension = 16;
+        const size_t queryVectorCount = 5;
+
+        const auto queries = flatten(generateRandomVectors(queryVectorCount, dimension, 8));
+        PaseIVFFlat<float> pase(dimension, 4);
+        for (BatchSearchMode mode: {BatchSearchMode::kQueryMajor, BatchSearchMode::kClusterMajor}) {
+            BatchSearchResult result = pase.searchBatch(queries.data(), queryVectorCount, 3, 2, mode);
+            BOOST_TEST(result.queryCount == queryVectorCount);
+            BOOST_TEST(result.ids == std::vector<u_int32_t>(queryVectorCount * 3, kInvalidVectorId));
+        }
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,126 @@
+#include "epoch.hpp"
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(ConcurrentAccess)
+
+    BOOST_AUTO_TEST_CASE(PinnedEpochsDelayReclamation) {
+        EpochManager epochs;
+        std::vector<BlockNumber> released;
+        auto release = [&released](BlockNumber page) {
+            released.push_back(page);
+        };
+
+        epochs.retire({1, 2});
+        BOOST_TEST(epochs.reclaim(release) == 2);
+        {
+            EpochGuard guard(epochs);
+            epochs.retire({3});
+            {
+                EpochGuard nested(epochs);
+            }
+            BOOST_TEST(epochs.reclaim(release) == 0);
+
+            // a reader that pins on another thread after the retirement does not hold the page back
+            std::thread reader([&epochs]() {
+                EpochGuard readerGuard(epochs);
+            });
+            reader.join();
+            BOOST_TEST(epochs.getRetiredPageCount() == 1);
+        }
+        BOOST_TEST(epochs.reclaim(release) == 1);
+        BOOST_TEST((released == std::vector<BlockNumber>{1, 2, 3}));
+
+        // a reader pinned on another thread holds back pages retired while it reads
+        std::atomic<bool> pinned{false};
+        std::atomic<bool> done{false};
+        std::thread reader([&]() {
+            EpochGuard readerGuard(epochs);
+            pinned = true;
+            while (!done) {
+                std::this_thread::yield();
+            }
+        });
+        while (!pinned) {
+            std::this_thread::yield();
+        }
+        epochs.retire({4});
+        BOOST_TEST(epochs.reclaim(release) == 0);
+        done = true;
+        reader.join();
+        BOOST_TEST(epochs.reclaim(release) == 1);
+    }
+
+    BOOST_AUTO_TEST_CASE(SearchesRunDuringWrites) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 8;
+        const size_t stableCount = 500;
+
+        const auto baseData = generateRandomVectors(4000, dimension, 61);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        for (PageLayout pageLayout: {PageLayout::kRowMajor, PageLayout::kBlocked}) {
+            PaseIVFFlat<float> pase(dimension, clusterCount, pageLayout);
+            pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+
+            // vectors [0, stableCount) are never removed, every search for one of them has to find it
+            std::atomic<bool> stop{false};
+            std::atomic<size_t> searchCount{0};
+            std::atomic<size_t> missCount{0};
+            std::vector<std::thread> readers;
+            for (size_t r = 0; r < 3; ++r) {
+                readers.emplace_back([&, r]() {
+                    u_int32_t foundId;
+                    float distance;
+                    for (size_t i = r; !stop; i = (i + 7) % stableCount) {
+                        size_t found = pase.searchInto(baseData[i].data(), dimension, 1, clusterCount, &foundId,
+                                                       &distance);
+                        if (found != 1 || foundId != i || distance != 0.0f) {
+                            ++missCount;
+                        }
+                        ++searchCount;
+                    }
+                });
+            }
+
+            u_int32_t nextId = 100000;
+            for (size_t round = 0; round < 6; ++round) {
+                const auto insertedData = generateRandomVectors(400, dimension, 62 + round);
+                std::vector<u_int32_t> insertedIds(insertedData.size());
+                std::iota(insertedIds.begin(), insertedIds.end(), nextId);
+                pase.insertBatch(insertedData, insertedIds);
+                for (size_t i = 0; i < insertedIds.size(); i += 2) {
+                    pase.remove(insertedIds[i]);
+                }
+                for (size_t i = stableCount + round; i < baseData.size(); i += 6) {
+                    pase.remove(ids[i]);
+                }
+                pase.vacuum(clusterCount / 2);
+                nextId += insertedIds.size();
+            }
+            pase.vacuum();
+            stop = true;
+            for (std::thread &reader: readers) {
+                reader.join();
+            }
+            BOOST_TEST(searchCount > 0);
+            BOOST_TEST(missCount == 0);
+
+            // writes keep working once the readers are gone
+            pase.insert(baseData[0], 0);
+            u_int32_t foundIds[2];
+            float distances[2];
+            BOOST_TEST(pase.searchInto(baseData[0].data(), dimension, 2, clusterCount, foundIds, distances) == 2);
+            BOOST_TEST(distances[1] == 0.0f);
+        }
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
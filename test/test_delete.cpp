@@ -0,0 +1,150 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <filesystem>
+#include <numeric>
+#include <vector>
+
+
+namespace {
+    // searchInto and both batch modes return the exact neighbours among the live vectors
+    void checkSearch(const PaseIVFFlat<float> &pase, const std::vector<std::vector<float>> &liveData,
+                     const std::vector<u_int32_t> &liveIds, const std::vector<std::vector<float>> &testData,
+                     const size_t nearestVectorsCount) {
+        const size_t dimension = pase.dimension;
+        auto answers = bruteForceSearch(liveData, testData, nearestVectorsCount);
+        for (auto &answer: answers) {
+            for (u_int32_t &id: answer) {
+                id = liveIds[id];
+            }
+        }
+
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        for (size_t i = 0; i < testData.size(); ++i) {
+            pase.searchInto(testData[i].data(), dimension, nearestVectorsCount, pase.clusterCount, foundIds.data(),
+                            distances.data());
+            BOOST_TEST(foundIds == answers[i]);
+        }
+        const std::vector<float> queries = flatten(testData);
+        for (BatchSearchMode mode: {BatchSearchMode::kQueryMajor, BatchSearchMode::kClusterMajor}) {
+            BatchSearchResult result = pase.searchBatch(queries.data(), testData.size(), nearestVectorsCount,
+                                                        pase.clusterCount, mode);
+            for (size_t i = 0; i < testData.size(); ++i) {
+                BOOST_TEST(std::vector<u_int32_t>(result.getIds(i), result.getIds(i) + nearestVectorsCount) ==
+                           answers[i]);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(Deletion)
+
+    BOOST_AUTO_TEST_CASE(RemovedVectorsAreNotFound) {
+        const size_t dimension = 24;
+        const size_t clusterCount = 8;
+        const size_t nearestVectorsCount = 10;
+
+        const auto baseData = generateRandomVectors(5000, dimension, 51);
+        const auto testData = generateRandomVectors(20, dimension, 52);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        for (PageLayout pageLayout: {PageLayout::kRowMajor, PageLayout::kBlocked}) {
+            PaseIVFFlat<float> pase(dimension, clusterCount, pageLayout);
+            pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+            const size_t pageCount = pase.pageArena.getPageCount();
+
+            // two of every three vectors go away
+            std::vector<std::vector<float>> liveData;
+            std::vector<u_int32_t> liveIds;
+            for (size_t i = 0; i < baseData.size(); ++i) {
+                if (i % 3 == 0) {
+                    liveData.push_back(baseData[i]);
+                    liveIds.push_back(ids[i]);
+                } else {
+                    BOOST_TEST(pase.remove(ids[i]));
+                }
+            }
+            BOOST_TEST(!pase.remove(ids[1]));
+            BOOST_TEST(!pase.remove(100000));
+            checkSearch(pase, liveData, liveIds, testData, nearestVectorsCount);
+
+            BOOST_TEST(pase.vacuum(1) > 0);
+            pase.vacuum();
+            BOOST_TEST(pase.pageArena.getFreePageCount() >= pageCount / 2);
+            BOOST_TEST(pase.vacuum() == 0);
+            const size_t vacuumedPageCount = pase.pageArena.getPageCount();
+            checkSearch(pase, liveData, liveIds, testData, nearestVectorsCount);
+
+            // vacuum moved vectors, the locator follows them
+            std::vector<std::vector<float>> keptData;
+            std::vector<u_int32_t> keptIds;
+            for (size_t i = 0; i < liveIds.size(); ++i) {
+                if (i % 2 == 0) {
+                    BOOST_TEST(pase.remove(liveIds[i]));
+                } else {
+                    keptData.push_back(liveData[i]);
+                    keptIds.push_back(liveIds[i]);
+                }
+            }
+            // appends take released pages before growing the arena, inserted vectors can be removed
+            const auto insertedData = generateRandomVectors(300, dimension, 55);
+            std::vector<u_int32_t> insertedIds(insertedData.size());
+            std::iota(insertedIds.begin(), insertedIds.end(), 10000);
+            pase.insertBatch(insertedData, insertedIds);
+            BOOST_TEST(pase.remove(insertedIds[0]));
+            keptData.insert(keptData.end(), insertedData.begin() + 1, insertedData.end());
+            keptIds.insert(keptIds.end(), insertedIds.begin() + 1, insertedIds.end());
+            BOOST_TEST(pase.pageArena.getPageCount() == vacuumedPageCount);
+            checkSearch(pase, keptData, keptIds, testData, nearestVectorsCount);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(TombstonesSurviveSaveAndLoad) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 4;
+        const size_t nearestVectorsCount = 5;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_delete.idx").string();
+
+        const auto baseData = generateRandomVectors(3000, dimension, 53);
+        const auto testData = generateRandomVectors(10, dimension, 54);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        std::vector<std::vector<float>> liveData;
+        std::vector<u_int32_t> liveIds;
+        {
+            PaseIVFFlat<float> pase(dimension, clusterCount);
+            pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+            for (size_t i = 0; i < baseData.size(); ++i) {
+                if (i % 2 == 0) {
+                    pase.remove(ids[i]);
+                } else {
+                    liveData.push_back(baseData[i]);
+                    liveIds.push_back(ids[i]);
+                }
+            }
+            // the tail pages of one cluster are released and saved unlinked
+            pase.vacuum(1);
+            pase.save(path);
+        }
+
+        std::unique_ptr<PaseIVFFlat<float>> loaded = PaseIVFFlat<float>::load(path);
+        checkSearch(*loaded, liveData, liveIds, testData, nearestVectorsCount);
+        std::unique_ptr<PaseIVFFlat<float>> mapped = PaseIVFFlat<float>::map(path);
+        checkSearch(*mapped, liveData, liveIds, testData, nearestVectorsCount);
+        BOOST_CHECK_THROW(mapped->remove(liveIds[0]), std::logic_error);
+
+        BOOST_TEST(loaded->pageArena.getFreePageCount() != 0);
+        BOOST_TEST(loaded->vacuum() != 0);
+        BOOST_TEST(loaded->remove(liveIds[0]));
+        BOOST_TEST(!loaded->remove(ids[0]));
+        liveData.erase(liveData.begin());
+        liveIds.erase(liveIds.begin());
+        checkSearch(*loaded, liveData, liveIds, testData, nearestVectorsCount);
+        std::filesystem::remove(path);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,216 @@
+#include "calc_distance.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <random>
+#include <vector>
+
+
+namespace {
+    const SimdLevel kAllLevels[] = {SimdLevel::kScalar, SimdLevel::kSSE, SimdLevel::kAVX2, SimdLevel::kAVX512,
+                                    SimdLevel::kNEON};
+
+    std::vector<const DistanceKernels *> getSupportedKernels() {
+        std::vector<const DistanceKernels *> result;
+        for (SimdLevel level: kAllLevels) {
+            if (const DistanceKernels *kernels = findDistanceKernels(level)) {
+                result.push_back(kernels);
+            }
+        }
+        return result;
+    }
+
+    std::vector<float> generateBuffer(std::mt19937 &gen, size_t size) {
+        std::uniform_real_distribution<float> dist(-10, 10);
+        std::vector<float> result(size);
+        for (float &x: result) {
+            x = dist(gen);
+        }
+        return result;
+    }
+
+    const size_t kDimensions[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+                                  24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 128, 960};
+}
+
+BOOST_AUTO_TEST_SUITE(DistanceKernelDispatch)
+
+    BOOST_AUTO_TEST_CASE(SelectsBestSupportedLevel) {
+        std::vector<const DistanceKernels *> supported = getSupportedKernels();
+        BOOST_TEST((supported.front()->level == SimdLevel::kScalar));
+        const DistanceKernels &selected = getDistanceKernels();
+        BOOST_TEST(&selected == &selectDistanceKernels());
+        for (const DistanceKernels *kernels: supported) {
+            if (kernels->level != SimdLevel::kNEON && selected.level != SimdLevel::kNEON) {
+                BOOST_TEST(static_cast<u_int32_t>(kernels->level) <= static_cast<u_int32_t>(selected.level));
+            }
+        }
+        BOOST_TEST_MESSAGE("Selected distance kernels: " << selected.name);
+    }
+
+    BOOST_AUTO_TEST_CASE(FloatKernelsMatchReference) {
+        std::mt19937 gen(3);
+        const auto tolerance = boost::test_tools::tolerance(1e-4f);
+        for (const DistanceKernels *kernels: getSupportedKernels()) {
+            BOOST_TEST_CONTEXT("kernels " << kernels->name) {
+                for (size_t d: kDimensions) {
+                    BOOST_TEST_CONTEXT("dimension " << d) {
+                        for (size_t offset: {0, 1, 3}) {
+                            std::vector<float> buffer = generateBuffer(gen, offset + 5 * d);
+                            const float *x = buffer.data() + offset;
+                            const float *y[4] = {x + d, x + 2 * d, x + 3 * d, x + 4 * d};
+
+                            BOOST_TEST(kernels->l2sqr(x, y[0], d) == fvecL2sqrRef(x, y[0], d), tolerance);
+                            BOOST_TEST(kernels->innerProduct(x, y[0], d) == fvecInnerProductRef(x, y[0], d),
+                                       boost::test_tools::tolerance(1e-3f));
+                            BOOST_TEST(kernels->normL2sqr(x, d) == fvecNormL2sqrRef(x, d), tolerance);
+
+                            float dis[4];
+                            kernels->l2sqrBatch4(x, y[0], y[1], y[2], y[3], d, dis);
+                            for (size_t j = 0; j < 4; ++j) {
+                                BOOST_TEST(dis[j] == fvecL2sqrRef(x, y[j], d), tolerance);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(OneToManyKernelsMatchReference) {
+        std::mt19937 gen(6);
+        for (const DistanceKernels *kernels: getSupportedKernels()) {
+            BOOST_TEST_CONTEXT("kernels " << kernels->name) {
+                for (size_t d: {1, 3, 4, 7, 16, 17, 33, 128}) {
+                    for (size_t n: {0, 1, 3, 4, 5, 8, 11}) {
+                        BOOST_TEST_CONTEXT("dimension " << d << ", vectors " << n) {
+                            std::vector<float> buffer = generateBuffer(gen, 1 + d + n * d);
+                            const float *x = buffer.data() + 1;
+                            const float *y = x + d;
+                            std::vector<float> expected(n + 1), actual(n + 1, -1);
+                            fvecL2sqrNyRef(x, y, n, d, expected.data());
+                            kernels->l2sqrNy(x, y, n, d, actual.data());
+                            for (size_t j = 0; j < n; ++j) {
+                                BOOST_TEST(actual[j] == expected[j], boost::test_tools::tolerance(1e-4f));
+                            }
+                            fvecInnerProductNyRef(x, y, n, d, expected.data());
+                            kernels->innerProductNy(x, y, n, d, actual.data());
+                            for (size_t j = 0; j < n; ++j) {
+                                BOOST_TEST(actual[j] == expected[j], boost::test_tools::tolerance(1e-3f));
+                            }
+                            // nothing is written past the last vector
+                            BOOST_TEST(actual[n] == -1.0f);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(IntegerKernelsMatchReference) {
+        std::mt19937 gen(7);
+        for (const DistanceKernels *kernels: getSupportedKernels()) {
+            BOOST_TEST_CONTEXT("kernels " << kernels->name) {
+                for (size_t d: kDimensions) {
+                    BOOST_TEST_CONTEXT("dimension " << d) {
+                        // extreme values included, the byte kernels must not saturate
+                        std::vector<u_int8_t> ux(d), uy(d);
+                        std::vector<int8_t> sx(d), sy(d);
+                        std::vector<int16_t> wx(d), wy(d);
+                        for (size_t i = 0; i < d; ++i) {
+                            ux[i] = i % 5 == 0 ? 255 : static_cast<u_int8_t>(gen());
+                            uy[i] = i % 5 == 0 ? 0 : static_cast<u_int8_t>(gen());
+                            sx[i] = i % 5 == 0 ? -128 : static_cast<int8_t>(gen());
+                            sy[i] = i % 5 == 0 ? 127 : static_cast<int8_t>(gen());
+                            wx[i] = i % 5 == 0 ? -32768 : static_cast<int16_t>(gen());
+                            wy[i] = i % 5 == 0 ? 32767 : static_cast<int16_t>(gen());
+                        }
+                        BOOST_TEST(kernels->u8L2sqr(ux.data(), uy.data(), d) == u8L2sqrRef(ux.data(), uy.data(), d));
+                        BOOST_TEST(kernels->u8InnerProduct(ux.data(), uy.data(), d) ==
+                                   u8InnerProductRef(ux.data(), uy.data(), d));
+                        BOOST_TEST(kernels->u8InnerProduct(ux.data(), ux.data(), d) ==
+                                   u8InnerProductRef(ux.data(), ux.data(), d));
+                        BOOST_TEST(kernels->i8L2sqr(sx.data(), sy.data(), d) == i8L2sqrRef(sx.data(), sy.data(), d));
+                        BOOST_TEST(kernels->i8InnerProduct(sx.data(), sy.data(), d) ==
+                                   i8InnerProductRef(sx.data(), sy.data(), d));
+                        BOOST_TEST(kernels->i8InnerProduct(sx.data(), sx.data(), d) ==
+                                   i8InnerProductRef(sx.data(), sx.data(), d));
+                        BOOST_TEST(kernels->i16L2sqr(wx.data(), wy.data(), d) == i16L2sqrRef(wx.data(), wy.data(), d),
+                                   boost::test_tools::tolerance(1e-5f));
+                        BOOST_TEST(kernels->i16InnerProduct(wx.data(), wx.data(), d) ==
+                                   i16InnerProductRef(wx.data(), wx.data(), d), boost::test_tools::tolerance(1e-5f));
+                    }
+                }
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(BlockedKernelsMatchReference) {
+        std::mt19937 gen(4);
+        for (const DistanceKernels *kernels: getSupportedKernels()) {
+            BOOST_TEST_CONTEXT("kernels " << kernels->name) {
+                for (size_t d: kDimensions) {
+                    BOOST_TEST_CONTEXT("dimension " << d) {
+                        std::vector<float> x = generateBuffer(gen, d);
+                        std::vector<float> block = generateBuffer(gen, d * 8);
+                        float expected[8], actual[8];
+                        fvecL2sqrBlocked8Ref(x.data(), block.data(), d, expected);
+                        kernels->l2sqrBlocked8(x.data(), block.data(), d, actual);
+                        for (size_t lane = 0; lane < 8; ++lane) {
+                            BOOST_TEST(actual[lane] == expected[lane], boost::test_tools::tolerance(1e-4f));
+                        }
+                        fvecInnerProductBlocked8Ref(x.data(), block.data(), d, expected);
+                        kernels->innerProductBlocked8(x.data(), block.data(), d, actual);
+                        for (size_t lane = 0; lane < 8; ++lane) {
+                            BOOST_TEST(actual[lane] == expected[lane], boost::test_tools::tolerance(1e-3f));
+                        }
+
+                        std::vector<float> queries = generateBuffer(gen, 4 * d);
+                        float expectedProducts[32], actualProducts[32];
+                        fvecInnerProductBlocked4x8Ref(queries.data(), block.data(), d, expectedProducts);
+                        kernels->innerProductBlocked4x8(queries.data(), block.data(), d, actualProducts);
+                        for (size_t j = 0; j < 32; ++j) {
+                            BOOST_TEST(actualProducts[j] == expectedProducts[j], boost::test_tools::tolerance(1e-3f));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(CodeKernelsMatchReference) {
+        std::mt19937 gen(5);
+        std::uniform_real_distribution<float> dist(-50, 50);
+        const auto tolerance = boost::test_tools::tolerance(1e-4f);
+        for (const DistanceKernels *kernels: getSupportedKernels()) {
+            BOOST_TEST_CONTEXT("kernels " << kernels->name) {
+                for (size_t m: {1, 4, 7, 8, 9, 15, 16, 17, 32, 33, 64}) {
+                    std::vector<float> lut = generateBuffer(gen, m * 256);
+                    std::vector<u_int8_t> code(m);
+                    for (u_int8_t &c: code) {
+                        c = static_cast<u_int8_t>(gen() % 256);
+                    }
+                    BOOST_TEST(kernels->pqAdcDistance(lut.data(), code.data(), m) ==
+                               pqAdcDistanceRef(lut.data(), code.data(), m), tolerance);
+                }
+                for (size_t d: kDimensions) {
+                    std::vector<float> x(d), vmin(d), scale(d);
+                    std::vector<u_int8_t> code(d);
+                    std::vector<u_int16_t> halfCode(d);
+                    for (size_t i = 0; i < d; ++i) {
+                        x[i] = dist(gen);
+                        vmin[i] = dist(gen);
+                        scale[i] = std::fabs(dist(gen)) / 255;
+                        code[i] = static_cast<u_int8_t>(gen() % 256);
+                        halfCode[i] = floatToHalf(dist(gen));
+                    }
+                    BOOST_TEST(kernels->sq8L2sqr(x.data(), code.data(), vmin.data(), scale.data(), d) ==
+                               sq8L2sqrRef(x.data(), code.data(), vmin.data(), scale.data(), d), tolerance);
+                    BOOST_TEST(kernels->fp16L2sqr(x.data(), halfCode.data(), d) ==
+                               fp16L2sqrRef(x.data(), halfCode.data(), d), tolerance);
+                }
+            }
+        }
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
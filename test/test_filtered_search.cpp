@@ -0,0 +1,123 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <numeric>
+#include <vector>
+
+
+namespace {
+    // exact neighbours among the vectors passing the filter
+    template<typename Filter>
+    std::vector<std::vector<u_int32_t>> bruteForceFilteredSearch(const std::vector<std::vector<float>> &baseData,
+                                                                 const std::vector<std::vector<float>> &queries,
+                                                                 size_t nearestVectorsCount, const Filter &filter) {
+        std::vector<std::vector<float>> passedData;
+        std::vector<u_int32_t> passedIds;
+        for (u_int32_t i = 0; i < baseData.size(); ++i) {
+            if (filter(i)) {
+                passedData.push_back(baseData[i]);
+                passedIds.push_back(i);
+            }
+        }
+        auto answers = bruteForceSearch(passedData, queries, std::min(nearestVectorsCount, passedData.size()));
+        for (auto &answer: answers) {
+            for (u_int32_t &id: answer) {
+                id = passedIds[id];
+            }
+        }
+        return answers;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(FilteredSearch)
+
+    BOOST_AUTO_TEST_CASE(FindsNeighboursPassingFilter) {
+        const size_t dimension = 32;
+        const size_t clusterCount = 16;
+        const size_t nearestVectorsCount = 10;
+
+        const auto baseData = generateRandomVectors(4000, dimension, 71);
+        const auto testData = generateRandomVectors(20, dimension, 72);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        auto predicate = [](u_int32_t id) {
+            return id % 7 == 3;
+        };
+        IdBitmap bitmap(baseData.size());
+        for (u_int32_t id = 0; id < baseData.size(); id += 13) {
+            bitmap.set(id);
+        }
+        BOOST_TEST(bitmap.count() == (baseData.size() + 12) / 13);
+
+        for (PageLayout pageLayout: {PageLayout::kRowMajor, PageLayout::kBlocked}) {
+            PaseIVFFlat<float> pase(dimension, clusterCount, pageLayout);
+            pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+            const auto predicateAnswers = bruteForceFilteredSearch(baseData, testData, nearestVectorsCount,
+                                                                   predicate);
+            const auto bitmapAnswers = bruteForceFilteredSearch(baseData, testData, nearestVectorsCount, bitmap);
+            std::vector<u_int32_t> foundIds(nearestVectorsCount);
+            std::vector<float> distances(nearestVectorsCount);
+            for (size_t i = 0; i < testData.size(); ++i) {
+                BOOST_TEST(pase.searchFiltered(testData[i].data(), dimension, nearestVectorsCount, clusterCount,
+                                               predicate, foundIds.data(), distances.data()) == nearestVectorsCount);
+                BOOST_TEST(foundIds == predicateAnswers[i]);
+                BOOST_TEST(pase.findNearestVectorIds(testData[i], nearestVectorsCount, clusterCount, bitmap) ==
+                           bitmapAnswers[i]);
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(WidensProbesForSelectiveFilters) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 20;
+        const size_t nearestVectorsCount = 10;
+
+        const auto baseData = generateRandomVectors(3000, dimension, 73);
+        const auto testData = generateRandomVectors(10, dimension, 74);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        // a handful of matches spread over the clusters, one probe is not enough
+        IdBitmap bitmap(baseData.size());
+        for (u_int32_t id: {5u, 700u, 1400u, 2100u, 2800u, 2999u}) {
+            bitmap.set(id);
+        }
+        BOOST_CHECK_THROW(bitmap.set(3000), std::invalid_argument);
+        const auto answers = bruteForceFilteredSearch(baseData, testData, nearestVectorsCount, bitmap);
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        for (size_t i = 0; i < testData.size(); ++i) {
+            size_t found = pase.searchFiltered(testData[i].data(), dimension, nearestVectorsCount, 1, bitmap,
+                                               foundIds.data(), distances.data());
+            BOOST_TEST(found == bitmap.count());
+            BOOST_TEST(std::vector<u_int32_t>(foundIds.begin(), foundIds.begin() + found) == answers[i]);
+        }
+
+        // k matches stop the widening, all of them pass the filter
+        auto predicate = [](u_int32_t id) {
+            return id % 100 == 0;
+        };
+        for (size_t i = 0; i < testData.size(); ++i) {
+            BOOST_TEST(pase.searchFiltered(testData[i].data(), dimension, nearestVectorsCount, 1, predicate,
+                                           foundIds.data(), distances.data()) == nearestVectorsCount);
+            for (u_int32_t id: foundIds) {
+                BOOST_TEST(predicate(id));
+            }
+        }
+
+        // removed vectors do not pass
+        pase.remove(700);
+        for (size_t i = 0; i < testData.size(); ++i) {
+            size_t found = pase.searchFiltered(testData[i].data(), dimension, nearestVectorsCount, 1, bitmap,
+                                               foundIds.data(), distances.data());
+            BOOST_TEST(found == bitmap.count() - 1);
+            BOOST_TEST(std::count(foundIds.begin(), foundIds.begin() + found, 700u) == 0);
+        }
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,158 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(IndexFile)
+
+    BOOST_AUTO_TEST_CASE(SaveAndLoad) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 300;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 30;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_save_load.idx").string();
+
+        const auto baseData = generateRandomVectors(6000, dimension, 9);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 10);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+        pase.save(path);
+        BOOST_TEST(std::filesystem::file_size(path) % PG_PAGE_SIZE == 0);
+
+        std::unique_ptr<PaseIVFFlat<float>> loaded = PaseIVFFlat<float>::load(path);
+        BOOST_TEST(loaded->dimension == dimension);
+        BOOST_TEST(loaded->clusterCount == clusterCount);
+        BOOST_TEST(loaded->centroidNorms == pase.centroidNorms);
+
+        const auto queries = flatten(testData);
+        BatchSearchResult expected = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount, 20);
+        BatchSearchResult actual = loaded->searchBatch(queries.data(), queryVectorCount, nearestVectorsCount, 20);
+        BOOST_TEST(expected.ids == actual.ids);
+        BOOST_TEST(expected.distances == actual.distances);
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            BOOST_TEST(pase.findNearestVectors(testData[i], 5, 3) == loaded->findNearestVectors(testData[i], 5, 3));
+        }
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(RejectsForeignFiles) {
+        const size_t dimension = 128;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_foreign.idx").string();
+
+        const auto baseData = generateRandomVectors(500, dimension, 11);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, 4);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+        pase.save(path);
+
+        BOOST_CHECK_THROW(PaseIVFFlat<u_int8_t>::load(path), std::runtime_error);
+        BOOST_CHECK_THROW((PaseIVFFlat<float, MetricType::kInnerProduct>::load(path)), std::runtime_error);
+        {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.write("NOTPASE", 7);
+        }
+        BOOST_CHECK_THROW(PaseIVFFlat<float>::load(path), std::runtime_error);
+        BOOST_CHECK_THROW(PaseIVFFlat<float>::load(path + ".missing"), std::runtime_error);
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(RejectsCorruptedPages) {
+        const size_t dimension = 16;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_corrupted.idx").string();
+
+        const auto baseData = generateRandomVectors(2000, dimension, 14);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, 4);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+        pase.save(path);
+
+        std::vector<char> original(std::filesystem::file_size(path));
+        std::ifstream(path, std::ios::binary).read(original.data(), static_cast<std::streamsize>(original.size()));
+        IndexFileHeader header{};
+        std::memcpy(&header, original.data(), sizeof(header));
+        const size_t firstDataBlock = (1 + header.centroidPageCount) * PG_PAGE_SIZE;
+
+        // header of data page 0 rewritten by corrupt, load and map both have to reject the file
+        auto checkRejected = [&](const std::function<void(DataPageHeader &)> &corrupt) {
+            std::vector<char> bytes = original;
+            DataPageHeader pageHeader{};
+            std::memcpy(&pageHeader, bytes.data() + firstDataBlock, sizeof(pageHeader));
+            corrupt(pageHeader);
+            std::memcpy(bytes.data() + firstDataBlock, &pageHeader, sizeof(pageHeader));
+            std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(),
+                                                                         static_cast<std::streamsize>(bytes.size()));
+            BOOST_CHECK_THROW(PaseIVFFlat<float>::load(path), std::runtime_error);
+            BOOST_CHECK_THROW(PaseIVFFlat<float>::map(path), std::runtime_error);
+        };
+        checkRejected([](DataPageHeader &pageHeader) {
+            pageHeader.vectorCount = DataPage<float>::calcVectorCount(dimension) + 1;
+        });
+        checkRejected([](DataPageHeader &pageHeader) {
+            pageHeader.layout = PageLayout::kBlocked;
+        });
+        checkRejected([](DataPageHeader &pageHeader) {
+            pageHeader.nextPage = 0;
+        });
+        checkRejected([&header](DataPageHeader &pageHeader) {
+            pageHeader.nextPage = header.dataPageCount;
+        });
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(MapInPlace) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 250;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 40;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_map.idx").string();
+
+        const auto baseData = generateRandomVectors(6000, dimension, 12);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 13);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+        pase.save(path);
+
+        std::unique_ptr<PaseIVFFlat<float>> mapped = PaseIVFFlat<float>::map(path);
+        const auto queries = flatten(testData);
+        for (auto mode: {BatchSearchMode::kQueryMajor, BatchSearchMode::kClusterMajor}) {
+            BatchSearchResult expected = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount, 15,
+                                                          mode);
+            BatchSearchResult actual = mapped->searchBatch(queries.data(), queryVectorCount, nearestVectorsCount,
+                                                           15, mode);
+            BOOST_TEST(expected.ids == actual.ids);
+        }
+
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        std::vector<const float *> vectors(nearestVectorsCount);
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            BOOST_TEST(pase.findNearestVectors(testData[i], 5, 3) == mapped->findNearestVectors(testData[i], 5, 3));
+            mapped->searchInto(testData[i].data(), dimension, nearestVectorsCount, 15, foundIds.data(),
+                               distances.data(), vectors.data());
+            for (size_t j = 0; j < nearestVectorsCount; ++j) {
+                BOOST_TEST(std::equal(vectors[j], vectors[j] + dimension, baseData[foundIds[j]].begin()));
+            }
+        }
+
+        BOOST_CHECK_THROW(mapped->buildIndex(baseData, baseData, ids, 5, 1e-4), std::logic_error);
+        BOOST_CHECK_THROW(mapped->save(path + ".copy"), std::logic_error);
+        mapped.reset();
+        std::filesystem::remove(path);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,118 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <filesystem>
+#include <numeric>
+#include <vector>
+
+
+namespace {
+    // sum of vectorCount over clusters and of the vectors found on their pages
+    std::pair<size_t, size_t> countVectors(const PaseIVFFlat<float> &pase) {
+        size_t recorded = 0;
+        size_t stored = 0;
+        size_t clustersLeft = pase.clusterCount;
+        for (const CentroidPage<float> *centroidPage = pase.firstCentroidPage; clustersLeft != 0;
+             centroidPage = centroidPage->nextPage) {
+            for (size_t c = 0; c < centroidPage->tuples.size() && clustersLeft != 0; ++c, --clustersLeft) {
+                const CentroidTuple<float> &cluster = centroidPage->tuples[c];
+                recorded += cluster.vectorCount;
+                for (BlockNumber pageNumber = cluster.firstDataPage; pageNumber != kInvalidBlockNumber;) {
+                    const DataPage<float> *pg = pase.getDataPage(pageNumber);
+                    stored += pg->header.vectorCount;
+                    BOOST_TEST((pg->hasNextPage() || pageNumber == cluster.lastDataPage));
+                    pageNumber = pg->header.nextPage;
+                }
+            }
+        }
+        return {recorded, stored};
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(Insertion)
+
+    BOOST_AUTO_TEST_CASE(InsertedVectorsAreFound) {
+        const size_t dimension = 32;
+        const size_t clusterCount = 10;
+        const size_t nearestVectorsCount = 10;
+
+        const auto baseData = generateRandomVectors(6000, dimension, 41);
+        const auto testData = generateRandomVectors(30, dimension, 42);
+        const size_t builtCount = 2000;
+        std::vector<std::vector<float>> builtData(baseData.begin(), baseData.begin() + builtCount);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        for (PageLayout pageLayout: {PageLayout::kRowMajor, PageLayout::kBlocked}) {
+            PaseIVFFlat<float> pase(dimension, clusterCount, pageLayout);
+            pase.buildIndex(builtData, builtData, std::vector<u_int32_t>(ids.begin(), ids.begin() + builtCount),
+                            10, 1e-4);
+            // singles, then batches of different sizes, every cluster receives appends several times
+            size_t next = builtCount;
+            for (; next < 2500; ++next) {
+                pase.insert(baseData[next], ids[next]);
+            }
+            for (size_t batchSize: {1, 7, 500, 2992}) {
+                std::vector<std::vector<float>> batch(baseData.begin() + next, baseData.begin() + next + batchSize);
+                pase.insertBatch(batch, std::vector<u_int32_t>(ids.begin() + next, ids.begin() + next + batchSize));
+                next += batchSize;
+            }
+            BOOST_TEST(next == baseData.size());
+            BOOST_TEST((countVectors(pase) == std::make_pair(baseData.size(), baseData.size())));
+
+            const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+            std::vector<u_int32_t> foundIds(nearestVectorsCount);
+            std::vector<float> distances(nearestVectorsCount);
+            for (size_t i = 0; i < testData.size(); ++i) {
+                pase.searchInto(testData[i].data(), dimension, nearestVectorsCount, clusterCount, foundIds.data(),
+                                distances.data());
+                BOOST_TEST(foundIds == answers[i]);
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(LoadedIndexAppendsToTail) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 4;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_insert.idx").string();
+
+        const auto baseData = generateRandomVectors(3000, dimension, 43);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        {
+            PaseIVFFlat<float> pase(dimension, clusterCount);
+            pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+            pase.save(path);
+        }
+        std::unique_ptr<PaseIVFFlat<float>> loaded = PaseIVFFlat<float>::load(path);
+        const size_t pageCount = loaded->pageArena.getPageCount();
+        loaded->insert(baseData[0], 100000);
+        BOOST_TEST(loaded->pageArena.getPageCount() <= pageCount + 1);
+        BOOST_TEST((countVectors(*loaded) == std::make_pair(baseData.size() + 1, baseData.size() + 1)));
+
+        u_int32_t foundIds[2];
+        float distances[2];
+        BOOST_TEST(loaded->searchInto(baseData[0].data(), dimension, 2, clusterCount, foundIds, distances) == 2);
+        BOOST_TEST(distances[0] == 0.0f);
+        BOOST_TEST(distances[1] == 0.0f);
+
+        std::unique_ptr<PaseIVFFlat<float>> mapped = PaseIVFFlat<float>::map(path);
+        BOOST_CHECK_THROW(mapped->insert(baseData[0], 1), std::logic_error);
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(RejectsInvalidInput) {
+        PaseIVFFlat<float> empty(8, 2);
+        BOOST_CHECK_THROW(empty.insert(std::vector<float>(8), 0), std::logic_error);
+
+        const auto baseData = generateRandomVectors(100, 8, 44);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(8, 2);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+        BOOST_CHECK_THROW(pase.insert(std::vector<float>(7), 0), std::invalid_argument);
+        BOOST_CHECK_THROW(pase.insertBatch(baseData, std::vector<u_int32_t>(1)), std::invalid_argument);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
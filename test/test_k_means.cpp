@@ -1,10 +1,54 @@
 #include "pase.hpp"
+#include "test_utils.hpp"
 
 #include <boost/test/unit_test.hpp>
+#include <cmath>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <set>
 #include <vector>
 
 
+namespace {
+    // groupCount tight groups of groupSize points, the group centers are far apart
+    std::vector<std::vector<float>> generateGroups(size_t groupCount, size_t groupSize, size_t dimension) {
+        const auto noise = generateRandomVectors(groupCount * groupSize, dimension, 61);
+        std::vector<std::vector<float>> points;
+        for (size_t i = 0; i < noise.size(); ++i) {
+            std::vector<float> point = noise[i];
+            for (float &x: point) {
+                x /= 100;
+            }
+            point[i / groupSize % dimension] += 1000.0f * static_cast<float>(1 + i / groupSize / dimension);
+            points.push_back(point);
+        }
+        return points;
+    }
+
+    // fvecs for float, bvecs for u_int8_t
+    template<typename T>
+    void writeVecs(const std::string &path, const std::vector<std::vector<T>> &vectors) {
+        std::ofstream out(path, std::ios::binary);
+        for (const auto &vec: vectors) {
+            const auto dimension = static_cast<int32_t>(vec.size());
+            out.write(reinterpret_cast<const char *>(&dimension), sizeof(dimension));
+            out.write(reinterpret_cast<const char *>(vec.data()), static_cast<std::streamsize>(sizeof(T) * vec.size()));
+        }
+    }
+
+    size_t findGroup(const std::vector<float> &point) {
+        for (size_t i = 0; i < point.size(); ++i) {
+            if (point[i] > 500) {
+                return i + point.size() * static_cast<size_t>((point[i] + 500) / 1000 - 1);
+            }
+        }
+        return point.size() * 1000;
+    }
+}
+
+
 BOOST_AUTO_TEST_SUITE(CentroidBuild)
 
     BOOST_AUTO_TEST_CASE(JustWorks) {
@@ -19,6 +63,391 @@ BOOST_AUTO_TEST_SUITE(CentroidBuild)
         IVFFlatClusterData<float> result = kMeans<float>(data, clusterCount, epochs, tol);
     }
 
+    BOOST_AUTO_TEST_CASE(BlockedAssignmentFindsNearestCentroid) {
+        const size_t dimension = 20;
+        // more centroids and points than one block holds, the last blocks are partial
+        const auto points = generateRandomVectors(1000, dimension, 63);
+        const auto centroids = generateRandomVectors(600, dimension, 64);
+        const std::vector<float> centroidRows = flatten(centroids);
+        std::vector<u_int32_t> labels(points.size());
+        std::vector<float> distances(points.size());
+
+        findNearestCentroids<MetricType::kL2>(centroidRows.data(), centroids.size(), dimension, points,
+                                              labels.data(), distances.data());
+        for (size_t i = 0; i < points.size(); ++i) {
+            float minDistance = std::numeric_limits<float>::max();
+            for (const auto &centroid: centroids) {
+                minDistance = std::min(minDistance, squaredDistance(points[i], centroid));
+            }
+            // the norm expansion rounds differently, near ties may go either way
+            BOOST_TEST(squaredDistance(points[i], centroids[labels[i]]) <= minDistance * 1.001f);
+            BOOST_TEST(distances[i] == minDistance, boost::test_tools::tolerance(0.01f));
+        }
+
+        findNearestCentroids<MetricType::kInnerProduct>(centroidRows.data(), centroids.size(), dimension, points,
+                                                        labels.data(), distances.data());
+        for (size_t i = 0; i < points.size(); ++i) {
+            float minDistance = std::numeric_limits<float>::max();
+            for (const auto &centroid: centroids) {
+                minDistance = std::min(minDistance, metricDistance<MetricType::kInnerProduct>(
+                        points[i].data(), centroid.data(), dimension));
+            }
+            BOOST_TEST(distances[i] == minDistance, boost::test_tools::tolerance(0.001f));
+        }
+
+        // integer points are converted per block
+        std::vector<std::vector<u_int8_t>> bytePoints(points.size(), std::vector<u_int8_t>(dimension));
+        for (size_t i = 0; i < points.size(); ++i) {
+            std::copy(points[i].begin(), points[i].end(), bytePoints[i].begin());
+        }
+        std::vector<u_int32_t> byteLabels(points.size());
+        findNearestCentroids<MetricType::kL2>(centroidRows.data(), centroids.size(), dimension, bytePoints,
+                                              byteLabels.data(), nullptr);
+        for (size_t i = 0; i < points.size(); ++i) {
+            float minDistance = std::numeric_limits<float>::max();
+            for (const auto &centroid: centroids) {
+                minDistance = std::min(minDistance, squaredDistance(bytePoints[i], centroid));
+            }
+            BOOST_TEST(squaredDistance(bytePoints[i], centroids[byteLabels[i]]) <= minDistance * 1.001f);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(UpdateSplitsEmptyClusters) {
+        const size_t dimension = 16;
+        // enough points for several update workers
+        const auto points = generateRandomVectors(20000, dimension, 65);
+        std::vector<u_int32_t> labels(points.size(), 0);
+        for (size_t i = 0; i < 100; ++i) {
+            labels[i] = 1;
+        }
+        std::vector<std::vector<float>> expected(2, std::vector<float>(dimension, 0));
+        for (size_t i = 0; i < points.size(); ++i) {
+            for (size_t j = 0; j < dimension; ++j) {
+                expected[labels[i]][j] += points[i][j] / (labels[i] == 0 ? 19900.0f : 100.0f);
+            }
+        }
+
+        // cluster 2 and 3 get no points
+        std::vector<std::vector<float>> centroids(4, std::vector<float>(dimension, 0));
+        std::vector<float> minSquaredDist(points.size());
+        CentroidUpdateBuffers buffers;
+        const float shift = computePoints(centroids, points, minSquaredDist, labels, buffers);
+        BOOST_TEST(std::isfinite(shift));
+        for (size_t j = 0; j < dimension; ++j) {
+            BOOST_TEST(centroids[1][j] == expected[1][j], boost::test_tools::tolerance(1e-3f));
+            // the largest cluster is halved twice, its centroid moves by at most twice the split shift
+            for (size_t c: {0, 2, 3}) {
+                BOOST_TEST(std::isfinite(centroids[c][j]));
+                BOOST_TEST(std::abs(centroids[c][j] - expected[0][j]) <= 3 * kClusterSplitEps * expected[0][j]);
+            }
+        }
+        BOOST_TEST((centroids[0] != centroids[2] && centroids[0] != centroids[3] && centroids[2] != centroids[3]));
+
+        // the next assignment gives the split clusters points again
+        assignPoints(centroids, points, minSquaredDist, labels);
+        std::vector<size_t> sizes(centroids.size(), 0);
+        for (u_int32_t label: labels) {
+            ++sizes[label];
+        }
+        for (size_t size: sizes) {
+            BOOST_TEST(size > 0);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(MiniBatchTrainsFromFile) {
+        const size_t groupCount = 24;
+        const size_t groupSize = 200;
+        const size_t dimension = 8;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_mini_batch.fvecs").string();
+        const auto points = generateGroups(groupCount, groupSize, dimension);
+        writeVecs(path, points);
+
+        MiniBatchKMeansOptions options;
+        options.batchSize = 256;
+        options.chunkSize = 1024;
+        options.epochCount = 2;
+        options.seedSampleSize = 1000;
+        // uniform seeds leave some groups without a centroid, one per group needs D^2 weighted picks
+        options.samplingMode = kMeansSamplingMode::kPlusplus;
+        const IVFFlatClusterData<float> trained = miniBatchKMeans<float>(path, dimension, groupCount, options);
+        BOOST_TEST(trained.centroids.size() == groupCount);
+        std::set<size_t> groups;
+        for (const auto &centroid: trained.centroids) {
+            const size_t group = findGroup(centroid);
+            groups.insert(group);
+            // the noise of a group is below 1 in every coordinate
+            for (size_t i = 0; i < groupSize; i += 20) {
+                BOOST_TEST(squaredDistance(points[group * groupSize + i], centroid) < dimension);
+            }
+        }
+        BOOST_TEST(groups.size() == groupCount);
+
+        // the index built from the trained centroids finds every point in the cluster of its group
+        PaseIVFFlat<float> pase(dimension, groupCount);
+        std::vector<u_int32_t> ids(points.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        pase.buildIndex(trained, points, ids);
+        for (size_t i = 0; i < points.size(); i += 97) {
+            u_int32_t foundId;
+            float distance;
+            pase.searchInto(points[i].data(), dimension, 1, 1, &foundId, &distance);
+            BOOST_TEST(foundId == i);
+        }
+        PaseIVFFlat<float> other(dimension, groupCount + 1);
+        BOOST_CHECK_THROW(other.buildIndex(trained, points, ids), std::invalid_argument);
+        BOOST_CHECK_THROW(miniBatchKMeans<float>(path, dimension + 1, groupCount, options), std::runtime_error);
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(MiniBatchStreamsBvecs) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 10;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_mini_batch.bvecs").string();
+        const auto randomVectors = generateRandomVectors(3000, dimension, 66);
+        std::vector<std::vector<u_int8_t>> points(randomVectors.size(), std::vector<u_int8_t>(dimension));
+        for (size_t i = 0; i < points.size(); ++i) {
+            for (size_t j = 0; j < dimension; ++j) {
+                points[i][j] = static_cast<u_int8_t>(randomVectors[i][j] * 2.5f);
+            }
+        }
+        writeVecs(path, points);
+
+        VecsReader<u_int8_t> reader(path, dimension);
+        BOOST_TEST(reader.getVectorCount() == points.size());
+        std::vector<std::vector<u_int8_t>> chunk;
+        BOOST_TEST(reader.read(1000, chunk) == 1000);
+        BOOST_TEST((chunk[999] == points[999]));
+        reader.seek(2500);
+        BOOST_TEST(reader.read(1000, chunk) == 500);
+        BOOST_TEST((chunk[0] == points[2500]));
+        BOOST_TEST(reader.read(1000, chunk) == 0);
+
+        MiniBatchKMeansOptions options;
+        options.batchSize = 300;
+        options.chunkSize = 1000;
+        options.learningRate = MiniBatchLearningRate::kInverseTime;
+        const auto trained = miniBatchKMeans<u_int8_t>(path, dimension, clusterCount, options);
+        BOOST_TEST(trained.centroids.size() == clusterCount);
+        BOOST_TEST((std::set<std::vector<u_int8_t>>(trained.centroids.begin(), trained.centroids.end()).size() ==
+                    clusterCount));
+        BOOST_TEST((miniBatchKMeans<u_int8_t>(path, dimension, clusterCount, options).centroids == trained.centroids));
+        options.chunkSize = 100;
+        BOOST_CHECK_THROW(miniBatchKMeans<u_int8_t>(path, dimension, clusterCount, options), std::invalid_argument);
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(MiniBatchSplitsEmptyClusters) {
+        const size_t dimension = 8;
+        const size_t clusterCount = 10;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_mini_batch_split.fvecs").string();
+        // a sixth of the file repeats one point far from the others, with this seed uniform seeding picks it twice
+        // and the second of those centroids never wins a point
+        auto points = generateRandomVectors(2000, dimension, 67);
+        points.resize(2400, std::vector<float>(dimension, 1000.0f));
+        writeVecs(path, points);
+
+        MiniBatchKMeansOptions options;
+        options.batchSize = 400;
+        options.chunkSize = 1200;
+        options.epochCount = 2;
+        options.seedSampleSize = points.size();
+        options.samplingMode = kMeansSamplingMode::kNormal;
+        options.seed = 10;
+        const auto seeds = kMeansSample(points, clusterCount, options.samplingMode, options.seed);
+        BOOST_TEST(std::count(seeds.begin(), seeds.end(), points.back()) == 2);
+        const auto trained = miniBatchKMeans<float>(path, dimension, clusterCount, options);
+        BOOST_TEST((std::set<std::vector<float>>(trained.centroids.begin(), trained.centroids.end()).size() ==
+                    clusterCount));
+        for (const auto &centroid: trained.centroids) {
+            for (float x: centroid) {
+                BOOST_TEST(std::isfinite(x));
+            }
+        }
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(MiniBatchTrainsSplitClustersInOnePass) {
+        const size_t dimension = 8;
+        const size_t clusterCount = 10;
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_mini_batch_one_pass.fvecs").string();
+        // The sample holds clusterCount vectors, so every one of them is a seed. The first two are copies of a point
+        // far from the others that the file repeats, the second of their centroids never wins a point and is split
+        // off the largest cluster of the uniform points at the end of the only pass.
+        auto points = generateRandomVectors(4400, dimension, 68);
+        std::fill(points.begin(), points.begin() + 400, std::vector<float>(dimension, 1000.0f));
+        points[440] = points[0];
+        writeVecs(path, points);
+
+        MiniBatchKMeansOptions options;
+        options.batchSize = 400;
+        options.chunkSize = 1200;
+        options.epochCount = 1;
+        options.seedSampleSize = clusterCount;
+        const auto trained = miniBatchKMeans<float>(path, dimension, clusterCount, options);
+
+        const std::vector<float> centroidRows = flatten(trained.centroids);
+        std::vector<u_int32_t> labels(points.size());
+        findNearestCentroids<MetricType::kL2>(centroidRows.data(), clusterCount, dimension, points, labels.data(),
+                                              nullptr);
+        std::vector<size_t> sizes(clusterCount, 0);
+        for (u_int32_t label: labels) {
+            ++sizes[label];
+        }
+        for (size_t c = 0; c < clusterCount; ++c) {
+            BOOST_TEST(sizes[c] > 0);
+            // an untrained split leaves two centroids at a squared distance of about 0.1
+            for (size_t other = c + 1; other < clusterCount; ++other) {
+                BOOST_TEST(squaredDistance(trained.centroids[c], trained.centroids[other]) > 1.0f);
+            }
+        }
+        std::filesystem::remove(path);
+    }
+
+    BOOST_AUTO_TEST_CASE(BalancedAssignmentCapsClusters) {
+        const size_t dimension = 8;
+        const size_t maxClusterSize = 250;
+        const auto points = generateRandomVectors(2000, dimension, 67);
+        // one centroid in the middle of the points, the others at the border
+        auto centroids = generateRandomVectors(10, dimension, 68);
+        centroids[0] = std::vector<float>(dimension, 50);
+        const std::vector<float> centroidRows = flatten(centroids);
+        std::vector<u_int32_t> labels(points.size());
+        std::vector<float> distances(points.size());
+        findNearestCentroids<MetricType::kL2>(centroidRows.data(), centroids.size(), dimension, points,
+                                              labels.data(), distances.data());
+        const std::vector<u_int32_t> nearest = labels;
+        const std::vector<float> nearestDistances = distances;
+
+        balanceAssignment<MetricType::kL2>(centroidRows.data(), centroids.size(), dimension, points, labels.data(),
+                                           distances.data(), maxClusterSize);
+        std::vector<size_t> sizes(centroids.size(), 0);
+        float maxKeptDistance = 0;
+        float minMovedDistance = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < points.size(); ++i) {
+            ++sizes[labels[i]];
+            BOOST_TEST(distances[i] == squaredDistance(points[i], centroids[labels[i]]),
+                       boost::test_tools::tolerance(0.01f));
+            if (nearest[i] == 0) {
+                if (labels[i] == 0) {
+                    maxKeptDistance = std::max(maxKeptDistance, nearestDistances[i]);
+                } else {
+                    minMovedDistance = std::min(minMovedDistance, nearestDistances[i]);
+                }
+            }
+        }
+        for (size_t size: sizes) {
+            BOOST_TEST(size <= maxClusterSize);
+        }
+        // the central cluster was over the cap and kept its closest points
+        BOOST_TEST(sizes[0] == maxClusterSize);
+        BOOST_TEST(maxKeptDistance <= minMovedDistance);
+
+        BOOST_CHECK_THROW(balanceAssignment<MetricType::kL2>(centroidRows.data(), centroids.size(), dimension, points,
+                                                             labels.data(), distances.data(), 199),
+                          std::invalid_argument);
+    }
+
+    BOOST_AUTO_TEST_CASE(BalancedBuildCapsListSizes) {
+        const size_t dimension = 8;
+        const size_t clusterCount = 12;
+        const size_t maxClusterSize = 400;
+        // a dense group holds most of the points
+        auto points = generateRandomVectors(4000, dimension, 69);
+        for (size_t i = 0; i < 3000; ++i) {
+            for (float &x: points[i]) {
+                x = 50 + x / 20;
+            }
+        }
+        std::vector<u_int32_t> ids(points.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> skewed(dimension, clusterCount);
+        skewed.buildIndex(points, points, ids, 10, 1e-4);
+        const auto skewedSizes = skewed.getClusterSizes();
+        BOOST_TEST(*std::max_element(skewedSizes.begin(), skewedSizes.end()) > maxClusterSize);
+
+        PaseIVFFlat<float> balanced(dimension, clusterCount);
+        balanced.setMaxClusterSize(maxClusterSize);
+        balanced.buildIndex(points, points, ids, 10, 1e-4);
+        auto sizes = balanced.getClusterSizes();
+        BOOST_TEST(sizes.size() == clusterCount);
+        BOOST_TEST(std::accumulate(sizes.begin(), sizes.end(), size_t(0)) == points.size());
+        BOOST_TEST(*std::max_element(sizes.begin(), sizes.end()) <= maxClusterSize);
+        BOOST_CHECK_THROW(skewed.setMaxClusterSize(maxClusterSize), std::logic_error);
+
+        PaseIVFFlat<float> tooSmall(dimension, clusterCount);
+        tooSmall.setMaxClusterSize(300);
+        BOOST_CHECK_THROW(tooSmall.buildIndex(points, points, ids, 10, 1e-4), std::invalid_argument);
+
+        // inserts fill the clusters with room first
+        const auto inserted = generateRandomVectors(500, dimension, 70);
+        std::vector<u_int32_t> insertedIds(inserted.size());
+        std::iota(insertedIds.begin(), insertedIds.end(), points.size());
+        balanced.insertBatch(std::vector<std::vector<float>>(inserted.begin(), inserted.begin() + 300),
+                             std::vector<u_int32_t>(insertedIds.begin(), insertedIds.begin() + 300));
+        for (size_t i = 300; i < inserted.size(); ++i) {
+            balanced.insert(inserted[i], insertedIds[i]);
+        }
+        sizes = balanced.getClusterSizes();
+        BOOST_TEST(std::accumulate(sizes.begin(), sizes.end(), size_t(0)) == points.size() + inserted.size());
+        BOOST_TEST(*std::max_element(sizes.begin(), sizes.end()) <= maxClusterSize);
+
+        // searching every cluster stays exact
+        points.insert(points.end(), inserted.begin(), inserted.end());
+        const auto queries = generateRandomVectors(20, dimension, 71);
+        const auto answers = bruteForceSearch(points, queries, 10);
+        std::vector<u_int32_t> foundIds(10);
+        std::vector<float> foundDistances(10);
+        for (size_t i = 0; i < queries.size(); ++i) {
+            balanced.searchInto(queries[i].data(), dimension, 10, clusterCount, foundIds.data(), foundDistances.data());
+            BOOST_TEST(foundIds == answers[i]);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(SeedingIsReproducible) {
+        const auto points = generateRandomVectors(5000, 8, 62);
+        const size_t clusterCount = 50;
+        for (kMeansSamplingMode mode: {kMeansSamplingMode::kNormal, kMeansSamplingMode::kPlusplus,
+                                       kMeansSamplingMode::kParallel}) {
+            const auto centroids = kMeansSample(points, clusterCount, mode, 1);
+            BOOST_TEST(centroids.size() == clusterCount);
+            BOOST_TEST((kMeansSample(points, clusterCount, mode, 1) == centroids));
+            BOOST_TEST((kMeansSample(points, clusterCount, mode, 2) != centroids));
+            BOOST_TEST(std::set<std::vector<float>>(centroids.begin(), centroids.end()).size() == clusterCount);
+
+            // every point is taken once there are as many clusters as points
+            const std::vector<std::vector<float>> few(points.begin(), points.begin() + clusterCount);
+            const auto all = kMeansSample(few, clusterCount, mode, 3);
+            BOOST_TEST((std::set<std::vector<float>>(all.begin(), all.end()) ==
+                        std::set<std::vector<float>>(few.begin(), few.end())));
+        }
+        BOOST_CHECK_THROW(kMeansSample(points, points.size() + 1, kMeansSamplingMode::kPlusplus, 1),
+                          std::invalid_argument);
+    }
+
+    BOOST_AUTO_TEST_CASE(SeedingCoversSeparatedGroups) {
+        const size_t groupCount = 24;
+        const size_t dimension = 8;
+        const auto points = generateGroups(groupCount, 200, dimension);
+        for (kMeansSamplingMode mode: {kMeansSamplingMode::kPlusplus, kMeansSamplingMode::kParallel}) {
+            for (u_int64_t seed = 0; seed < 5; ++seed) {
+                std::set<size_t> groups;
+                for (const auto &centroid: kMeansSample(points, groupCount, mode, seed)) {
+                    groups.insert(findGroup(centroid));
+                }
+                BOOST_TEST(groups.size() == groupCount);
+            }
+        }
+
+        // the duplicates of a pick are only taken once every distinct point is
+        std::vector<std::vector<float>> duplicates(100, points[0]);
+        duplicates.push_back(points[1]);
+        for (kMeansSamplingMode mode: {kMeansSamplingMode::kPlusplus, kMeansSamplingMode::kParallel}) {
+            const auto centroids = kMeansSample(duplicates, 2, mode, 4);
+            BOOST_TEST((std::set<std::vector<float>>(centroids.begin(), centroids.end()).size() == 2));
+        }
+    }
+
     BOOST_AUTO_TEST_CASE(BuildPages) {
         const size_t centroidTuplesPerPage = 204;
         const size_t dimension = 128;
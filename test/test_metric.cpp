@@ -0,0 +1,166 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+
+namespace {
+    // exact top nearestVectorsCount ids by decreasing inner product, optionally of normalized vectors
+    std::vector<std::vector<u_int32_t>> bruteForceSearchByProduct(const std::vector<std::vector<float>> &baseData,
+                                                                  const std::vector<std::vector<float>> &queries,
+                                                                  size_t nearestVectorsCount, bool isCosine) {
+        std::vector<std::vector<u_int32_t>> result(queries.size());
+        std::vector<std::pair<float, u_int32_t>> dists(baseData.size());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            for (size_t j = 0; j < baseData.size(); ++j) {
+                float product = fvecInnerProductRef(queries[i].data(), baseData[j].data(), queries[i].size());
+                if (isCosine) {
+                    product /= std::sqrt(fvecNormL2sqrRef(baseData[j].data(), baseData[j].size()));
+                }
+                dists[j] = {-product, static_cast<u_int32_t>(j)};
+            }
+            std::partial_sort(dists.begin(), dists.begin() + nearestVectorsCount, dists.end());
+            for (size_t j = 0; j < nearestVectorsCount; ++j) {
+                result[i].push_back(dists[j].second);
+            }
+        }
+        return result;
+    }
+
+    template<MetricType Metric>
+    void checkFullScan(PageLayout pageLayout) {
+        const size_t dimension = 32;
+        const size_t clusterCount = 10;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 40;
+
+        const auto baseData = generateRandomVectors(3000, dimension, 31);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 32);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float, Metric> pase(dimension, clusterCount, pageLayout);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const auto answers = bruteForceSearchByProduct(baseData, testData, nearestVectorsCount,
+                                                       Metric == MetricType::kCosine);
+        const auto queries = flatten(testData);
+        for (BatchSearchMode mode: {BatchSearchMode::kQueryMajor, BatchSearchMode::kClusterMajor}) {
+            BatchSearchResult result = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount,
+                                                        clusterCount, mode);
+            for (size_t i = 0; i < queryVectorCount; ++i) {
+                const u_int32_t *foundIds = result.getIds(i);
+                BOOST_TEST(std::vector<u_int32_t>(foundIds, foundIds + nearestVectorsCount) == answers[i]);
+            }
+        }
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            BOOST_TEST(pase.findNearestVectorIds(testData[i], nearestVectorsCount, clusterCount) == answers[i]);
+            pase.searchInto(testData[i].data(), dimension, nearestVectorsCount, clusterCount, foundIds.data(),
+                            distances.data());
+            BOOST_TEST(foundIds == answers[i]);
+            BOOST_TEST(distances[0] < 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(MetricSearch)
+
+    BOOST_AUTO_TEST_CASE(InnerProductMatchesBruteForce) {
+        checkFullScan<MetricType::kInnerProduct>(PageLayout::kRowMajor);
+        checkFullScan<MetricType::kInnerProduct>(PageLayout::kBlocked);
+    }
+
+    BOOST_AUTO_TEST_CASE(CosineMatchesBruteForce) {
+        checkFullScan<MetricType::kCosine>(PageLayout::kRowMajor);
+        checkFullScan<MetricType::kCosine>(PageLayout::kBlocked);
+    }
+
+    BOOST_AUTO_TEST_CASE(CosineInsertsAreNormalized) {
+        const size_t dimension = 32;
+        const size_t clusterCount = 10;
+        const size_t nearestVectorsCount = 10;
+
+        const auto baseData = generateRandomVectors(3000, dimension, 33);
+        const auto testData = generateRandomVectors(20, dimension, 34);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        const std::vector<std::vector<float>> builtData(baseData.begin(), baseData.begin() + 1000);
+        const std::vector<std::vector<float>> insertedData(baseData.begin() + 1000, baseData.end());
+
+        PaseIVFFlat<float, MetricType::kCosine> pase(dimension, clusterCount);
+        pase.buildIndex(builtData, builtData, std::vector<u_int32_t>(ids.begin(), ids.begin() + 1000), 10, 1e-4);
+        pase.insertBatch(insertedData, std::vector<u_int32_t>(ids.begin() + 1000, ids.end()));
+
+        const auto answers = bruteForceSearchByProduct(baseData, testData, nearestVectorsCount, true);
+        for (size_t i = 0; i < testData.size(); ++i) {
+            BOOST_TEST(pase.findNearestVectorIds(testData[i], nearestVectorsCount, clusterCount) == answers[i]);
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(IntegerVectorsUseSquaredDistance) {
+        const size_t dimension = 16;
+        std::mt19937 gen(33);
+        std::vector<std::vector<int32_t>> baseData(500, std::vector<int32_t>(dimension));
+        for (auto &vec: baseData) {
+            for (auto &x: vec) {
+                x = static_cast<int32_t>(gen() % 100);
+            }
+        }
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<int32_t> pase(dimension, 4);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+
+        u_int32_t foundId = 0;
+        float distance = 0;
+        std::vector<int32_t> query = baseData[7];
+        query[0] += 3;
+        query[1] -= 4;
+        BOOST_TEST(pase.searchInto(query.data(), dimension, 1, 4, &foundId, &distance) == 1);
+        BOOST_TEST(foundId == 7);
+        BOOST_TEST(distance == 25.0f);
+    }
+
+    BOOST_AUTO_TEST_CASE(ByteVectorsMatchBruteForce) {
+        const size_t dimension = 40;
+        const size_t clusterCount = 8;
+        const size_t nearestVectorsCount = 5;
+        std::mt19937 gen(34);
+        std::vector<std::vector<u_int8_t>> baseData(1000, std::vector<u_int8_t>(dimension));
+        for (auto &vec: baseData) {
+            for (auto &x: vec) {
+                x = static_cast<u_int8_t>(gen());
+            }
+        }
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<u_int8_t> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 5, 1e-4);
+
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        std::vector<std::pair<float, u_int32_t>> expected(baseData.size());
+        for (size_t q = 0; q < 20; ++q) {
+            const std::vector<u_int8_t> &query = baseData[gen() % baseData.size()];
+            for (size_t j = 0; j < baseData.size(); ++j) {
+                expected[j] = {u8L2sqrRef(query.data(), baseData[j].data(), dimension), static_cast<u_int32_t>(j)};
+            }
+            std::partial_sort(expected.begin(), expected.begin() + nearestVectorsCount, expected.end());
+            BOOST_TEST(pase.searchInto(query.data(), dimension, nearestVectorsCount, clusterCount, foundIds.data(),
+                                       distances.data()) == nearestVectorsCount);
+            for (size_t j = 0; j < nearestVectorsCount; ++j) {
+                BOOST_TEST(distances[j] == expected[j].first);
+            }
+        }
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#include "page_arena.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(PageArenaAllocation)
+
+    BOOST_AUTO_TEST_CASE(AllocatesZeroedAlignedPages) {
+        PageArena arena;
+        const size_t pageCount = 3 * PageArena::kPagesPerChunk + 5;
+        for (size_t i = 0; i < pageCount; ++i) {
+            BlockNumber pageNumber = arena.allocatePage();
+            BOOST_TEST(pageNumber == i);
+            char *page = arena.getPage(pageNumber);
+            BOOST_TEST(reinterpret_cast<uintptr_t>(page) % 64 == 0);
+            BOOST_TEST(std::all_of(page, page + PG_PAGE_SIZE, [](char c) { return c == 0; }));
+            std::memset(page, static_cast<int>(i % 127), PG_PAGE_SIZE);
+        }
+        BOOST_TEST(arena.getPageCount() == pageCount);
+        for (size_t i = 0; i < pageCount; ++i) {
+            const char *page = arena.getPage(i);
+            BOOST_TEST(page[0] == static_cast<char>(i % 127));
+            BOOST_TEST(page[PG_PAGE_SIZE - 1] == static_cast<char>(i % 127));
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(ReusesReleasedPages) {
+        PageArena arena;
+        for (size_t i = 0; i < 4; ++i) {
+            std::memset(arena.getPage(arena.allocatePage()), 1, PG_PAGE_SIZE);
+        }
+        arena.releasePage(1);
+        arena.releasePage(2);
+        BOOST_TEST(arena.getFreePageCount() == 2);
+        BOOST_TEST(arena.getPageCount() == 4);
+
+        for (size_t i = 0; i < 2; ++i) {
+            BlockNumber pageNumber = arena.allocatePage();
+            BOOST_TEST((pageNumber == 1 || pageNumber == 2));
+            const char *page = arena.getPage(pageNumber);
+            BOOST_TEST(std::all_of(page, page + PG_PAGE_SIZE, [](char c) { return c == 0; }));
+        }
+        BOOST_TEST(arena.getFreePageCount() == 0);
+        BOOST_TEST(arena.allocatePage() == 4);
+        BOOST_CHECK_THROW(arena.releasePage(5), std::invalid_argument);
+    }
+
+    BOOST_AUTO_TEST_CASE(AttachesExternalPages) {
+        const size_t pageCount = PageArena::kPagesPerChunk + 3;
+        std::vector<char> region(pageCount * PG_PAGE_SIZE);
+        for (size_t i = 0; i < pageCount; ++i) {
+            region[i * PG_PAGE_SIZE] = static_cast<char>(i % 100);
+        }
+
+        PageArena arena;
+        arena.attach(region.data(), pageCount);
+        BOOST_TEST(arena.isReadOnly());
+        BOOST_TEST(arena.getPageCount() == pageCount);
+        for (size_t i = 0; i < pageCount; ++i) {
+            BOOST_TEST(arena.getPage(i) == region.data() + i * PG_PAGE_SIZE);
+        }
+        BOOST_CHECK_THROW(arena.allocatePage(), std::logic_error);
+        BOOST_CHECK_THROW(arena.releasePage(0), std::logic_error);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,8 @@
 #include "pase.hpp"
+#include "test_utils.hpp"
 
 #include <boost/test/unit_test.hpp>
+#include <cstddef>
 #include <cstdlib>
 #include <parser.hpp>
 
@@ -29,24 +31,24 @@ BOOST_AUTO_TEST_SUITE(TestPages)
 
         BOOST_TEST(pase.firstCentroidPage->tuples[0].vec == parsed[0]);
 
-        auto *lastDataPage = pase.firstCentroidPage->tuples[0].firstDataPage;
+        auto *lastDataPage = pase.getDataPage(pase.firstCentroidPage->tuples[0].firstDataPage);
         size_t dataPageCount = 0;
         while (lastDataPage->hasNextPage()) {
-            lastDataPage = lastDataPage->nextPage;
+            lastDataPage = pase.getDataPage(lastDataPage->header.nextPage);
             ++dataPageCount;
         }
+        BOOST_TEST(pase.pageArena.getPageCount() == dataPageCount + 1);
 
-        size_t vectorCountPerDataPage = Page<float>::calcVectorCount(dimension);
+        size_t vectorCountPerDataPage = DataPage<float>::calcVectorCount(dimension);
         size_t lastPageVectorCount = parsed.size() - vectorCountPerDataPage * dataPageCount;
-        auto nextIdsPtr = (u_int32_t *) &(*lastDataPage->getEndTuples(dimension));
+        BOOST_TEST(lastDataPage->header.vectorCount == lastPageVectorCount);
+        BOOST_TEST(pase.firstCentroidPage->tuples[0].vectorCount == parsed.size());
 
-        for (size_t i = 0; i < parsed[0].size(); ++i) {
-            BOOST_TEST(lastDataPage->tuples[(lastPageVectorCount - 1) * parsed[0].size() + i] ==
-                       parsed[parsed.size() - 1][i]);
-        }
+        const float *lastVector = lastDataPage->getVector(lastPageVectorCount - 1, dimension);
+        BOOST_TEST(std::equal(lastVector, lastVector + dimension, parsed.back().begin()));
+        const u_int32_t *pageIds = lastDataPage->getIds(dimension);
         for (size_t i = 0; i < lastPageVectorCount; ++i) {
-            BOOST_TEST(*(nextIdsPtr) == parsed.size() - lastPageVectorCount + i);
-            nextIdsPtr += 4;
+            BOOST_TEST(pageIds[i] == parsed.size() - lastPageVectorCount + i);
         }
 
         auto nextCentroidPage = pase.firstCentroidPage->nextPage;
@@ -60,4 +62,49 @@ BOOST_AUTO_TEST_SUITE(TestPages)
         pase.findNearestVectorIds(parsed[0], 5, 5);
     }
 
+    BOOST_AUTO_TEST_CASE(TestDataPageLayout)
+    {
+        const size_t dimension = 128;
+        BOOST_TEST(sizeof(DataPage<float>) == PG_PAGE_SIZE);
+        BOOST_TEST(offsetof(DataPage<float>, body) % kCacheLineSize == 0);
+
+        // vectors, packed ids and the tombstone bitmap fill the body without overlapping
+        auto calcUsedSize = [](size_t vectorCount, size_t dim) {
+            return vectorCount * (dim * sizeof(float) + sizeof(u_int32_t)) + (vectorCount + 63) / 64 * 8;
+        };
+        for (size_t dim: {1, 3, 17, 128, 960}) {
+            size_t vectorCount = DataPage<float>::calcVectorCount(dim);
+            BOOST_TEST(calcUsedSize(vectorCount, dim) <= DataPage<float>::kBodySize);
+            BOOST_TEST(calcUsedSize(vectorCount + 1, dim) > DataPage<float>::kBodySize);
+            BOOST_TEST(DataPage<float>::calcVectorCount(dim, PageLayout::kBlocked) % kBlockedLanes == 0);
+        }
+        BOOST_TEST(DataPage<u_int8_t>::calcVectorCount(5) * 5 % alignof(u_int32_t) != 0);
+
+        PageArena arena;
+        for (PageLayout layout: {PageLayout::kRowMajor, PageLayout::kBlocked}) {
+            auto *pg = reinterpret_cast<DataPage<float> *>(arena.getPage(arena.allocatePage()));
+            pg->init(layout);
+            size_t vectorCount = DataPage<float>::calcVectorCount(dimension, layout);
+            auto vectors = generateRandomVectors(vectorCount, dimension, 7);
+            for (size_t i = 0; i < vectorCount; ++i) {
+                pg->appendVector(vectors[i].data(), static_cast<u_int32_t>(1000 + i), dimension);
+            }
+            BOOST_TEST(pg->header.vectorCount == vectorCount);
+            std::vector<float> copy(dimension);
+            for (size_t i = 0; i < vectorCount; ++i) {
+                pg->copyVector(i, dimension, copy.data());
+                BOOST_TEST(copy == vectors[i]);
+                BOOST_TEST(pg->getIds(dimension)[i] == 1000 + i);
+            }
+            const char *tombstones = reinterpret_cast<const char *>(pg->getTombstones(dimension));
+            BOOST_TEST(tombstones >= reinterpret_cast<const char *>(pg->getIds(dimension) + vectorCount));
+            BOOST_TEST(tombstones + (vectorCount + 63) / 64 * 8 <= reinterpret_cast<const char *>(pg + 1));
+            BOOST_TEST(pg->markDead(3, dimension));
+            BOOST_TEST(!pg->markDead(3, dimension));
+            BOOST_TEST(pg->header.deadCount == 1);
+            BOOST_TEST(DataPage<float>::isDead(pg->getTombstones(dimension), 3));
+            BOOST_TEST(!DataPage<float>::isDead(pg->getTombstones(dimension), 4));
+        }
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
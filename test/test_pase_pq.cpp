@@ -0,0 +1,88 @@
+#include "pase_pq.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <numeric>
+#include <random>
+#include <vector>
+
+
+namespace {
+    // points scattered around a few random centers, so that quantization keeps neighbourhoods
+    std::vector<std::vector<float>> generateClusteredVectors(size_t vectorCount, size_t dimension, u_int32_t seed) {
+        const auto centers = generateRandomVectors(64, dimension, seed);
+        std::mt19937 gen(seed + 1);
+        std::normal_distribution<float> noise(0, 2);
+        std::vector<std::vector<float>> result(vectorCount);
+        for (size_t i = 0; i < vectorCount; ++i) {
+            result[i] = centers[gen() % centers.size()];
+            for (auto &x: result[i]) {
+                x += noise(gen);
+            }
+        }
+        return result;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(PQSearch)
+
+    BOOST_AUTO_TEST_CASE(AdcKernelMatchesReference) {
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<float> dist(0, 10);
+        for (size_t m: {1, 4, 7, 8, 16, 19, 32}) {
+            std::vector<float> lut(m * 256);
+            std::vector<u_int8_t> code(m);
+            for (auto &x: lut) {
+                x = dist(gen);
+            }
+            for (auto &x: code) {
+                x = static_cast<u_int8_t>(gen() % 256);
+            }
+            BOOST_TEST(pqAdcDistance(lut.data(), code.data(), m) == pqAdcDistanceRef(lut.data(), code.data(), m),
+                       boost::test_tools::tolerance(1e-4f));
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(FindsNeighboursFromCodes) {
+        const size_t dimension = 32;
+        const size_t clusterCount = 8;
+        const size_t subQuantizerCount = 16;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 100;
+
+        const auto baseData = generateClusteredVectors(5000, dimension, 11);
+        const auto testData = generateClusteredVectors(queryVectorCount, dimension, 11);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFPQ<float> pase(dimension, clusterCount, subQuantizerCount);
+        BOOST_CHECK_THROW(pase.add(baseData, ids), std::logic_error);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        // codes and ids take far less than the raw vectors
+        BOOST_TEST(pase.pageArena.getPageCount() * PG_PAGE_SIZE * 4 < baseData.size() * dimension * sizeof(float));
+        size_t storedCount = 0;
+        for (const auto &centroid: pase.centroids) {
+            storedCount += centroid.vectorCount;
+        }
+        BOOST_TEST(storedCount == baseData.size());
+
+        const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        size_t hits = 0;
+        for (size_t i = 0; i < queryVectorCount; ++i) {
+            size_t found = pase.searchInto(testData[i].data(), dimension, nearestVectorsCount, clusterCount,
+                                           foundIds.data(), distances.data());
+            BOOST_TEST(found == nearestVectorsCount);
+            BOOST_TEST(std::is_sorted(distances.begin(), distances.end()));
+            hits += intersection(foundIds, answers[i]);
+        }
+        BOOST_TEST(static_cast<double>(hits) / (queryVectorCount * nearestVectorsCount) > 0.5);
+
+        BOOST_CHECK_THROW(pase.searchInto(testData[0].data(), dimension - 1, nearestVectorsCount, 1,
+                                          foundIds.data(), distances.data()), std::invalid_argument);
+        BOOST_CHECK_THROW(PaseIVFPQ<float>(dimension, clusterCount, 5), std::logic_error);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
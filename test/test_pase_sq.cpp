@@ -0,0 +1,76 @@
+#include "pase_sq.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(SQSearch)
+
+    BOOST_AUTO_TEST_CASE(HalfConversion) {
+        for (float f: {0.0f, -0.0f, 1.0f, -2.25f, 0.5f, 65504.0f, 6.103515625e-05f, 5.960464477539063e-08f}) {
+            BOOST_TEST(halfToFloat(floatToHalf(f)) == f);
+        }
+        BOOST_TEST(std::isinf(halfToFloat(floatToHalf(1e6f))));
+        BOOST_TEST(halfToFloat(floatToHalf(1e-9f)) == 0.0f);
+        // ties round to even
+        BOOST_TEST(halfToFloat(floatToHalf(1.0f + std::ldexp(1.0f, -11))) == 1.0f);
+        BOOST_TEST(halfToFloat(floatToHalf(1.0f + 3 * std::ldexp(1.0f, -11))) == 1.0f + std::ldexp(1.0f, -9));
+    }
+
+    BOOST_AUTO_TEST_CASE(KernelsMatchReference) {
+        std::mt19937 gen(5);
+        std::uniform_real_distribution<float> dist(-50, 50);
+        for (size_t d: {1, 7, 8, 13, 128, 960}) {
+            std::vector<float> x(d), vmin(d), scale(d);
+            std::vector<u_int8_t> code(d);
+            std::vector<u_int16_t> halfCode(d);
+            for (size_t i = 0; i < d; ++i) {
+                x[i] = dist(gen);
+                vmin[i] = dist(gen);
+                scale[i] = std::fabs(dist(gen)) / 255;
+                code[i] = static_cast<u_int8_t>(gen() % 256);
+                halfCode[i] = floatToHalf(dist(gen));
+            }
+            BOOST_TEST(sq8L2sqr(x.data(), code.data(), vmin.data(), scale.data(), d) ==
+                       sq8L2sqrRef(x.data(), code.data(), vmin.data(), scale.data(), d),
+                       boost::test_tools::tolerance(1e-4f));
+            BOOST_TEST(fp16L2sqr(x.data(), halfCode.data(), d) == fp16L2sqrRef(x.data(), halfCode.data(), d),
+                       boost::test_tools::tolerance(1e-4f));
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(SearchesCompressedPages) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 10;
+        const size_t nearestVectorsCount = 10;
+        const size_t queryVectorCount = 50;
+
+        const auto baseData = generateRandomVectors(4000, dimension, 21);
+        const auto testData = generateRandomVectors(queryVectorCount, dimension, 22);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+
+        for (auto [quantizerType, minRecall]: {std::make_pair(ScalarQuantizerType::kSQ8, 0.9),
+                                               std::make_pair(ScalarQuantizerType::kFP16, 0.99)}) {
+            PaseIVFSQ<float> pase(dimension, clusterCount, quantizerType);
+            pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+            const size_t rawPageCount = baseData.size() / DataPage<float>::calcVectorCount(dimension);
+            const size_t compression = quantizerType == ScalarQuantizerType::kSQ8 ? 3 : 2;
+            BOOST_TEST(pase.pageArena.getPageCount() * compression <= rawPageCount + clusterCount * compression);
+
+            size_t hits = 0;
+            for (size_t i = 0; i < queryVectorCount; ++i) {
+                hits += intersection(pase.findNearestVectorIds(testData[i], nearestVectorsCount, clusterCount),
+                                     answers[i]);
+            }
+            BOOST_TEST(static_cast<double>(hits) / (queryVectorCount * nearestVectorsCount) >= minRecall);
+        }
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
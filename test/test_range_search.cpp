@@ -0,0 +1,169 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <vector>
+
+
+namespace {
+    // radius halfway between the rank-th and the next distance from the query, so no vector sits on it
+    float calcRadius(const std::vector<std::vector<float>> &baseData, const std::vector<float> &query, size_t rank) {
+        std::vector<float> dists;
+        for (const auto &vec: baseData) {
+            dists.push_back(fvecL2sqrRef(query.data(), vec.data(), query.size()));
+        }
+        std::sort(dists.begin(), dists.end());
+        return (dists[rank - 1] + dists[rank]) / 2;
+    }
+
+    std::vector<u_int32_t> bruteForceRangeSearch(const std::vector<std::vector<float>> &baseData,
+                                                 const std::vector<float> &query, float radius) {
+        std::vector<u_int32_t> result;
+        for (u_int32_t i = 0; i < baseData.size(); ++i) {
+            if (fvecL2sqrRef(query.data(), baseData[i].data(), query.size()) <= radius) {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+    std::vector<u_int32_t> sortedIds(const u_int32_t *ids, size_t count) {
+        std::vector<u_int32_t> result(ids, ids + count);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(RangeSearch)
+
+    BOOST_AUTO_TEST_CASE(FindsAllVectorsWithinRadius) {
+        const size_t dimension = 16;
+        const size_t clusterCount = 20;
+
+        const auto baseData = generateRandomVectors(5000, dimension, 91);
+        const auto testData = generateRandomVectors(20, dimension, 92);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        for (PageLayout pageLayout: {PageLayout::kRowMajor, PageLayout::kBlocked}) {
+            PaseIVFFlat<float> pase(dimension, clusterCount, pageLayout);
+            pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+            std::vector<float> radiuses;
+            for (size_t i = 0; i < testData.size(); ++i) {
+                // from a few hits to a good part of the index
+                const float radius = calcRadius(baseData, testData[i], 1 + i * i * 5);
+                const auto answer = bruteForceRangeSearch(baseData, testData[i], radius);
+                BOOST_TEST(answer.size() == 1 + i * i * 5);
+
+                RangeSearchResult result = pase.rangeSearch(testData[i], radius);
+                BOOST_TEST(result.getQueryCount() == 1);
+                BOOST_TEST(sortedIds(result.getIds(0), result.getCount(0)) == answer);
+                for (size_t j = 0; j < result.getCount(0); ++j) {
+                    BOOST_TEST(result.getDistances(0)[j] <= radius);
+                }
+            }
+
+            // one radius for the whole batch, every query matches its single search
+            const float radius = calcRadius(baseData, testData[0], 50);
+            const std::vector<float> queries = flatten(testData);
+            RangeSearchResult batchResult = pase.rangeSearchBatch(queries.data(), testData.size(), radius);
+            BOOST_TEST(batchResult.getQueryCount() == testData.size());
+            for (size_t i = 0; i < testData.size(); ++i) {
+                BOOST_TEST(sortedIds(batchResult.getIds(i), batchResult.getCount(i)) ==
+                           bruteForceRangeSearch(baseData, testData[i], radius));
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(StreamsHitsAndSkipsRemovedVectors) {
+        const size_t dimension = 8;
+        const size_t clusterCount = 8;
+
+        const auto baseData = generateRandomVectors(2000, dimension, 93);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const float radius = calcRadius(baseData, baseData[0], 30);
+        auto answer = bruteForceRangeSearch(baseData, baseData[0], radius);
+        pase.remove(answer[1]);
+        answer.erase(answer.begin() + 1);
+
+        std::vector<u_int32_t> hits;
+        size_t hitCount = pase.rangeSearch(baseData[0].data(), dimension, radius, [&hits](u_int32_t id, float) {
+            hits.push_back(id);
+        });
+        BOOST_TEST(hitCount == answer.size());
+        BOOST_TEST(sortedIds(hits.data(), hits.size()) == answer);
+        BOOST_TEST(pase.rangeSearch(baseData[0], -1.0f).ids.empty());
+    }
+
+    BOOST_AUTO_TEST_CASE(ScansEveryClusterForInnerProduct) {
+        const size_t dimension = 8;
+        const size_t clusterCount = 8;
+
+        const auto baseData = generateRandomVectors(2000, dimension, 94);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float, MetricType::kInnerProduct> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        // negated products at most -threshold
+        const float threshold = 2.5f;
+        std::vector<u_int32_t> answer;
+        for (u_int32_t i = 0; i < baseData.size(); ++i) {
+            if (fvecInnerProductRef(baseData[0].data(), baseData[i].data(), dimension) >= threshold) {
+                answer.push_back(i);
+            }
+        }
+        RangeSearchResult result = pase.rangeSearch(baseData[0], -threshold);
+        BOOST_TEST(!answer.empty());
+        BOOST_TEST(sortedIds(result.getIds(0), result.getCount(0)) == answer);
+    }
+
+    BOOST_AUTO_TEST_CASE(ScansEveryClusterWhenSizesAreCapped) {
+        const size_t dimension = 2;
+        const size_t clusterCount = 50;
+        const size_t maxClusterSize = 100;
+
+        // most vectors in a dense core, so the cap moves many of them out of the cell of their nearest centroid
+        std::mt19937 gen(95);
+        std::normal_distribution<float> core(0, 1);
+        std::normal_distribution<float> halo(0, 10);
+        std::vector<std::vector<float>> baseData(5000, std::vector<float>(dimension));
+        for (size_t i = 0; i < baseData.size(); ++i) {
+            for (float &x: baseData[i]) {
+                x = i % 20 == 0 ? halo(gen) : core(gen);
+            }
+        }
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.setMaxClusterSize(maxClusterSize);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        const std::string path = (std::filesystem::temp_directory_path() / "pase_capped_range.idx").string();
+        pase.save(path);
+        const auto loaded = PaseIVFFlat<float>::load(path);
+        const auto mapped = PaseIVFFlat<float>::map(path);
+        BOOST_TEST(loaded->getMaxClusterSize() == maxClusterSize);
+
+        for (size_t i = 0; i < 200; ++i) {
+            const std::vector<float> &query = baseData[i * 25];
+            const float radius = calcRadius(baseData, query, 5);
+            const auto answer = bruteForceRangeSearch(baseData, query, radius);
+            for (const PaseIVFFlat<float> *index: {&pase, loaded.get(), mapped.get()}) {
+                RangeSearchResult result = index->rangeSearch(query, radius);
+                BOOST_TEST(sortedIds(result.getIds(0), result.getCount(0)) == answer);
+            }
+        }
+        std::filesystem::remove(path);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -48,6 +48,8 @@ BOOST_AUTO_TEST_SUITE(VectorSearch)
 
         testSearch(pase, queryVectorCount, nearestVectorsCount, clusterCountToSelect, testData, parsedTestAnswers);
         testSearch(pase, queryVectorCount, 1, clusterCountToSelect, testData, parsedTestAnswers);
+        testSearchBatch(pase, queryVectorCount, nearestVectorsCount, clusterCountToSelect, testData,
+                        parsedTestAnswers);
     }
 
     BOOST_AUTO_TEST_CASE(ANN_SIFT1M) {
@@ -87,6 +89,8 @@ BOOST_AUTO_TEST_SUITE(VectorSearch)
 
         testSearch(pase, queryVectorCount, nearestVectorsCount, clusterCountToSelect, testData, parsedTestAnswers);
         testSearch(pase, queryVectorCount, 1, clusterCountToSelect, testData, parsedTestAnswers);
+        testSearchBatch(pase, queryVectorCount, nearestVectorsCount, clusterCountToSelect, testData,
+                        parsedTestAnswers);
     }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,46 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE test_search_alloc
+
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <numeric>
+#include <vector>
+
+
+// defined next to the replaced global operator new in allocation_counter.cpp, that file is linked only into this
+// binary; kept out of this translation unit so the replaced operator delete is not inlined into the tests
+size_t getAllocationCount();
+
+
+BOOST_AUTO_TEST_SUITE(SearchInto)
+
+    BOOST_AUTO_TEST_CASE(SteadyStateDoesNotAllocate) {
+        const size_t dimension = 128;
+        const size_t nearestVectorsCount = 50;
+
+        const auto baseData = generateRandomVectors(2000, dimension, 8);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        PaseIVFFlat<float> pase(dimension, 10);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        std::vector<const float *> vectors(nearestVectorsCount);
+        // warm up thread local scratch
+        pase.searchInto(baseData[0].data(), dimension, nearestVectorsCount, 3, foundIds.data(), distances.data(),
+                        vectors.data());
+
+        size_t allocationsBefore = getAllocationCount();
+        for (size_t i = 0; i < 100; ++i) {
+            pase.searchInto(baseData[i].data(), dimension, nearestVectorsCount, 3, foundIds.data(),
+                            distances.data());
+            pase.searchInto(baseData[i].data(), dimension, nearestVectorsCount, 3, foundIds.data(),
+                            distances.data(), vectors.data());
+        }
+        BOOST_TEST(getAllocationCount() == allocationsBefore);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,47 @@
+#include "pase.hpp"
+#include "test_utils.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <numeric>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(SearchInto)
+
+    BOOST_AUTO_TEST_CASE(WritesIntoCallerBuffers) {
+        const size_t dimension = 128;
+        const size_t clusterCount = 20;
+        const size_t nearestVectorsCount = 10;
+
+        const auto baseData = generateRandomVectors(4000, dimension, 6);
+        const auto testData = generateRandomVectors(20, dimension, 7);
+        std::vector<u_int32_t> ids(baseData.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        PaseIVFFlat<float> pase(dimension, clusterCount);
+        pase.buildIndex(baseData, baseData, ids, 10, 1e-4);
+        const auto answers = bruteForceSearch(baseData, testData, nearestVectorsCount);
+
+        std::vector<u_int32_t> foundIds(nearestVectorsCount);
+        std::vector<float> distances(nearestVectorsCount);
+        std::vector<const float *> vectors(nearestVectorsCount);
+        for (size_t i = 0; i < testData.size(); ++i) {
+            size_t found = pase.searchInto(testData[i].data(), dimension, nearestVectorsCount, clusterCount,
+                                           foundIds.data(), distances.data(), vectors.data());
+            BOOST_TEST(found == nearestVectorsCount);
+            BOOST_TEST(foundIds == answers[i]);
+            for (size_t j = 0; j < found; ++j) {
+                BOOST_TEST(std::equal(vectors[j], vectors[j] + dimension, baseData[foundIds[j]].begin()));
+            }
+
+            found = pase.searchInto(testData[i].data(), dimension, nearestVectorsCount, 5, foundIds.data(),
+                                    distances.data());
+            BOOST_TEST(found == nearestVectorsCount);
+            BOOST_TEST(foundIds == pase.findNearestVectorIds(testData[i], nearestVectorsCount, 5));
+        }
+
+        BOOST_CHECK_THROW(pase.searchInto(testData[0].data(), dimension - 1, nearestVectorsCount, 5,
+                                          foundIds.data(), distances.data()), std::invalid_argument);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
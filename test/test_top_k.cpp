@@ -0,0 +1,76 @@
+#include "top_k.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(TopKSelection)
+
+    BOOST_AUTO_TEST_CASE(MatchesFullSort) {
+        std::mt19937 gen(42);
+        std::uniform_real_distribution<float> dist(0, 1);
+        std::vector<float> values(5000);
+        for (auto &value: values) {
+            value = dist(gen);
+        }
+        std::vector<float> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+
+        // both the sorted small-k path and the heap path
+        for (size_t k: {1, 7, 100, 101, 1000}) {
+            std::vector<float> distances(k);
+            std::vector<u_int32_t> labels(k);
+            TopK<u_int32_t> topK(distances.data(), labels.data(), k);
+            for (size_t i = 0; i < values.size(); ++i) {
+                topK.push(values[i], i);
+            }
+            topK.finalize();
+
+            BOOST_TEST(topK.size() == k);
+            BOOST_TEST(std::vector<float>(sorted.begin(), sorted.begin() + k) == distances);
+            for (size_t i = 0; i < k; ++i) {
+                BOOST_TEST(values[labels[i]] == distances[i]);
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(PartiallyFilled) {
+        for (size_t k: {10, 200}) {
+            std::vector<float> distances(k);
+            std::vector<u_int32_t> labels(k);
+            TopK<u_int32_t> topK(distances.data(), labels.data(), k);
+            BOOST_TEST(topK.threshold() == std::numeric_limits<float>::infinity());
+            for (u_int32_t i = 0; i < 5; ++i) {
+                topK.push(static_cast<float>(5 - i), i);
+            }
+            topK.finalize();
+            BOOST_TEST(topK.size() == 5);
+            BOOST_TEST(!topK.full());
+            for (u_int32_t i = 0; i < 5; ++i) {
+                BOOST_TEST(distances[i] == static_cast<float>(i + 1));
+                BOOST_TEST(labels[i] == 4 - i);
+            }
+        }
+    }
+
+    BOOST_AUTO_TEST_CASE(ResumesFromStoredCount) {
+        std::vector<float> distances(3);
+        std::vector<u_int32_t> labels(3);
+        size_t count = 0;
+        {
+            TopK<u_int32_t> topK(distances.data(), labels.data(), 3, count);
+            topK.push(3, 3);
+            topK.push(1, 1);
+            count = topK.size();
+        }
+        TopK<u_int32_t> topK(distances.data(), labels.data(), 3, count);
+        topK.push(0.5, 0);
+        topK.push(2, 2);
+        BOOST_TEST(topK.threshold() == 2);
+        topK.finalize();
+        BOOST_TEST(labels == std::vector<u_int32_t>({0, 1, 2}));
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
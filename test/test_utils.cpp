@@ -1,5 +1,7 @@
 #include "test_utils.hpp"
 
+#include <random>
+
 std::pair<double, float>
 testSearch(const PaseIVFFlat<float> &pase, const size_t queryVectorCount, const size_t nearestVectorsCount,
            const size_t clusterCountToSelect, const std::vector<std::vector<float>> &testData,
@@ -28,6 +30,73 @@ testSearch(const PaseIVFFlat<float> &pase, const size_t queryVectorCount, const
     return {1000 * query_time, recall};
 }
 
+std::pair<double, float>
+testSearchBatch(const PaseIVFFlat<float> &pase, const size_t queryVectorCount, const size_t nearestVectorsCount,
+                const size_t clusterCountToSelect, const std::vector<std::vector<float>> &testData,
+                const std::vector<std::vector<u_int32_t>> &parsedTestAnswers) {
+    std::cout << "\nLaunch batch search on " << queryVectorCount << " query vectors.\nCluster count to scan: "
+              << clusterCountToSelect
+              << ".\nLook for " << nearestVectorsCount << " neighbours." << std::endl;
+    const std::vector<float> queries = flatten(
+            std::vector<std::vector<float>>(testData.begin(), testData.begin() + queryVectorCount));
+    double query_time{};
+    BatchSearchResult searchResult;
+    {
+        Timer t("Batch search");
+        searchResult = pase.searchBatch(queries.data(), queryVectorCount, nearestVectorsCount, clusterCountToSelect);
+        query_time = t.elapsed();
+        query_time /= static_cast<double>(queryVectorCount);
+    }
+    double matched = 0;
+    for (size_t i = 0; i < queryVectorCount; ++i) {
+        const u_int32_t *ids = searchResult.getIds(i);
+        matched += intersection(std::vector<u_int32_t>(ids, ids + nearestVectorsCount), parsedTestAnswers[i]);
+    }
+    auto recall = matched / static_cast<double>(queryVectorCount) / static_cast<double>(nearestVectorsCount);
+    std::cout << "R1@" << nearestVectorsCount << ": " << recall << std::endl;
+    BOOST_TEST(recall > 0.5);
+    return {1000 * query_time, recall};
+}
+
+std::vector<std::vector<float>> generateRandomVectors(size_t vectorCount, size_t dimension, u_int32_t seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(0, 100);
+    std::vector<std::vector<float>> result(vectorCount, std::vector<float>(dimension));
+    for (auto &vec: result) {
+        for (auto &x: vec) {
+            x = dist(gen);
+        }
+    }
+    return result;
+}
+
+std::vector<float> flatten(const std::vector<std::vector<float>> &vectors) {
+    std::vector<float> result;
+    result.reserve(vectors.empty() ? 0 : vectors.size() * vectors[0].size());
+    for (const auto &vec: vectors) {
+        result.insert(result.end(), vec.begin(), vec.end());
+    }
+    return result;
+}
+
+std::vector<std::vector<u_int32_t>> bruteForceSearch(const std::vector<std::vector<float>> &baseData,
+                                                     const std::vector<std::vector<float>> &queries,
+                                                     size_t nearestVectorsCount) {
+    std::vector<std::vector<u_int32_t>> result(queries.size());
+    std::vector<std::pair<float, u_int32_t>> dists(baseData.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        for (size_t j = 0; j < baseData.size(); ++j) {
+            dists[j] = {fvecL2sqrRef(queries[i].data(), baseData[j].data(), queries[i].size()),
+                        static_cast<u_int32_t>(j)};
+        }
+        std::partial_sort(dists.begin(), dists.begin() + nearestVectorsCount, dists.end());
+        for (size_t j = 0; j < nearestVectorsCount; ++j) {
+            result[i].push_back(dists[j].second);
+        }
+    }
+    return result;
+}
+
 void profileSift(const std::string &siftDir, const std::string &saveDir) {
     std::cout << "Profiling ANN on SIFT1M" << std::endl;
 
@@ -10,6 +10,22 @@ std::pair<double, float> testSearch(const PaseIVFFlat<float> &pase,
                                     const std::vector<std::vector<float>> &testData,
                                     const std::vector<std::vector<u_int32_t>> &parsedTestAnswers);
 
+std::pair<double, float> testSearchBatch(const PaseIVFFlat<float> &pase,
+                                         const size_t queryVectorCount,
+                                         const size_t nearestVectorsCount,
+                                         const size_t clusterCountToSelect,
+                                         const std::vector<std::vector<float>> &testData,
+                                         const std::vector<std::vector<u_int32_t>> &parsedTestAnswers);
+
+std::vector<std::vector<float>> generateRandomVectors(size_t vectorCount, size_t dimension, u_int32_t seed);
+
+std::vector<float> flatten(const std::vector<std::vector<float>> &vectors);
+
+// exact top nearestVectorsCount ids by squared L2 for every query
+std::vector<std::vector<u_int32_t>> bruteForceSearch(const std::vector<std::vector<float>> &baseData,
+                                                     const std::vector<std::vector<float>> &queries,
+                                                     size_t nearestVectorsCount);
+
 
 void profileSift(const std::string& siftDir, const std::string& saveDir);
 